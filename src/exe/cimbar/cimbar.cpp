@@ -1,14 +1,19 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #include "cimb_translator/Config.h"
 #include "compression/zstd_decompressor.h"
+#include "compression/zstd_dictionary.h"
+#include "encoder/DecodeSession.h"
 #include "encoder/DecoderPlus.h"
 #include "encoder/EncoderPlus.h"
 #include "extractor/Extractor.h"
 #include "extractor/SimpleCameraCalibration.h"
 #include "extractor/Undistort.h"
+#include "fountain/FountainChunkLog.h"
 #include "fountain/FountainInit.h"
 #include "fountain/fountain_decoder_sink.h"
+#include "serialize/format.h"
 #include "serialize/str.h"
+#include "util/File.h"
 
 #include "cxxopts/cxxopts.hpp"
 
@@ -16,6 +21,7 @@
 #include <filesystem>
 #include <functional>
 #include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 using std::string;
@@ -103,11 +109,66 @@ namespace {
 	};
 }
 
+std::optional<cimbar::zstd_dictionary> load_dictionary(const string& path)
+{
+	if (path.empty())
+		return std::nullopt;
+	std::string content = File(path).read_all();
+	if (content.empty())
+	{
+		std::cerr << "couldn't read dictionary " << path << std::endl;
+		return std::nullopt;
+	}
+	return cimbar::zstd_dictionary(content);
+}
+
+int train_dictionary(const string& sample_dir, const string& outpath)
+{
+	// zstd's advice is lots of small samples. Big files only contribute their first bit.
+	static const size_t MAX_SAMPLE_SIZE = 0x20000;
+
+	vector<string> samples;
+	for (const auto& entry : std::filesystem::recursive_directory_iterator(sample_dir))
+	{
+		if (!entry.is_regular_file())
+			continue;
+		string sample = File(entry.path().string()).read_all();
+		if (sample.size() > MAX_SAMPLE_SIZE)
+			sample.resize(MAX_SAMPLE_SIZE);
+		if (!sample.empty())
+			samples.push_back(std::move(sample));
+	}
+	if (samples.empty())
+	{
+		std::cerr << "no samples in " << sample_dir << " :(" << std::endl;
+		return 1;
+	}
+
+	cimbar::zstd_dictionary dict = cimbar::zstd_dictionary::train(samples);
+
+	string dict_path = outpath;
+	if (std::filesystem::is_directory(outpath))
+		dict_path = fmt::format("{}/{:08x}.dict", outpath, dict.id());
+	File f(dict_path, true);
+	if (f.write(dict.data(), dict.size()) != dict.size())
+	{
+		std::cerr << "failed to write " << dict_path << std::endl;
+		return 2;
+	}
+	std::cerr << fmt::format("trained dictionary {:08x} ({} bytes, from {} samples)", dict.id(), dict.size(), samples.size()) << std::endl;
+	std::cout << dict_path << std::endl;
+	return 0;
+}
+
 template <typename FilenameIterable>
-int encode(const FilenameIterable& infiles, const std::string& outpath, int compression_level, bool no_fountain)
+int encode(const FilenameIterable& infiles, const std::string& outpath, int compression_level, unsigned compression_budget, const std::optional<cimbar::zstd_dictionary>& dict, bool no_fountain)
 {
 	EncoderPlus en;
 	en.set_encode_id(109);
+	en.set_frame_header(true);
+	en.set_compression_budget(compression_budget);
+	if (dict)
+		en.set_compression_dictionary(*dict);
 	for (const string& f : infiles)
 	{
 		if (f.empty())
@@ -121,7 +182,7 @@ int encode(const FilenameIterable& infiles, const std::string& outpath, int comp
 }
 
 template <typename FilenameIterable>
-int decode(const FilenameIterable& infiles, const std::function<int(cv::UMat, bool, int)>& decodefun, bool no_deskew, bool undistort, int preprocess, int color_correct)
+int decode(const FilenameIterable& infiles, const std::function<int(cv::UMat, bool, int)>& decodefun, const std::function<int(cv::UMat&)>& extractfun, bool no_deskew, bool undistort, int preprocess, int color_correct)
 {
 	int err = 0;
 	for (const string& inf : infiles)
@@ -143,8 +204,7 @@ int decode(const FilenameIterable& infiles, const std::function<int(cv::UMat, bo
 					err |= 1;
 			}
 
-			Extractor ext;
-			int res = ext.extract(img, img);
+			int res = extractfun(img);
 			if (!res)
 			{
 				err |= 2;
@@ -180,13 +240,17 @@ int main(int argc, char** argv)
 		("n,encode", "Run the encoder!", cxxopts::value<bool>())
 		("i,in", "Encoded pngs/jpgs/etc (for decode), or file to encode", cxxopts::value<vector<string>>())
 		("o,out", "Output file prefix (encoding) or directory (decoding).", cxxopts::value<string>())
-		("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,4C]", cxxopts::value<string>()->default_value("B"))
+		("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. auto (decode only) follows the sender's frame header. [B,Bm,Bu,S,Sd,4C,auto]", cxxopts::value<string>()->default_value("B"))
 		("z,compression", "Compression level. 0 == no compression.", cxxopts::value<int>()->default_value(turbo::str::str(compressionLevel)))
+		("compression-budget", "Rough limit (in ms) on time spent compressing each file. Slow levels fall back to a fast one. 0 == no limit.", cxxopts::value<unsigned>()->default_value("0"))
+		("dictionary", "zstd dictionary to compress (encoding) or decompress (decoding) with. Both sides need the same one.", cxxopts::value<string>())
+		("train-dictionary", "Train a zstd dictionary from the sample files in this directory. Written to --out.", cxxopts::value<string>())
 		("color-correct", "Toggle decoding color correction. 2 == full (fountain mode only). 1 == simple. 0 == off.", cxxopts::value<int>()->default_value("2"))
 		("color-correction-file", "Debug -- save color correction matrix generated during fountain decode, or use it for non-fountain decodes", cxxopts::value<string>())
 		("no-deskew", "Skip the deskew step -- treat input image as already extracted.", cxxopts::value<bool>())
 		("no-fountain", "Disable fountain encode/decode. Will also disable compression.", cxxopts::value<bool>())
 		("undistort", "Attempt undistort step -- useful if image distortion is significant.", cxxopts::value<bool>())
+		("chunk-log", "Don't reassemble the files: write the decoded fountain chunks to this file. See cimbar_merge.", cxxopts::value<string>())
 		("preprocess", "Run sharpen filter on the input image. 1 == on. 0 == off. -1 == guess.", cxxopts::value<int>()->default_value("-1"))
 		("h,help", "Print usage")
 	;
@@ -206,6 +270,9 @@ int main(int argc, char** argv)
 		outpath = result["out"].as<string>();
 	std::cerr << "Output files will appear in " << outpath << std::endl;
 
+	if (result.count("train-dictionary"))
+		return train_dictionary(result["train-dictionary"].as<string>(), outpath);
+
 	bool useStdin = !result.count("in");
 	vector<string> infiles;
 	if (!useStdin)
@@ -224,13 +291,24 @@ int main(int argc, char** argv)
 	bool no_fountain = result.count("no-fountain");
 
 	compressionLevel = result["compression"].as<int>();
+	unsigned compressionBudget = result["compression-budget"].as<unsigned>();
+	std::optional<cimbar::zstd_dictionary> dict;
+	if (result.count("dictionary"))
+	{
+		dict = load_dictionary(result["dictionary"].as<string>());
+		if (!dict)
+			return 3;
+	}
 
 	// set config
 	unsigned config_mode = 68;
+	bool autoMode = false;
 	if (result.count("mode"))
 	{
 		string mode = result["mode"].as<string>();
-		if (mode == "4" or mode == "4c" or mode == "4C")
+		if (mode == "auto" or mode == "Auto")
+			autoMode = true;
+		else if (mode == "4" or mode == "4c" or mode == "4C")
 			config_mode = 4;
 		else if (mode == "8c" or mode == "8C")
 			config_mode = 8;
@@ -238,15 +316,19 @@ int main(int argc, char** argv)
 			config_mode = 66;
 		else if (mode == "Bm" or mode == "BM")
 			config_mode = 67;
+		else if (mode == "S" or mode == "s")
+			config_mode = 83;
+		else if (mode == "Sd" or mode == "SD")
+			config_mode = 84;
 	}
 	cimbar::Config::update(config_mode);
 
 	if (encodeFlag)
 	{
 		if (useStdin)
-			return encode(StdinLineReader(), outpath, compressionLevel, no_fountain);
+			return encode(StdinLineReader(), outpath, compressionLevel, compressionBudget, dict, no_fountain);
 		else
-			return encode(infiles, outpath, compressionLevel, no_fountain);
+			return encode(infiles, outpath, compressionLevel, compressionBudget, dict, no_fountain);
 	}
 
 	// else, decode
@@ -259,6 +341,29 @@ int main(int argc, char** argv)
 	int preprocess = result["preprocess"].as<int>();
 
 	DecoderPlus d;
+	std::function<int(cv::UMat&)> extractfun = [] (cv::UMat& img) {
+		Extractor ext;
+		return ext.extract(img, img);
+	};
+
+	// in auto mode, a session does the extract and the decode -- so it can switch modes when the frame header says to
+	std::optional<DecodeSession> session;
+	if (autoMode)
+	{
+		if (not color_correction_file.empty())
+		{
+			std::cerr << "--color-correction-file doesn't work with auto mode, ignoring it" << std::endl;
+			color_correction_file.clear();
+		}
+		if (no_deskew)
+			std::cerr << "auto mode needs the deskew step to find the mode. Decoding as mode B" << std::endl;
+
+		session.emplace(config_mode);
+		session->set_auto_mode(true);
+		extractfun = [&session] (cv::UMat& img) {
+			return session->extract(img, img);
+		};
+	}
 
 	if (no_fountain)
 	{
@@ -270,29 +375,66 @@ int main(int argc, char** argv)
 		std::function<int(cv::UMat,bool,int)> decodefun = [&f, &d] (cv::UMat m, bool pre, int cc) {
 			return d.decode(m, f, pre, cc);
 		};
+		if (session)
+			decodefun = [&f, &session] (cv::UMat m, bool pre, int cc) {
+				return session->decode(m, f, pre, cc);
+			};
 		if (useStdin)
-			return decode(StdinLineReader(), decodefun, no_deskew, undistort, preprocess, color_correct);
+			return decode(StdinLineReader(), decodefun, extractfun, no_deskew, undistort, preprocess, color_correct);
 		else
-			return decode(infiles, decodefun, no_deskew, undistort, preprocess, color_correct);
+			return decode(infiles, decodefun, extractfun, no_deskew, undistort, preprocess, color_correct);
 	}
 
 	// else, the good stuff
 	int res = -200;
 
 	unsigned chunkSize = cimbar::Config::fountain_chunk_size();
-	if (compressionLevel <= 0)
+	if (result.count("chunk-log"))
 	{
-		fountain_decoder_sink sink(chunkSize, write_on_store<std::ofstream>(outpath, true));
-		res = decode(infiles, fountain_decode_fun(sink, d), no_deskew, undistort, preprocess, color_correct);
+		if (autoMode)
+		{
+			std::cerr << "a chunk log is for one mode. Pick one with -m" << std::endl;
+			return 128;
+		}
+
+		// one shard of a bigger decode. cimbar_merge puts them back together
+		fountain_chunk_log_sink sink(result["chunk-log"].as<string>(), chunkSize);
+		if (!sink.good())
+		{
+			std::cerr << "failed to open chunk log :(" << std::endl;
+			return 5;
+		}
+		if (useStdin)
+			res = decode(StdinLineReader(), fountain_decode_fun(sink, d), extractfun, no_deskew, undistort, preprocess, color_correct);
+		else
+			res = decode(infiles, fountain_decode_fun(sink, d), extractfun, no_deskew, undistort, preprocess, color_correct);
+		std::cerr << fmt::format("{} chunks logged", sink.count()) << std::endl;
 	}
-	else // default case, all bells and whistles
+	else
 	{
-		fountain_decoder_sink sink(chunkSize, write_on_store<cimbar::zstd_decompressor<std::ofstream>>(outpath, true));
+		fountain_store_fun store = write_on_store<std::ofstream>(outpath, true);
+		if (compressionLevel > 0) // default case, all bells and whistles
+		{
+			store = write_on_store<cimbar::zstd_decompressor<std::ofstream>>(outpath, true);
+			if (dict)
+				store = decompress_on_store<std::ofstream>(outpath, true, {*dict});
+		}
+		auto sink = std::make_shared<fountain_decoder_sink>(chunkSize, segmented_on_store(outpath, store));
+
+		std::function<int(cv::UMat,bool,int)> decodefun = fountain_decode_fun(*sink, d);
+		if (session)
+		{
+			// the session keeps the sink's chunk size in step with the mode
+			session->set_sink(sink);
+			decodefun = [&session] (cv::UMat m, bool pre, int cc) {
+				return session->decode_fountain(m, pre, cc);
+			};
+		}
 
 		if (useStdin)
-			res = decode(StdinLineReader(), fountain_decode_fun(sink, d), no_deskew, undistort, preprocess, color_correct);
+			res = decode(StdinLineReader(), decodefun, extractfun, no_deskew, undistort, preprocess, color_correct);
 		else
-			res = decode(infiles, fountain_decode_fun(sink, d), no_deskew, undistort, preprocess, color_correct);
+			res = decode(infiles, decodefun, extractfun, no_deskew, undistort, preprocess, color_correct);
 	}
 	if (not color_correction_file.empty())
 		d.save_ccm(color_correction_file);
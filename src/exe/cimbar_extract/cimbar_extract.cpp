@@ -14,7 +14,7 @@ int main(int argc, char** argv)
 	options.add_options()
 	    ("i,in", "Encoded png/jpg/etc", cxxopts::value<std::string>())
 	    ("o,out", "Output image", cxxopts::value<std::string>())
-	    ("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,4C]", cxxopts::value<string>()->default_value("B"))
+	    ("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,S,Sd,4C]", cxxopts::value<string>()->default_value("B"))
 	    ("h,help", "Print usage")
 	;
 	options.show_positional_help();
@@ -39,6 +39,10 @@ int main(int argc, char** argv)
 			config_mode = 66;
 		else if (mode == "Bm" or mode == "BM")
 			config_mode = 67;
+		else if (mode == "S" or mode == "s")
+			config_mode = 83;
+		else if (mode == "Sd" or mode == "SD")
+			config_mode = 84;
 	}
 	cimbar::Config::update(config_mode);
 
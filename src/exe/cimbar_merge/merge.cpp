@@ -0,0 +1,97 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "compression/zstd_decompressor.h"
+#include "compression/zstd_dictionary.h"
+#include "fountain/FountainChunkLog.h"
+#include "fountain/fountain_decoder_sink.h"
+#include "serialize/format.h"
+#include "serialize/str_join.h"
+#include "util/File.h"
+
+#include "cxxopts/cxxopts.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+using std::string;
+using std::vector;
+
+// put the chunk logs from several `cimbar --chunk-log` runs back together, and recover the files.
+int main(int argc, char** argv)
+{
+	cxxopts::Options options("cimbar chunk log merger", "Recover files from the chunk logs of one or more decoders");
+
+	options.add_options()
+		("i,in", "Chunk logs (from cimbar --chunk-log).", cxxopts::value<vector<string>>())
+		("o,out", "Output directory.", cxxopts::value<string>())
+		("dictionary", "zstd dictionaries the sender might have used.", cxxopts::value<vector<string>>())
+		("no-compression", "The sender didn't compress (cimbar -z 0). Write files out as-is.", cxxopts::value<bool>())
+		("h,help", "Print usage")
+	;
+	options.show_positional_help();
+	options.parse_positional({"in"});
+	options.positional_help("<in...>");
+
+	auto result = options.parse(argc, argv);
+	if (result.count("help") or !result.count("in"))
+	{
+		std::cerr << options.help() << std::endl;
+		return 0;
+	}
+
+	string outpath = std::filesystem::current_path().string();
+	if (result.count("out"))
+		outpath = result["out"].as<string>();
+	std::cerr << "Output files will appear in " << outpath << std::endl;
+
+	vector<std::unique_ptr<FountainChunkLog>> logs;
+	unsigned chunkSize = 0;
+	for (const string& path : result["in"].as<vector<string>>())
+	{
+		auto log = std::make_unique<FountainChunkLog>(path);
+		if (!log->good())
+		{
+			std::cerr << "not a chunk log: " << path << std::endl;
+			return 2;
+		}
+		if (chunkSize and log->chunk_size() != chunkSize)
+		{
+			std::cerr << fmt::format("chunk size mismatch: {} has {}, expected {}. (different cimbar modes?)", path, log->chunk_size(), chunkSize) << std::endl;
+			return 3;
+		}
+		chunkSize = log->chunk_size();
+		logs.push_back(std::move(log));
+	}
+
+	std::vector<cimbar::zstd_dictionary> dicts;
+	if (result.count("dictionary"))
+		for (const string& path : result["dictionary"].as<vector<string>>())
+			dicts.emplace_back(File(path).read_all());
+
+	fountain_store_fun store = result.count("no-compression")?
+		write_on_store<std::ofstream>(outpath, true) :
+		decompress_on_store<std::ofstream>(outpath, true, dicts);
+	fountain_decoder_sink sink(chunkSize, segmented_on_store(outpath, store));
+	sink.set_recover_threads(std::thread::hardware_concurrency());
+
+	// the sink throws out what it doesn't need -- duplicates across logs, chunks for files it's already finished
+	uint64_t total = 0;
+	for (const auto& log : logs)
+	{
+		log->for_each([&sink](const char* chunk, unsigned len) {
+			sink.decode_frame(chunk, len);
+		});
+		total += log->size();
+	}
+
+	std::cerr << fmt::format("{} chunks from {} logs. {} files done.", total, logs.size(), sink.num_done()) << std::endl;
+	if (sink.num_streams())
+	{
+		std::cerr << "incomplete: " << turbo::str::join(sink.get_progress()) << std::endl;
+		return 1;
+	}
+	return sink.num_done()? 0 : 1;
+}
@@ -1,7 +1,8 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #include "cimb_translator/Config.h"
 #include "compression/zstd_decompressor.h"
-#include "encoder/Decoder.h"
+#include "compression/zstd_dictionary.h"
+#include "encoder/DecodeSession.h"
 #include "extractor/Extractor.h"
 #include "fountain/fountain_decoder_sink.h"
 #include "gui/window_glfw.h"
@@ -9,15 +10,19 @@
 #include "cxxopts/cxxopts.hpp"
 #include "serialize/str.h"
 #include "serialize/str_join.h"
+#include "util/File.h"
 
 #include <GLFW/glfw3.h>
 #include <opencv2/videoio.hpp>
 
 #include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 using std::string;
+using std::vector;
 
 namespace {
 
@@ -45,7 +50,9 @@ int main(int argc, char** argv)
 		("c,colorbits", "Color bits. [0-3]", cxxopts::value<int>()->default_value(turbo::str::str(colorBits)))
 		("e,ecc", "ECC level", cxxopts::value<unsigned>()->default_value(turbo::str::str(ecc)))
 		("f,fps", "Target decode FPS", cxxopts::value<unsigned>()->default_value(turbo::str::str(defaultFps)))
-		("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,4C]", cxxopts::value<string>()->default_value("B"))
+		("m,mode", "Select a cimbar mode. B (the default) is new to 0.6.x. 4C is the 0.5.x config. auto follows the sender's frame header. [B,Bm,Bu,S,Sd,4C,auto]", cxxopts::value<string>()->default_value("B"))
+		("dictionary", "zstd dictionaries the sender might have used.", cxxopts::value<vector<string>>())
+		("journal", "Keep received chunks in this file, so an interrupted transfer can pick up where it left off.", cxxopts::value<string>())
 		("h,help", "Print usage")
 	;
 	options.show_positional_help();
@@ -62,19 +69,31 @@ int main(int argc, char** argv)
 	string source = result["in"].as<string>();
 	string outpath = result["out"].as<string>();
 
+	std::vector<cimbar::zstd_dictionary> dicts;
+	if (result.count("dictionary"))
+		for (const string& path : result["dictionary"].as<vector<string>>())
+			dicts.emplace_back(File(path).read_all());
+
 	colorBits = std::min(3, result["colorbits"].as<int>());
 	ecc = result["ecc"].as<unsigned>();
 
 	unsigned config_mode = 68;
+	bool autoMode = false;
 	if (result.count("mode"))
 	{
 		string mode = result["mode"].as<string>();
-		if (mode == "4c" or mode == "4C")
+		if (mode == "auto" or mode == "Auto")
+			autoMode = true;
+		else if (mode == "4c" or mode == "4C")
 			config_mode = 4;
 		else if (mode == "Bu" or mode == "BU")
 			config_mode = 66;
 		else if (mode == "Bm" or mode == "BM")
 			config_mode = 67;
+		else if (mode == "S" or mode == "s")
+			config_mode = 83;
+		else if (mode == "Sd" or mode == "SD")
+			config_mode = 84;
 	}
 	cimbar::Config::update(config_mode);
 
@@ -110,11 +129,23 @@ int main(int argc, char** argv)
 	}
 	window.auto_scale_to_window();
 
-	Extractor ext;
-	Decoder dec;
+	// in auto mode, the session switches modes (and the sink's chunk size) when the frame header says to
+	DecodeSession session(config_mode);
+	session.set_auto_mode(autoMode);
+	session.set_ecc_threads(std::thread::hardware_concurrency());
 
-	unsigned chunkSize = cimbar::Config::fountain_chunk_size();
-	fountain_decoder_sink sink(chunkSize, decompress_on_store<std::ofstream>(outpath, true));
+	unsigned chunkSize = session.conf().fountain_chunk_size();
+	auto sink = std::make_shared<fountain_decoder_sink>(chunkSize, segmented_on_store(outpath, decompress_on_store<std::ofstream>(outpath, true, dicts)));
+	sink->set_recover_threads(std::thread::hardware_concurrency());
+	session.set_sink(sink);
+	if (result.count("journal"))
+	{
+		auto journal = std::make_shared<FountainJournal>(result["journal"].as<string>());
+		if (!sink->set_journal(journal))
+			std::cerr << "couldn't use journal, continuing without it" << std::endl;
+		else
+			std::cerr << fmt::format("journal: resumed {} chunks, {} finished files", journal->on_disk().chunks, journal->on_disk().done) << std::endl;
+	}
 
 	cv::Mat mat;
 
@@ -143,7 +174,7 @@ int main(int argc, char** argv)
 
 		// extract
 		bool shouldPreprocess = false;
-		int res = ext.extract(img, img);
+		int res = session.extract(img, img);
 		if (!res)
 		{
 			//std::cerr << "no extract " << mat.cols << "," << mat.rows << std::endl;
@@ -153,11 +184,11 @@ int main(int argc, char** argv)
 			shouldPreprocess = true;
 
 		// decode
-		int bytes = dec.decode_fountain(img, sink, shouldPreprocess);
+		int bytes = session.decode_fountain(img, shouldPreprocess);
 		if (bytes > 0)
 			std::cerr << "got some bytes " << bytes << std::endl;
 
-		std::cerr << turbo::str::join(sink.get_progress()) << std::endl;
+		std::cerr << turbo::str::join(sink->get_progress()) << std::endl;
 	}
 
 	return 0;
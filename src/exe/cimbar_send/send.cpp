@@ -2,14 +2,17 @@
 #include "cimbar_js/cimbar_js.h"
 
 #include "cimb_translator/Config.h"
+#include "compression/archive.h"
 #include "serialize/str.h"
-#include "util/File.h"
+#include "util/MappedFile.h"
 
 #include "cxxopts/cxxopts.hpp"
 #include <GLFW/glfw3.h>
 
 #include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
@@ -27,6 +30,63 @@ namespace {
 		return std::chrono::high_resolution_clock::now();
 	}
 
+	bool archive_add(const std::filesystem::path& path, const string& name)
+	{
+		MappedFile contents(path.string());
+		if (!contents.good())
+		{
+			std::cerr << "failed to read file " << path.string() << std::endl;
+			return false;
+		}
+		if (cimbare_archive_add(name.data(), name.size(), reinterpret_cast<const unsigned char*>(contents.data()), contents.size()) < 0)
+		{
+			std::cerr << "failed to add " << name << " to archive" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// every input in one stream. Directories go in whole, under their own name.
+	bool encode_archive(const string& archive_name, const vector<string>& infiles)
+	{
+		if (cimbare_init_archive(archive_name.data(), archive_name.size(), -1) < 0)
+		{
+			std::cerr << "failed to 'init archive' " << archive_name << std::endl;
+			return false;
+		}
+
+		unsigned count = 0;
+		for (const string& in : infiles)
+		{
+			std::filesystem::path inpath(in);
+			if (!std::filesystem::is_directory(inpath))
+			{
+				count += archive_add(inpath, inpath.filename().string());
+				continue;
+			}
+
+			for (const auto& entry : std::filesystem::recursive_directory_iterator(inpath))
+			{
+				if (!entry.is_regular_file())
+					continue;
+				count += archive_add(entry.path(), cimbar::archive::entry_name(inpath, entry.path()));
+			}
+		}
+
+		if (count == 0)
+		{
+			std::cerr << "nothing to archive :(" << std::endl;
+			return false;
+		}
+		if (cimbare_encode(nullptr, 0) != 0)
+		{
+			std::cerr << "failed to encode archive " << archive_name << std::endl;
+			return false;
+		}
+		std::cerr << "archived " << count << " files as " << archive_name << std::endl;
+		return true;
+	}
+
 }
 
 
@@ -40,9 +100,11 @@ int main(int argc, char** argv)
 	options.add_options()
 		("i,in", "Source file", cxxopts::value<vector<string>>())
 		("f,fps", "Target FPS", cxxopts::value<unsigned>()->default_value(turbo::str::str(defaultFps)))
-		("m,mode", "Select a cimbar mode. B modes are new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,4C]", cxxopts::value<string>()->default_value("B"))
+		("m,mode", "Select a cimbar mode. B modes are new to 0.6.x. 4C is the 0.5.x config. [B,Bm,Bu,S,Sd,4C]", cxxopts::value<string>()->default_value("B"))
 		("p,padding", "Black padding around image in pixels.", cxxopts::value<unsigned>()->default_value(turbo::str::str(defaultPadding)))
 		("z,compression", "Compression level. 0 == no compression.", cxxopts::value<int>()->default_value(turbo::str::str(compressionLevel)))
+		("compression-budget", "Rough limit (in ms) on time spent compressing each file. Slow levels fall back to a fast one. 0 == no limit.", cxxopts::value<unsigned>()->default_value("0"))
+		("a,archive", "Send all inputs (directories included) as one archive, unpacked by the receiver into a directory with this name.", cxxopts::value<string>())
 		("h,help", "Print usage")
 	;
 	options.show_positional_help();
@@ -58,6 +120,7 @@ int main(int argc, char** argv)
 
 	vector<string> infiles = result["in"].as<vector<string>>();
 	compressionLevel = result["compression"].as<int>();
+	unsigned compressionBudget = result["compression-budget"].as<unsigned>();
 
 	unsigned config_mode = 68;
 	if (result.count("mode"))
@@ -69,6 +132,10 @@ int main(int argc, char** argv)
 			config_mode = 66;
 		else if (mode == "Bm" or mode == "BM")
 			config_mode = 67;
+		else if (mode == "S" or mode == "s")
+			config_mode = 83;
+		else if (mode == "Sd" or mode == "SD")
+			config_mode = 84;
 	}
 	cimbar::Config::update(config_mode);
 
@@ -93,52 +160,90 @@ int main(int argc, char** argv)
 	}
 	cimbare_auto_scale_window(padding);
 	cimbare_configure(config_mode, compressionLevel);
+	cimbare_set_compression_budget(compressionBudget);
 
 	std::chrono::time_point start = std::chrono::high_resolution_clock::now();
-	while (true)
-		for (unsigned i = 0; i < infiles.size(); ++i)
+	if (result.count("archive"))
+	{
+		if (!encode_archive(result["archive"].as<string>(), infiles))
+			return 1;
+		while (true)
 		{
-			// delay, then try to read file
 			start = wait_for_frame_time(delay, start);
-			// TODO: maybe delay is the wrong thing to do here. Might be best to just kick out any files that fail to read?
-			// we can then error out properly if all inputs are bad, which would be nice.
+			if (cimbare_render() < 0)
+				return 0;
+			cimbare_next_frame();
+		}
+	}
+
+	// the next file is compressed and encoded in the background, while the current one is on screen.
+	// `nextContents` has to outlive that work.
+	std::unique_ptr<MappedFile> nextContents;
+	// tries (at most) `count` files, starting at `start` and wrapping around
+	auto prepare_from = [&infiles, &nextContents](unsigned start, unsigned count) -> int {
+		for (unsigned n = 0; n < count; ++n)
+		{
+			unsigned i = (start + n) % infiles.size();
+			const string& filename = infiles[i];
+			auto contents = std::make_unique<MappedFile>(filename);
+			if (!contents->good() or contents->size() == 0)
 			{
-				const string& filename = infiles[i];
-				string contents = File(filename).read_all();
-				if (contents.empty())
-				{
-					std::cerr << "failed to read file " << filename << std::endl;
-					continue;
-				}
-
-				if (cimbare_init_encode(filename.data(), filename.size(), -1) < 0)
-				{
-					std::cerr << "failed to 'init encode' file " << filename << std::endl;
-					continue; // abort??
-				}
-
-				int res = cimbare_encode(reinterpret_cast<unsigned char*>(contents.data()), contents.size());
-				if (res < 0)
-				{
-					std::cerr << "failed to compress file " << filename << std::endl;
-					continue;
-				}
-				else if (res == 1 and cimbare_encode(nullptr, 0) != 0) // fallback finish encode
-				{
-					std::cerr << "failed to encode for file" << filename << std::endl;
-					continue;
-				}
+				std::cerr << "failed to read file " << filename << std::endl;
+				continue;
 			}
 
-			// after loading our current file, render frames to the screen until next_frame() loops
-			int frameCount = 0;
-			do {
-				start = wait_for_frame_time(delay, start);
-				if (cimbare_render() < 0)
-					return 0;
+			if (cimbare_prepare_next(filename.data(), filename.size(), reinterpret_cast<const unsigned char*>(contents->data()), contents->size(), -1) < 0)
+			{
+				std::cerr << "failed to 'prepare encode' file " << filename << std::endl;
+				continue;
 			}
-			while (++frameCount == cimbare_next_frame()); // when next_frame() finally loops, we roll to the next file
+			nextContents = std::move(contents);
+			return i;
 		}
+		return -1;
+	};
+
+	// the first file, we have to wait for. One pass through the list, no wrapping
+	const unsigned numFiles = infiles.size();
+	int current = prepare_from(0, numFiles);
+	while (current >= 0 and cimbare_swap_next(true) < 0)
+	{
+		std::cerr << "failed to encode file " << infiles[current] << std::endl;
+		current = prepare_from(current + 1, numFiles - current - 1);
+	}
+	if (current < 0)
+	{
+		std::cerr << "no usable input files :(" << std::endl;
+		return 1;
+	}
+
+	// everything but `current`, in order
+	int next = prepare_from(current + 1, numFiles - 1);
+	while (true)
+	{
+		// render frames to the screen until next_frame() loops
+		int frameCount = 0;
+		do {
+			start = wait_for_frame_time(delay, start);
+			if (cimbare_render() < 0)
+				return 0;
+		}
+		while (++frameCount == cimbare_next_frame());
+
+		// then roll to the next file -- if it's ready. If not, we go around again
+		if (next < 0)
+			continue;
+		int res = cimbare_swap_next();
+		if (res == 0)
+			continue;
+		if (res < 0)
+			std::cerr << "failed to encode file " << infiles[next] << std::endl;
+		else
+			current = next;
+
+		// whatever's left between `next` and `current`. If that comes up empty, we're done rolling
+		next = prepare_from(next + 1, (current + numFiles - next - 1) % numFiles);
+	}
 
 	return 0; // should never reach here
 }
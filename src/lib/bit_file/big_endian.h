@@ -0,0 +1,50 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 8 bytes <-> uint64_t, most significant byte first. That's the bit order bitbuffer/bitreader use,
+// so a word load lets us get at up to 57 (arbitrarily aligned) bits at once.
+// written byte by byte so it's endian-agnostic -- gcc/clang/msvc all turn these into a single load/store + bswap.
+namespace big_endian
+{
+	inline uint64_t load64(const char* p)
+	{
+		const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+		return (uint64_t(b[0]) << 56) | (uint64_t(b[1]) << 48) | (uint64_t(b[2]) << 40) | (uint64_t(b[3]) << 32) |
+			(uint64_t(b[4]) << 24) | (uint64_t(b[5]) << 16) | (uint64_t(b[6]) << 8) | uint64_t(b[7]);
+	}
+
+	inline void store64(char* p, uint64_t val)
+	{
+		uint8_t* b = reinterpret_cast<uint8_t*>(p);
+		b[0] = val >> 56;
+		b[1] = val >> 48;
+		b[2] = val >> 40;
+		b[3] = val >> 32;
+		b[4] = val >> 24;
+		b[5] = val >> 16;
+		b[6] = val >> 8;
+		b[7] = val;
+	}
+
+	// the slow way, for the last few bytes of a buffer. Missing bytes read as 0.
+	inline uint64_t load64_partial(const char* p, size_t len)
+	{
+		uint64_t val = 0;
+		for (size_t i = 0; i < 8; ++i)
+		{
+			val <<= 8;
+			if (i < len)
+				val |= static_cast<uint8_t>(p[i]);
+		}
+		return val;
+	}
+
+	inline void store64_partial(char* p, size_t len, uint64_t val)
+	{
+		for (size_t i = 0; i < len and i < 8; ++i)
+			p[i] = static_cast<char>(val >> (56 - i*8));
+	}
+}
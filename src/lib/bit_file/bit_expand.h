@@ -0,0 +1,129 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "big_endian.h"
+#include "wordreader.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+// bytes -> an array of N-bit fields (msb first, same as bitreader), one uint16_t per field.
+// each field is shifted up by `shift` and OR'd in, so two calls build (b << shift) | a. shift + N should be <= 16.
+// the encoder uses this to turn its ecc'd stream into per-cell tile indices.
+//
+// 1/2/4/8 bit fields go 8 input bytes at a time, 4 fields -> 4 uint16_t lanes per step: with BMI2's pdep if the
+// compiler is allowed to use it (-mbmi2, or -march=haswell and up), and with a multiply otherwise.
+// anything else goes through wordreader.
+namespace bit_expand
+{
+	namespace detail
+	{
+		// out[0..3] |= the 4 16-bit lanes of `cells`, lane 0 being the low bits
+		inline void or_lanes(uint16_t* out, uint64_t cells)
+		{
+#if (defined(__BYTE_ORDER__) and __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) or defined(_MSC_VER)
+			uint64_t cur;
+			memcpy(&cur, out, sizeof cur);
+			cur |= cells;
+			memcpy(out, &cur, sizeof cur);
+#else
+			for (unsigned k = 0; k < 4; ++k)
+				out[k] |= static_cast<uint16_t>(cells >> 16*k);
+#endif
+		}
+
+#if defined(__BMI2__)
+		// within each byte, put the fields in reverse order. Combined with a little endian load, field k ends up at bit k*BITS.
+		template <unsigned BITS>
+		inline uint64_t reverse_fields(uint64_t word)
+		{
+			if constexpr (BITS <= 4)
+				word = ((word >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((word & 0x0F0F0F0F0F0F0F0FULL) << 4);
+			if constexpr (BITS <= 2)
+				word = ((word >> 2) & 0x3333333333333333ULL) | ((word & 0x3333333333333333ULL) << 2);
+			if constexpr (BITS == 1)
+				word = ((word >> 1) & 0x5555555555555555ULL) | ((word & 0x5555555555555555ULL) << 1);
+			return word;
+		}
+
+		template <unsigned BITS>
+		inline void expand_word(const char* in, uint16_t* out, unsigned shift)
+		{
+			// x86 (the only place we have pdep) is little endian, so this is the byte order we want
+			uint64_t word;
+			memcpy(&word, in, sizeof word);
+			word = reverse_fields<BITS>(word);
+
+			const uint64_t lanes = (((uint64_t(1) << BITS) - 1) * 0x0001000100010001ULL) << shift;
+			for (unsigned g = 0; g < 16/BITS; ++g)
+				or_lanes(out + g*4, _pdep_u64(word >> (g*4*BITS), lanes));
+		}
+#else
+		// no pdep: same idea, with a multiply. Multiplying 4 fields (4*BITS bits) by M lays a copy of them every 16+BITS bits,
+		// lined up so that after >> 3*BITS, field k sits at the bottom of 16 bit lane k. For BITS <= 4, the copies don't overlap.
+		template <unsigned BITS>
+		inline void expand_word(const char* in, uint16_t* out, unsigned shift)
+		{
+			if constexpr (BITS == 8)
+			{
+				const uint8_t* bytes = reinterpret_cast<const uint8_t*>(in);
+				for (unsigned i = 0; i < 8; ++i)
+					out[i] |= bytes[i] << shift;
+			}
+			else
+			{
+				constexpr uint64_t M = 1 | (uint64_t(1) << (16+BITS)) | (uint64_t(1) << 2*(16+BITS)) | (uint64_t(1) << 3*(16+BITS));
+				const uint64_t lanes = (((uint64_t(1) << BITS) - 1) * 0x0001000100010001ULL) << shift;
+				const uint64_t word = big_endian::load64(in);
+				for (unsigned g = 0; g < 16/BITS; ++g)
+				{
+					uint64_t v = (word >> (64 - 4*BITS*(g+1))) & ((uint64_t(1) << 4*BITS) - 1);
+					or_lanes(out + g*4, (((v * M) >> 3*BITS) << shift) & lanes);
+				}
+			}
+		}
+#endif
+
+		template <unsigned BITS>
+		inline size_t expand_fast(const char* in, size_t in_bytes, uint16_t* out, size_t count, unsigned shift)
+		{
+			constexpr size_t FIELDS = 64 / BITS;
+			size_t i = 0;
+			for (; i + FIELDS <= count; i += FIELDS, in += 8)
+				expand_word<BITS>(in, out + i, shift);
+
+			// the rest, one at a time
+			wordreader wr(in, in_bytes - i*BITS/8);
+			for (; i < count; ++i)
+				out[i] |= wr.read(BITS) << shift;
+			return count;
+		}
+	}
+
+	// writes min(count, in_bytes*8/bits) fields -- partial fields at the end are dropped. Returns that number.
+	inline size_t expand(const char* in, size_t in_bytes, uint16_t* out, size_t count, unsigned bits, unsigned shift=0)
+	{
+		if (!bits)
+			return 0;
+		count = std::min(count, in_bytes*8 / bits);
+
+		switch (bits)
+		{
+			case 1: return detail::expand_fast<1>(in, in_bytes, out, count, shift);
+			case 2: return detail::expand_fast<2>(in, in_bytes, out, count, shift);
+			case 4: return detail::expand_fast<4>(in, in_bytes, out, count, shift);
+			case 8: return detail::expand_fast<8>(in, in_bytes, out, count, shift);
+			default: break;
+		}
+
+		wordreader wr(in, in_bytes);
+		for (size_t i = 0; i < count; ++i)
+			out[i] |= wr.read(bits) << shift;
+		return count;
+	}
+}
@@ -0,0 +1,47 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "bit_expand.h"
+#include "bitreader.h"
+#include <string>
+#include <vector>
+
+TEST_CASE( "bit_expandTest/testSimple", "[unit]" )
+{
+	std::string input = "\x7C\xA0\xD1";
+	std::vector<uint16_t> cells(4, 0);
+	assertEquals( 4, bit_expand::expand(input.data(), input.size(), cells.data(), cells.size(), 6) );
+	assertEquals( std::vector<uint16_t>({31, 10, 3, 17}), cells );
+}
+
+TEST_CASE( "bit_expandTest/testSymbolsThenColors", "[unit]" )
+{
+	// 4 bit symbols, then 2 bit colors on top
+	std::string symbols = "\x12\x34\x56\x78\x9A\xBC\xDE\xF0\x11\x22";
+	std::string colors = "\xE4\x1B\xFF";
+
+	std::vector<uint16_t> cells(12, 0);
+	assertEquals( 12, bit_expand::expand(colors.data(), colors.size(), cells.data(), cells.size(), 2, 4) );
+	assertEquals( 12, bit_expand::expand(symbols.data(), symbols.size(), cells.data(), cells.size(), 4) );
+	assertEquals( std::vector<uint16_t>({49, 34, 19, 4, 5, 22, 39, 56, 57, 58, 59, 60}), cells );
+}
+
+TEST_CASE( "bit_expandTest/testMatchesBitreader", "[unit]" )
+{
+	std::string input;
+	for (unsigned i = 0; i < 203; ++i)
+		input += static_cast<char>(i * 0x9D + 7);
+
+	for (unsigned bits : {1, 2, 3, 4, 5, 6, 8})
+	{
+		std::vector<uint16_t> cells(300, 0);
+		size_t count = bit_expand::expand(input.data(), input.size(), cells.data(), cells.size(), bits, 3);
+		assertEquals( std::min<size_t>(300, input.size()*8/bits), count );
+
+		bitreader br(input.data(), input.size());
+		std::vector<uint16_t> expected(300, 0);
+		for (unsigned i = 0; i < count; ++i)
+			expected[i] = br.read(bits) << 3;
+		assertEquals( expected, cells );
+	}
+}
@@ -0,0 +1,40 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "wordreader.h"
+#include "bitreader.h"
+#include <string>
+#include <vector>
+
+TEST_CASE( "wordreaderTest/testSimple", "[unit]" )
+{
+	std::string input = "Hello ";
+	wordreader wr(input.data(), input.size());
+	assertEquals( 0x48, wr.read(8) );
+	assertEquals( 0x65, wr.read(8) );
+	assertEquals( 0x6c, wr.read(8) );
+	assertEquals( 0x6c, wr.read(8) );
+	assertEquals( 0x6f, wr.read(8) );
+	assertEquals( 8, wr.remaining() );
+	assertEquals( 0x20, wr.read(8) );
+
+	assertTrue( wr.empty() );
+	assertEquals( 0, wr.remaining() );
+	assertEquals( 0, wr.read(8) );
+}
+
+TEST_CASE( "wordreaderTest/testMatchesBitreader", "[unit]" )
+{
+	std::string input = "the quick brown fox jumps over the lazy dog, again and again";
+	std::vector<unsigned> lengths = {6, 2, 1, 10, 3, 32, 7, 4, 5};
+
+	bitreader br(input.data(), input.size());
+	wordreader wr(input.data(), input.size());
+
+	unsigned i = 0;
+	while (wr.remaining() >= 32)
+	{
+		unsigned len = lengths[i++ % lengths.size()];
+		assertEquals( br.read(len), wr.read(len) );
+	}
+}
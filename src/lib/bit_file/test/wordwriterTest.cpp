@@ -0,0 +1,98 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "wordwriter.h"
+#include "bitbuffer.h"
+#include <string>
+#include <vector>
+
+TEST_CASE( "wordwriterTest/testWrite.6", "[unit]" )
+{
+	std::vector<char> buff(3, 0);
+	wordwriter ww(buff.data(), buff.size());
+	ww.write(0x1F, 6);
+	ww.write(0x0A, 6);
+	ww.write(0x03, 6);
+	ww.write(0x11, 6);
+	assertEquals( 3, ww.flush() );
+
+	// same as bitbufferTest/testSimple.6
+	assertEquals( 0x7C, (int)(unsigned char)buff[0] );
+	assertEquals( 0xA0, (int)(unsigned char)buff[1] );
+	assertEquals( 0xD1, (int)(unsigned char)buff[2] );
+}
+
+TEST_CASE( "wordwriterTest/testWrite.mixed", "[unit]" )
+{
+	// odd lengths, across several words. Should match bitbuffer exactly
+	std::vector<unsigned> lengths = {3, 7, 1, 10, 5, 32, 13, 8, 2, 6, 17, 4};
+
+	bitbuffer bb(64);
+	std::vector<char> buff(64, 0);
+	wordwriter ww(buff.data(), buff.size());
+
+	unsigned pos = 0;
+	for (unsigned i = 0; i < 40; ++i)
+	{
+		unsigned len = lengths[i % lengths.size()];
+		unsigned val = (i * 0x9E3779B9u) >> (32 - len);
+		bb.write(val, pos, len);
+		ww.write(val, len);
+		pos += len;
+	}
+	// the (masked off) garbage above `length` doesn't leak in
+	ww.write(0xFFFFFFF0, 4);
+	bb.write(0, pos, 4);
+	pos += 4;
+
+	assertEquals( (pos+7)/8, ww.flush() );
+	assertEquals( std::string(bb.buffer().data(), ww.flush()), std::string(buff.data(), ww.flush()) );
+}
+
+TEST_CASE( "wordwriterTest/testScatter", "[unit]" )
+{
+	std::vector<uint8_t> values = {13, 7, 1, 5, 13, 7, 12, 14, 13, 7, 2};
+	std::vector<unsigned> slots = {10, 2, 5, 0, 7, 3, 9, 1, 8, 4, 6};
+
+	bitbuffer bb(9);
+	for (unsigned k = 0; k < values.size(); ++k)
+		bb.write(values[k], slots[k]*6, 6);
+
+	std::vector<char> buff(9, 0);
+	wordwriter ww(buff.data(), buff.size());
+	ww.scatter(values.data(), slots.data(), values.size(), 6);
+
+	assertEquals( std::string(bb.buffer().data(), 9), std::string(buff.data(), 9) );
+}
+
+TEST_CASE( "wordwriterTest/testGather", "[unit]" )
+{
+	// the inverse of testScatter's slots. Should come out the same
+	std::vector<uint8_t> values = {13, 7, 1, 5, 13, 7, 12, 14, 13, 7, 2};
+	std::vector<uint16_t> indices = {3, 7, 1, 5, 9, 2, 10, 4, 8, 6, 0};
+
+	bitbuffer bb(9);
+	for (unsigned s = 0; s < indices.size(); ++s)
+		bb.write(values[indices[s]], s*6, 6);
+
+	std::vector<char> buff(9, 0x55); // doesn't need to start zeroed
+	wordwriter ww(buff.data(), buff.size());
+	ww.gather(values.data(), indices.data(), indices.size(), 6);
+
+	assertEquals( std::string(bb.buffer().data(), 9), std::string(buff.data(), 9) );
+}
+
+TEST_CASE( "wordwriterTest/testScatterPastEnd", "[unit]" )
+{
+	// 6 slots of 3 bits is more than 2 bytes. The last one hangs off the end -- only its first bit makes it in
+	std::vector<uint16_t> values = {7, 0, 7, 0, 7, 7};
+	std::vector<uint16_t> slots = {0, 1, 2, 3, 4, 5};
+
+	std::vector<char> buff(3, 0);
+	wordwriter ww(buff.data(), 2);
+	ww.scatter(values.data(), slots.data(), values.size(), 3);
+
+	assertEquals( 0xE3, (int)(unsigned char)buff[0] );
+	assertEquals( 0x8F, (int)(unsigned char)buff[1] );
+	assertEquals( 0, buff[2] );
+}
@@ -0,0 +1,51 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "big_endian.h"
+#include <cstddef>
+#include <cstdint>
+
+// buffer -> bits, a word at a time. Same bit order as bitreader (msb first).
+// the "refill" is just an unaligned 8 byte load at the current byte, shifted by the bit offset --
+// no per-byte loop, and no branch on how many bits are left in the accumulator. Only the last 7 bytes of the buffer go the slow way.
+// unlike bitreader, there's no partial state: reading past the end gives 0s. Check remaining() if you care.
+class wordreader
+{
+public:
+	wordreader(const char* buffer, size_t size)
+		: _buffer(buffer)
+		, _size(size)
+	{}
+
+	// 1 <= length <= 32
+	unsigned read(unsigned length)
+	{
+		uint64_t word = load(_pos >> 3) << (_pos & 7);
+		_pos += length;
+		return static_cast<unsigned>(word >> (64 - length));
+	}
+
+	bool empty() const
+	{
+		return _pos >= _size*8;
+	}
+
+	// in bits
+	size_t remaining() const
+	{
+		return empty()? 0 : _size*8 - _pos;
+	}
+
+protected:
+	uint64_t load(size_t byte) const
+	{
+		if (byte + 8 <= _size)
+			return big_endian::load64(_buffer + byte);
+		return big_endian::load64_partial(_buffer + byte, byte < _size? _size - byte : 0);
+	}
+
+protected:
+	const char* _buffer;
+	size_t _size;
+	size_t _pos = 0; // bits
+};
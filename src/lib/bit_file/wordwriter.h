@@ -0,0 +1,91 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "big_endian.h"
+#include <cstddef>
+#include <cstdint>
+
+// write bits -> buffer, a word at a time. Same bit layout as bitbuffer (msb first), but:
+// * bits pile up in a 64-bit accumulator, and *every* write stores all 8 bytes of it, then advances past the complete ones.
+//   the incomplete tail gets rewritten by the next store, so there's no "is it time to flush?" branch.
+// * no resizing. The buffer is whatever the caller gave us -- writes past the end are dropped.
+// * scatter() for the (interleaved) "value k goes in slot lookup[k]" case: a read-modify-write of one word per value.
+//   or gather(), if you have the slot -> value mapping instead. That one rides on write().
+class wordwriter
+{
+public:
+	wordwriter(char* buffer, size_t size)
+		: _buffer(buffer)
+		, _size(size)
+	{}
+
+	// length <= 32
+	void write(uint64_t bits, unsigned length)
+	{
+		_acc |= (bits & mask(length)) << (64 - _count - length);
+		_count += length;
+		store(_pos, _acc);
+
+		unsigned bytes = _count >> 3;
+		_pos += bytes;
+		_acc <<= bytes << 3; // _count was < 8 before this write, so this is <= 32
+		_count &= 7;
+	}
+
+	// everything's already in the buffer. Returns the number of bytes we've touched.
+	size_t flush() const
+	{
+		size_t bytes = _pos + (_count + 7) / 8;
+		return bytes < _size? bytes : _size;
+	}
+
+	// values[k] goes in slot slots[k], where each slot is `length` bits wide (length <= 32).
+	// values are OR'd in, so the buffer should start out zeroed.
+	template <typename VALUE, typename INDEX>
+	void scatter(const VALUE* values, const INDEX* slots, size_t count, unsigned length)
+	{
+		uint64_t m = mask(length);
+		for (size_t k = 0; k < count; ++k)
+			write_at(values[k] & m, static_cast<size_t>(slots[k]) * length, length);
+	}
+
+	// the other way around: slot s gets values[indices[s]]. These are sequential write()s, so the buffer doesn't need to be zeroed.
+	template <typename VALUE, typename INDEX>
+	void gather(const VALUE* values, const INDEX* indices, size_t count, unsigned length)
+	{
+		for (size_t s = 0; s < count; ++s)
+			write(values[indices[s]], length);
+	}
+
+	// OR `length` bits in at bit position `pos`
+	void write_at(uint64_t bits, size_t pos, unsigned length)
+	{
+		size_t byte = pos >> 3;
+		uint64_t shifted = bits << (64 - (pos & 7) - length);
+		if (byte + 8 <= _size)
+			big_endian::store64(_buffer + byte, big_endian::load64(_buffer + byte) | shifted);
+		else if (byte < _size)
+			big_endian::store64_partial(_buffer + byte, _size - byte, big_endian::load64_partial(_buffer + byte, _size - byte) | shifted);
+	}
+
+protected:
+	static uint64_t mask(unsigned length)
+	{
+		return (uint64_t(1) << length) - 1;
+	}
+
+	void store(size_t byte, uint64_t val)
+	{
+		if (byte + 8 <= _size)
+			big_endian::store64(_buffer + byte, val);
+		else if (byte < _size)
+			big_endian::store64_partial(_buffer + byte, _size - byte, val);
+	}
+
+protected:
+	char* _buffer;
+	size_t _size;
+	size_t _pos = 0; // bytes
+	uint64_t _acc = 0;
+	unsigned _count = 0; // bits in _acc. Always < 8 between writes
+};
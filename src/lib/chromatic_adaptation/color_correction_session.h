@@ -0,0 +1,162 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "color_correction.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <tuple>
+
+// a ccm that lives across frames (and decode threads), rather than being rebuilt from scratch for every frame.
+//  * new per-frame estimates are blended in with an exponential moving average
+//  * an estimate that's way off from what we have is an outlier, and ignored. Unless they keep coming -- then the lighting changed.
+//  * while we're confident and the white point (see CimbReader) hasn't moved, the caller can skip the estimate entirely.
+// thread safe. Share one between Decoders with Decoder::set_color_session().
+class color_correction_session
+{
+public:
+	struct params
+	{
+		float alpha = 0.25f; // weight of a new estimate in the average
+		float outlier = 0.35f; // relative distance (frobenius) past which an estimate is an outlier
+		unsigned max_rejects = 3; // this many outliers in a row, and we start over from the latest one
+		float white_tolerance = 8.0f; // per channel. More than this, and the lighting isn't stable
+		float stable_confidence = 0.75f;
+		unsigned max_skips = 10; // re-estimate at least this often, even if everything looks stable
+	};
+
+public:
+	color_correction_session() = default;
+
+	color_correction_session(const params& p)
+		: _params(p)
+	{}
+
+	// is the ccm we have good for a frame with this white point? If so, we count it as a skipped estimate.
+	bool is_stable(const std::tuple<float, float, float>& white)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!_active or _confidence < _params.stable_confidence or _skips >= _params.max_skips)
+			return false;
+		if (white_distance(white) > _params.white_tolerance)
+			return false;
+		++_skips;
+		return true;
+	}
+
+	// blend in a fresh estimate. Returns false if we threw it out.
+	bool update(const cv::Matx<float, 3, 3>& ccm, const std::tuple<float, float, float>& white)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (!valid(ccm))
+			return false;
+
+		if (!_active)
+		{
+			start_over(ccm, white);
+			return true;
+		}
+
+		float dist = distance(ccm);
+		if (dist > _params.outlier)
+		{
+			_confidence *= 0.5f;
+			if (++_rejects < _params.max_rejects)
+				return false;
+			start_over(ccm, white);
+			return true;
+		}
+
+		_ccm = _ccm * (1.0f - _params.alpha) + ccm * _params.alpha;
+		_white = white;
+		_rejects = 0;
+		_skips = 0;
+
+		// agreeing estimates build confidence. Borderline ones don't.
+		float agreement = 1.0f - (dist / _params.outlier);
+		_confidence += 0.5f * (agreement - _confidence);
+		return true;
+	}
+
+	cv::Matx<float, 3, 3> ccm() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _ccm;
+	}
+
+	bool active() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _active;
+	}
+
+	// 0 (no idea) -> 1 (every estimate agrees)
+	float confidence() const
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _confidence;
+	}
+
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_active = false;
+		_confidence = 0;
+		_rejects = 0;
+		_skips = 0;
+	}
+
+protected:
+	void start_over(const cv::Matx<float, 3, 3>& ccm, const std::tuple<float, float, float>& white)
+	{
+		_ccm = ccm;
+		_white = white;
+		_active = true;
+		_confidence = 0.25f;
+		_rejects = 0;
+		_skips = 0;
+	}
+
+	static bool valid(const cv::Matx<float, 3, 3>& ccm)
+	{
+		for (float v : ccm.val)
+			if (!std::isfinite(v))
+				return false;
+		return true;
+	}
+
+	float distance(const cv::Matx<float, 3, 3>& ccm) const
+	{
+		float diff = 0;
+		float norm = 0;
+		for (unsigned i = 0; i < 9; ++i)
+		{
+			diff += (ccm.val[i] - _ccm.val[i]) * (ccm.val[i] - _ccm.val[i]);
+			norm += _ccm.val[i] * _ccm.val[i];
+		}
+		if (norm <= 0)
+			return diff > 0? INFINITY : 0;
+		return std::sqrt(diff / norm);
+	}
+
+	float white_distance(const std::tuple<float, float, float>& white) const
+	{
+		return std::max({
+			std::abs(std::get<0>(white) - std::get<0>(_white)),
+			std::abs(std::get<1>(white) - std::get<1>(_white)),
+			std::abs(std::get<2>(white) - std::get<2>(_white))
+		});
+	}
+
+protected:
+	params _params;
+	mutable std::mutex _mutex;
+
+	cv::Matx<float, 3, 3> _ccm;
+	std::tuple<float, float, float> _white;
+	bool _active = false;
+	float _confidence = 0;
+	unsigned _rejects = 0;
+	unsigned _skips = 0;
+};
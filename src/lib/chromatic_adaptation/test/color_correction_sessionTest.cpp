@@ -0,0 +1,95 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "color_correction_session.h"
+
+#include <cmath>
+#include <tuple>
+
+namespace {
+	cv::Matx<float, 3, 3> scaled(float s)
+	{
+		return cv::Matx<float, 3, 3>(
+			s, 0, 0,
+			0, s, 0,
+			0, 0, s
+		);
+	}
+}
+
+TEST_CASE( "color_correction_sessionTest/testAverage", "[unit]" )
+{
+	color_correction_session session;
+	std::tuple<float, float, float> white(240, 240, 230);
+	assertFalse( session.active() );
+	assertFalse( session.is_stable(white) );
+
+	// the first estimate is taken as is
+	assertTrue( session.update(scaled(2.0f), white) );
+	assertTrue( session.active() );
+	assertInRange( 1.999f, session.ccm()(0, 0), 2.001f );
+	assertInRange( 0.249f, session.confidence(), 0.251f );
+
+	// the next ones are blended in
+	assertTrue( session.update(scaled(2.2f), white) );
+	assertInRange( 2.049f, session.ccm()(0, 0), 2.051f );
+	assertInRange( -0.001f, session.ccm()(0, 1), 0.001f );
+	assertTrue( session.confidence() > 0.25f );
+
+	// ... and the more they agree, the more sure we are
+	for (unsigned i = 0; i < 4; ++i)
+		session.update(scaled(2.05f), white);
+	assertTrue( session.confidence() > 0.75f );
+}
+
+TEST_CASE( "color_correction_sessionTest/testOutliers", "[unit]" )
+{
+	color_correction_session session;
+	std::tuple<float, float, float> white(240, 240, 230);
+	for (unsigned i = 0; i < 5; ++i)
+		session.update(scaled(2.0f), white);
+	float confidence = session.confidence();
+
+	// one bad frame doesn't move us
+	assertFalse( session.update(scaled(5.0f), white) );
+	assertInRange( 1.999f, session.ccm()(0, 0), 2.001f );
+	assertTrue( session.confidence() < confidence );
+
+	// neither does garbage
+	assertFalse( session.update(scaled(NAN), white) );
+	assertInRange( 1.999f, session.ccm()(0, 0), 2.001f );
+
+	// but if it keeps happening, the lighting changed
+	assertFalse( session.update(scaled(5.0f), white) );
+	assertTrue( session.update(scaled(5.0f), white) );
+	assertInRange( 4.999f, session.ccm()(0, 0), 5.001f );
+	assertInRange( 0.249f, session.confidence(), 0.251f );
+}
+
+TEST_CASE( "color_correction_sessionTest/testStable", "[unit]" )
+{
+	color_correction_session::params params;
+	params.max_skips = 3;
+	color_correction_session session(params);
+
+	std::tuple<float, float, float> white(240, 240, 230);
+	for (unsigned i = 0; i < 5; ++i)
+		session.update(scaled(2.0f), white);
+
+	// same lighting: skip the estimate. But not forever
+	assertTrue( session.is_stable({242, 238, 231}) );
+	assertTrue( session.is_stable(white) );
+	assertTrue( session.is_stable(white) );
+	assertFalse( session.is_stable(white) );
+
+	// a new estimate resets the clock
+	session.update(scaled(2.0f), white);
+	assertTrue( session.is_stable(white) );
+
+	// lights changed
+	assertFalse( session.is_stable({200, 240, 230}) );
+
+	session.reset();
+	assertFalse( session.active() );
+	assertFalse( session.is_stable(white) );
+}
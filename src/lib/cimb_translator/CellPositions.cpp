@@ -57,8 +57,11 @@ CellPositions::positions_list CellPositions::compute(cimbar::vec_xy spacing, cim
 	return pos;
 }
 
+// we don't make an interleaved copy of the positions -- next() goes through the (cached) interleave table instead.
+// with interleave_blocks == 0, that's just the identity.
 CellPositions::CellPositions(cimbar::vec_xy spacing, cimbar::vec_xy dimensions, int offset, cimbar::vec_xy marker_size, int interleave_blocks, int interleave_partitions)
-	: _positions(compute(spacing, dimensions, offset, marker_size, interleave_blocks, interleave_partitions))
+	: _positions(compute_linear(spacing, dimensions, offset, marker_size))
+	, _order(&Interleave::lookup(_positions.size(), interleave_blocks, interleave_partitions).indices)
 {
 	reset();
 }
@@ -70,7 +73,7 @@ unsigned CellPositions::index() const
 
 size_t CellPositions::count() const
 {
-	return _positions.size();
+	return _order->size();
 }
 
 void CellPositions::reset()
@@ -80,12 +83,12 @@ void CellPositions::reset()
 
 bool CellPositions::done() const
 {
-	return _index >= _positions.size();
+	return _index >= _order->size();
 }
 
 const CellPositions::coordinate& CellPositions::next()
 {
-	return _positions[_index++];
+	return _positions[(*_order)[_index++]];
 }
 
 const CellPositions::positions_list& CellPositions::positions() const
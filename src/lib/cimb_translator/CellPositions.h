@@ -3,6 +3,7 @@
 
 #include "util/vec_xy.h"
 #include <cstddef>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
@@ -24,9 +25,11 @@ public:
 	bool done() const;
 	const coordinate& next();
 
+	// in linear order. next() walks them in interleaved order.
 	const positions_list& positions() const;
 
 protected:
 	unsigned _index;
 	positions_list _positions;
+	const std::vector<uint16_t>* _order; // see Interleave::lookup()
 };
@@ -4,7 +4,6 @@
 #include "Cell.h"
 #include "Common.h"
 #include "Config.h"
-#include "image_hash/hamming_distance.h"
 #include "serialize/format.h"
 #include "util/compiler_constants.h"
 
@@ -21,7 +20,7 @@ const float BEST_COLOR_FLOOR = 48.0f;
 namespace {
 	unsigned squared_difference(int a, int b)
 	{
-		return std::pow(a - b, 2);
+		return (a - b) * (a - b);
 	}
 
 	uchar fix_single_color(float c, float adjustUp, float down)
@@ -53,23 +52,118 @@ namespace {
 			squared_difference(std::get<2>(rel1), std::get<2>(rel2))
 		);
 	}
+
+	// mean color of the middle (cell_size-2)^2 pixels of each cell, one channel per output array.
+	// the cell size is a compile time constant, so the inner loops have fixed trip counts.
+	// (36 pixels * 255 fits in a uint16_t, same as Cell::mean_rgb())
+	template <unsigned CELLSIZE, unsigned CHANNELS>
+	void mean_cell_interiors(const cv::Mat& img, const std::vector<PositionData>& positions, uint8_t* red, uint8_t* green, uint8_t* blue)
+	{
+		constexpr unsigned inner = CELLSIZE - 2;
+		constexpr unsigned count = inner * inner;
+		const uchar* base = img.ptr<uchar>(0);
+		const size_t stride = (size_t)img.cols * CHANNELS;
+
+		for (size_t k = 0; k < positions.size(); ++k)
+		{
+			const PositionData& pos = positions[k];
+			const uchar* p = base + ((size_t)(pos.y+1) * img.cols + (pos.x+1)) * CHANNELS;
+
+			uint16_t r = 0, g = 0, b = 0;
+			for (unsigned row = 0; row < inner; ++row, p += stride)
+			{
+				for (unsigned col = 0; col < inner; ++col)
+				{
+					r += p[col*CHANNELS];
+					g += p[col*CHANNELS + 1];
+					b += p[col*CHANNELS + 2];
+				}
+			}
+			red[k] = r / count;
+			green[k] = g / count;
+			blue[k] = b / count;
+		}
+	}
 }
 
-CimbDecoder::CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark, uchar ahashThreshold)
+template <unsigned CELLSIZE>
+unsigned CimbDecoder::decode_symbol_impl(const cv::Mat& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
+{
+	image_hash::ahash_result<CELLSIZE> results = image_hash::fuzzy_ahash<CELLSIZE>(
+		cell, _ahashThreshold, image_hash::ahash_result<CELLSIZE>::FAST
+	);
+	return get_best_symbol(results, drift_offset, best_distance, cooldown);
+}
+
+template <unsigned CELLSIZE>
+CIMBAR_FLATTEN unsigned CimbDecoder::decode_symbol_impl(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
+{
+	int checkRule = cooldown == 0xFE? image_hash::ahash_result<CELLSIZE>::ALL : image_hash::ahash_result<CELLSIZE>::FAST;
+	image_hash::ahash_result<CELLSIZE> results = image_hash::fuzzy_ahash<CELLSIZE>(cell, checkRule);
+	return get_best_symbol(results, drift_offset, best_distance, cooldown);
+}
+
+// the cell sizes we know about: 8 (mode B, etc), and 5 (mode S)
+const CimbDecoder::kernel& CimbDecoder::kernel_for(unsigned cell_size)
+{
+	static const kernel k5 = {
+		5,
+		&CimbDecoder::decode_symbol_impl<5>,
+		&CimbDecoder::decode_symbol_impl<5>,
+		&mean_cell_interiors<5, 3>,
+		&mean_cell_interiors<5, 4>
+	};
+	static const kernel k8 = {
+		8,
+		&CimbDecoder::decode_symbol_impl<8>,
+		&CimbDecoder::decode_symbol_impl<8>,
+		&mean_cell_interiors<8, 3>,
+		&mean_cell_interiors<8, 4>
+	};
+
+	switch (cell_size)
+	{
+		case 5:
+			return k5;
+		case 8:
+		default:
+			return k8;
+	}
+}
+
+CimbDecoder::CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark, uchar ahashThreshold, unsigned cell_size)
 	: _symbolBits(symbol_bits)
 	, _numSymbols(1 << symbol_bits)
 	, _numColors(1 << color_bits)
 	, _dark(dark)
 	, _ahashThreshold(ahashThreshold)
+	, _kernel(&kernel_for(cell_size? cell_size : cimbar::Config::cell_size()))
 {
 	load_tiles();
 }
 
 // protected
+CimbDecoder::color_state& CimbDecoder::own_color_state()
+{
+	static thread_local color_state _state;
+	return _state;
+}
+
+CimbDecoder::color_state*& CimbDecoder::current_color_state()
+{
+	static thread_local color_state* _current = &own_color_state();
+	return _current;
+}
+
 color_correction& CimbDecoder::internal_ccm() const
 {
-	static thread_local color_correction _ccm;
-	return _ccm;
+	return current_color_state()->ccm;
+}
+
+// goes with internal_ccm()
+ColorLookup& CimbDecoder::internal_color_lookup() const
+{
+	return current_color_state()->lookup;
 }
 
 // public
@@ -84,6 +178,23 @@ void CimbDecoder::update_color_correction(cv::Matx<float, 3, 3>&& ccm)
 	internal_ccm().update(std::move(ccm));
 }
 
+void CimbDecoder::set_color_session(std::shared_ptr<color_correction_session> session)
+{
+	_colorSession = session;
+}
+
+color_correction_session* CimbDecoder::color_session() const
+{
+	return _colorSession.get();
+}
+
+CimbDecoder::color_state* CimbDecoder::swap_color_state(color_state* state)
+{
+	color_state* prev = current_color_state();
+	current_color_state() = state? state : &own_color_state();
+	return prev;
+}
+
 uint64_t CimbDecoder::get_tile_hash(unsigned symbol) const
 {
 	cv::Mat tile = cimbar::getTile(_symbolBits, symbol, _dark, _numColors);
@@ -98,52 +209,14 @@ bool CimbDecoder::load_tiles()
 	return true;
 }
 
-unsigned CimbDecoder::get_best_symbol(image_hash::ahash_result<cimbar::Config::cell_size()>& results, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
-{
-	drift_offset = 0;
-	unsigned best_fit = 0;
-	best_distance = 1000;
-	// ahash_result will give us either 5 or 9 candidate hashes -- depending on whether we want to ignore the corners or not.
-	// Because we're greedy (see the `return`), we will iterate out from the center
-	// 4 == center.
-	// 5, 7, 3, 1 == sides.
-	// 8, 0, 2, 6 == corners.
-	for (auto&& [drift_idx, h] : results)
-	{
-		// skip over this drift_idx if it matches cooldown
-		// we could be more clever to check for corners, but for now this is fine
-		// ~0U is "unset"
-		if (drift_idx == cooldown and drift_idx != 4) // don't skip the center, obvs
-			continue;
-		for (unsigned i = 0; i < _tileHashes.size(); ++i)
-		{
-			unsigned distance = image_hash::hamming_distance(h, _tileHashes[i]);
-			if (distance < best_distance)
-			{
-				best_distance = distance;
-				best_fit = i;
-				drift_offset = drift_idx;
-				if (best_distance == 0)
-					return best_fit;
-			}
-		}
-	}
-	return best_fit;
-}
-
 unsigned CimbDecoder::decode_symbol(const cv::Mat& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
 {
-	image_hash::ahash_result<cimbar::Config::cell_size()> results = image_hash::fuzzy_ahash<cimbar::Config::cell_size()>(
-		cell, _ahashThreshold, image_hash::ahash_result<cimbar::Config::cell_size()>::FAST
-	);
-	return get_best_symbol(results, drift_offset, best_distance, cooldown);
+	return (this->*_kernel->decode_symbol_mat)(cell, drift_offset, best_distance, cooldown);
 }
 
-CIMBAR_FLATTEN unsigned CimbDecoder::decode_symbol(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
+unsigned CimbDecoder::decode_symbol(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
 {
-	int checkRule = cooldown == 0xFE? image_hash::ahash_result<cimbar::Config::cell_size()>::ALL : image_hash::ahash_result<cimbar::Config::cell_size()>::FAST;
-	image_hash::ahash_result<cimbar::Config::cell_size()> results = image_hash::fuzzy_ahash<cimbar::Config::cell_size()>(cell, checkRule);
-	return get_best_symbol(results, drift_offset, best_distance, cooldown);
+	return (this->*_kernel->decode_symbol_bits)(cell, drift_offset, best_distance, cooldown);
 }
 
 std::tuple<uchar,uchar,uchar> CimbDecoder::fix_color(std::tuple<float,float,float> c, float adjustUp, float down) const
@@ -199,6 +272,31 @@ unsigned CimbDecoder::get_best_color(float r, float g, float b, unsigned color_m
 	return best_fit;
 }
 
+// same answer as get_best_color(), but we remember it. Cells are mostly a handful of colors, so most calls are a table hit.
+unsigned CimbDecoder::lookup_best_color(uchar r, uchar g, uchar b, unsigned color_mode) const
+{
+	return color_lookup(color_mode).get(r, g, b, [&]() {
+		return get_best_color(r, g, b, color_mode);
+	});
+}
+
+// the lookup table, ready to go for the current ccm
+ColorLookup& CimbDecoder::color_lookup(unsigned color_mode) const
+{
+	// the ccm can change out from under us (it's per thread, not per decoder), so we check it every time
+	const color_correction& ccm = internal_ccm();
+	ColorLookup::context ctx;
+	auto m = ccm.mat();
+	std::copy(m.val, m.val+9, ctx.begin());
+	ctx[9] = ccm.active();
+	ctx[10] = _numColors;
+	ctx[11] = color_mode;
+
+	ColorLookup& lookup = internal_color_lookup();
+	lookup.set_context(ctx);
+	return lookup;
+}
+
 std::tuple<uchar,uchar,uchar> CimbDecoder::avg_color(const Cell& color_cell) const
 {
 	// TODO: check/enforce dimensions of color_cell?
@@ -213,7 +311,48 @@ CIMBAR_FLATTEN unsigned CimbDecoder::decode_color(const Cell& color_cell, unsign
 	if (_numColors <= 1)
 		return 0;
 	auto [r, g, b] = avg_color(color_cell);
-	return get_best_color(r, g, b, color_mode);
+	return lookup_best_color(r, g, b, color_mode);
+}
+
+// decode_color() for a whole frame's worth of cells. Same answers, but in two tight passes:
+// 1. sum each cell's interior into flat r/g/b arrays
+// 2. classify them all against the lookup table
+void CimbDecoder::decode_colors(const cv::Mat& img, const std::vector<PositionData>& positions, unsigned color_mode, std::vector<uint8_t>& colors) const
+{
+	colors.resize(positions.size());
+	if (_numColors <= 1)
+	{
+		std::fill(colors.begin(), colors.end(), 0);
+		return;
+	}
+
+	int channels = img.channels();
+	if (!img.isContinuous() or (channels != 3 and channels != 4))
+	{
+		for (size_t k = 0; k < positions.size(); ++k)
+			colors[k] = decode_color(Cell(img, positions[k].x, positions[k].y, _kernel->cell_size, _kernel->cell_size), color_mode);
+		return;
+	}
+
+	std::vector<uint8_t> means(positions.size() * 3);
+	uint8_t* red = means.data();
+	uint8_t* green = red + positions.size();
+	uint8_t* blue = green + positions.size();
+	if (channels == 3)
+		_kernel->mean_cells_rgb(img, positions, red, green, blue);
+	else
+		_kernel->mean_cells_rgba(img, positions, red, green, blue);
+
+	ColorLookup& lookup = color_lookup(color_mode);
+	for (size_t k = 0; k < positions.size(); ++k)
+	{
+		uchar r = red[k];
+		uchar g = green[k];
+		uchar b = blue[k];
+		colors[k] = lookup.get(r, g, b, [&]() {
+			return get_best_color(r, g, b, color_mode);
+		});
+	}
 }
 
 bool CimbDecoder::expects_binary_threshold() const
@@ -225,3 +364,8 @@ unsigned CimbDecoder::symbol_bits() const
 {
 	return _symbolBits;
 }
+
+unsigned CimbDecoder::cell_size() const
+{
+	return _kernel->cell_size;
+}
@@ -2,37 +2,88 @@
 #pragma once
 
 #include "CellDrift.h"
+#include "ColorLookup.h"
 #include "Config.h"
+#include "PositionData.h"
 #include "chromatic_adaptation/color_correction.h"
+#include "chromatic_adaptation/color_correction_session.h"
 #include "image_hash/ahash_result.h"
 #include "image_hash/average_hash.h"
+#include "image_hash/hamming_distance.h"
 #include "util/compiler_constants.h"
 #include <opencv2/opencv.hpp>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 class CimbDecoder
 {
 public:
-	CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark=true, uchar ahashThreshold=0);
+	// the ccm + color lookup table a decode works against.
+	// by default, every thread has its own. DecodeSession brings one along instead (see swap_color_state()).
+	struct color_state
+	{
+		color_correction ccm;
+		ColorLookup lookup;
+	};
+
+public:
+	// cell_size=0 -> Config::cell_size()
+	CimbDecoder(unsigned symbol_bits, unsigned color_bits, bool dark=true, uchar ahashThreshold=0, unsigned cell_size=0);
 
 	const color_correction& get_ccm() const;
 	void update_color_correction(cv::Matx<float, 3, 3>&& ccm);
 
-	unsigned get_best_symbol(image_hash::ahash_result<cimbar::Config::cell_size()>& results, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown=0xFF) const;
+	// optional. If set, CimbReader::init_ccm() goes through the session instead of starting from scratch every frame.
+	void set_color_session(std::shared_ptr<color_correction_session> session);
+	color_correction_session* color_session() const;
+
+	// point this thread at somebody else's color state (nullptr == back to the thread's own). Returns the previous one.
+	static color_state* swap_color_state(color_state* state);
+
+	template <unsigned CELLSIZE>
+	unsigned get_best_symbol(image_hash::ahash_result<CELLSIZE>& results, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown=0xFF) const;
 	unsigned decode_symbol(const cv::Mat& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown=0xFF) const;
-	CIMBAR_FLATTEN unsigned decode_symbol(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown=0xFF) const;
+	unsigned decode_symbol(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown=0xFF) const;
 
 	std::tuple<uchar,uchar,uchar> get_color(int i, unsigned color_mode) const;
 	std::tuple<uchar,uchar,uchar> avg_color(const Cell& color_cell) const;
 	unsigned get_best_color(float r, float g, float b, unsigned color_mode) const;
+	unsigned lookup_best_color(uchar r, uchar g, uchar b, unsigned color_mode) const;
 	CIMBAR_FLATTEN unsigned decode_color(const Cell& cell, unsigned color_mode) const;
+	void decode_colors(const cv::Mat& img, const std::vector<PositionData>& positions, unsigned color_mode, std::vector<uint8_t>& colors) const;
 
 	bool expects_binary_threshold() const;
 	unsigned symbol_bits() const;
+	unsigned cell_size() const;
 
 protected:
+	// the parts of the decode that care about the cell size, compiled once per supported size (see kernel_for()).
+	// picked once, when the decoder is made
+	struct kernel
+	{
+		unsigned cell_size;
+		unsigned (CimbDecoder::*decode_symbol_mat)(const cv::Mat&, unsigned&, unsigned&, unsigned) const;
+		unsigned (CimbDecoder::*decode_symbol_bits)(const bitmatrix&, unsigned&, unsigned&, unsigned) const;
+		// mean color of each cell's interior -> r/g/b arrays. One for 3 channel images, one for 4
+		void (*mean_cells_rgb)(const cv::Mat&, const std::vector<PositionData>&, uint8_t*, uint8_t*, uint8_t*);
+		void (*mean_cells_rgba)(const cv::Mat&, const std::vector<PositionData>&, uint8_t*, uint8_t*, uint8_t*);
+	};
+
+	static const kernel& kernel_for(unsigned cell_size);
+
+	template <unsigned CELLSIZE>
+	unsigned decode_symbol_impl(const cv::Mat& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const;
+	template <unsigned CELLSIZE>
+	unsigned decode_symbol_impl(const bitmatrix& cell, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const;
+
+	static color_state& own_color_state();
+	static color_state*& current_color_state();
+
 	color_correction& internal_ccm() const;
+	ColorLookup& internal_color_lookup() const;
+	ColorLookup& color_lookup(unsigned color_mode) const;
 
 	uint64_t get_tile_hash(unsigned symbol) const;
 	bool load_tiles();
@@ -47,4 +98,40 @@ protected:
 	unsigned _numColors;
 	bool _dark;
 	uchar _ahashThreshold;
+	const kernel* _kernel;
+	std::shared_ptr<color_correction_session> _colorSession;
 };
+
+template <unsigned CELLSIZE>
+inline unsigned CimbDecoder::get_best_symbol(image_hash::ahash_result<CELLSIZE>& results, unsigned& drift_offset, unsigned& best_distance, unsigned cooldown) const
+{
+	drift_offset = 0;
+	unsigned best_fit = 0;
+	best_distance = 1000;
+	// ahash_result will give us either 5 or 9 candidate hashes -- depending on whether we want to ignore the corners or not.
+	// Because we're greedy (see the `return`), we will iterate out from the center
+	// 4 == center.
+	// 5, 7, 3, 1 == sides.
+	// 8, 0, 2, 6 == corners.
+	for (auto&& [drift_idx, h] : results)
+	{
+		// skip over this drift_idx if it matches cooldown
+		// we could be more clever to check for corners, but for now this is fine
+		// ~0U is "unset"
+		if (drift_idx == cooldown and drift_idx != 4) // don't skip the center, obvs
+			continue;
+		for (unsigned i = 0; i < _tileHashes.size(); ++i)
+		{
+			unsigned distance = image_hash::hamming_distance(h, _tileHashes[i]);
+			if (distance < best_distance)
+			{
+				best_distance = distance;
+				best_fit = i;
+				drift_offset = drift_idx;
+				if (best_distance == 0)
+					return best_fit;
+			}
+		}
+	}
+	return best_fit;
+}
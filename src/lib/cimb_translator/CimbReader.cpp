@@ -108,7 +108,7 @@ CimbReader::CimbReader(const cv::Mat& img, CimbDecoder& decoder, unsigned color_
 	: _image(img)
 	, _fountainColorHeader(0U)
 	, _radioactiveBlockId(0) // can only compute once we know the file size
-	, _cellSize(Config::cell_size() + 2)
+	, _cellSize(decoder.cell_size() + 2)
 	, _gridPadding(std::min(_image.cols - Config::image_size_x(), _image.rows - Config::image_size_y())/2)
 	, _positions(
 		  cimbar::vec_xy{Config::cell_spacing_x(), Config::cell_spacing_y()},
@@ -132,10 +132,16 @@ CimbReader::CimbReader(const cv::UMat& img, CimbDecoder& decoder, unsigned color
 
 CIMBAR_ALWAYS_INLINE unsigned CimbReader::read_color(const PositionData& pos) const
 {
-	Cell color_cell(_image, pos.x, pos.y, Config::cell_size(), Config::cell_size());
+	Cell color_cell(_image, pos.x, pos.y, _decoder.cell_size(), _decoder.cell_size());
 	return _decoder.decode_color(color_cell, _colorMode);
 }
 
+// read_color() for every position at once. colors[k] goes with positions[k]
+void CimbReader::read_colors(const std::vector<PositionData>& positions, std::vector<uint8_t>& colors) const
+{
+	_decoder.decode_colors(_image, positions, _colorMode, colors);
+}
+
 CIMBAR_ALWAYS_INLINE unsigned CimbReader::read(PositionData& pos)
 {
 	if (done())
@@ -171,11 +177,21 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 	if (_colorCorrection != 2)
 		return;
 
+	// with a session, we might not need to do any of this. If the lighting looks the same as last time, we'll reuse that ccm.
+	color_correction_session* session = _decoder.color_session();
+	std::tuple<float, float, float> white(0, 0, 0);
+	if (session and _good)
+	{
+		white = calculateWhite(_image, _gridPadding, Config::dark());
+		if (session->is_stable(white))
+			return use_session_ccm();
+	}
+
 	// if no fountain header, we don't attempt color correction
 	// we *could* (and used to) sample white pixels in the anchor points, and use the von kries/bradford matrix to generate a primitive CCM
 	// but for now we're aiming for something a bit smarter
 	if (_fountainColorHeader.id() == 0) // and _decoder.has_no_ccm() ... or something?
-		return;
+		return use_session_ccm();
 
 	// TODO: refactor?
 	// most logical thing to do is probably to make a get_color_map(), and leave the rest (avg computation, etc) here...?
@@ -183,7 +199,9 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 	// full ccm, using header values as known color index
 	// 1. get positions
 	// 2. put fountain header into a bitbuffer so we can read decoder.color_bits() bits at a time
-	CellPositions::positions_list positions = Interleave::interleave(_positions.positions(), interleave_blocks, interleave_partitions);
+	// (in interleaved order -- we look them up through the interleave table, rather than making a reordered copy)
+	const CellPositions::positions_list& positions = _positions.positions();
+	const std::vector<uint16_t>& order = Interleave::lookup(positions.size(), interleave_blocks, interleave_partitions).indices;
 
 	// 3. using expected fountain headers, decode color for each position
 	unsigned end = cimbar::Config::capacity(color_bits) * 8 / color_bits;
@@ -208,12 +226,12 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 		for (unsigned idx = block, i = 0; idx < block+headerLen; ++idx, i+=color_bits)
 		{
 			unsigned expected = buff.read(i, color_bits);
-			CellPositions::coordinate pos = positions[idx];
+			CellPositions::coordinate pos = positions[order[idx]];
 
 			//Cell color_cell(_image, pos.first, pos.second, Config::cell_size(), Config::cell_size());
 			//auto col = _decoder.avg_color(color_cell); // could just call cell mean_rgb directly?
 
-			Cell color_cell(_image, pos.first+1, pos.second+1, Config::cell_size()-2, Config::cell_size()-2);
+			Cell color_cell(_image, pos.first+1, pos.second+1, _decoder.cell_size()-2, _decoder.cell_size()-2);
 			auto col = color_cell.mean_rgb();
 
 			auto [it, isNew] = colors.try_emplace(expected, std::make_tuple(0, 0, 0, 0)); // count,r,g,b
@@ -250,11 +268,12 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 
 	// bail if we don't have enough data...
 	if (actual.rows < 4)
-		return;
+		return use_session_ccm();
 
 	// 5. sample corners
 	{
-		std::tuple<float, float, float> white = calculateWhite(_image, _gridPadding, Config::dark());
+		if (!session)
+			white = calculateWhite(_image, _gridPadding, Config::dark());
 		cv::Mat arow = (cv::Mat_<float>(1,3) << std::get<0>(white), std::get<1>(white), std::get<2>(white));
 		actual.push_back(arow);
 
@@ -263,7 +282,21 @@ void CimbReader::init_ccm(unsigned color_bits, unsigned interleave_blocks, unsig
 	}
 
 	// 6. generate ccm from avgs in #4/5, save in decoder. Success! We hope
-	_decoder.update_color_correction(color_correction::get_moore_penrose_lsm(actual, desired));
+	cv::Matx<float, 3, 3> ccm = color_correction::get_moore_penrose_lsm(actual, desired);
+	if (!session)
+		return _decoder.update_color_correction(std::move(ccm));
+
+	// ... or blend it into the session's, which is what we'll use
+	session->update(ccm, white);
+	use_session_ccm();
+}
+
+// if we have a session ccm, this frame gets it
+void CimbReader::use_session_ccm()
+{
+	color_correction_session* session = _decoder.color_session();
+	if (session and session->active())
+		_decoder.update_color_correction(session->ccm());
 }
 
 void CimbReader::update_metadata(char* buff, unsigned len, unsigned chunk_size)
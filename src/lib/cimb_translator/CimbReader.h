@@ -9,6 +9,7 @@
 #include "fountain/FountainMetadata.h"
 #include "util/compiler_constants.h"
 #include <opencv2/opencv.hpp>
+#include <vector>
 
 class CimbReader
 {
@@ -18,6 +19,7 @@ public:
 
 	CIMBAR_ALWAYS_INLINE unsigned read(PositionData& pos);
 	CIMBAR_ALWAYS_INLINE unsigned read_color(const PositionData& pos) const;
+	void read_colors(const std::vector<PositionData>& positions, std::vector<uint8_t>& colors) const;
 	bool done() const;
 
 	void init_ccm(unsigned color_bits, unsigned interleave_blocks, unsigned interleave_partitions, unsigned fountain_blocks);
@@ -25,6 +27,9 @@ public:
 
 	unsigned num_reads() const;
 
+protected:
+	void use_session_ccm();
+
 protected:
 	cv::Mat _image;
 	bitbuffer _grayscale;
@@ -3,6 +3,7 @@
 
 #include "Common.h"
 #include "Config.h"
+#include "FrameHeader.h"
 #include "serialize/format.h"
 #include <string>
 #include <iostream>
@@ -94,6 +95,12 @@ bool CimbWriter::write(unsigned bits)
 	return true;
 }
 
+// the mode id, so the receiver can figure things out on its own. See FrameHeader
+void CimbWriter::write_header(unsigned mode_val, bool dark)
+{
+	FrameHeader::draw(_image, mode_val, dark, _offsetX, _offsetY, {Config::image_size_x(), Config::image_size_y()});
+}
+
 bool CimbWriter::done() const
 {
 	return _positions.done();
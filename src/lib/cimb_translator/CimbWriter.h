@@ -13,6 +13,8 @@ public:
 	bool write(unsigned bits);
 	bool done() const;
 
+	void write_header(unsigned mode_val, bool dark=true);
+
 	cv::Mat image() const;
 
 	unsigned num_cells() const;
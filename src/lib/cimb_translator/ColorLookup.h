@@ -0,0 +1,70 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// a 3D table of (average cell color) -> color index, so we only classify each color once per ccm.
+// 64x64x64 buckets (top 6 bits of each channel). Each bucket remembers which exact color it holds (the low 2 bits are the tag),
+// so a hit is always the same answer CimbDecoder::get_best_color() would have given. A miss classifies, and takes the slot.
+// the table is only good for one ccm + palette -- the "context". A new context empties it.
+class ColorLookup
+{
+public:
+	static constexpr unsigned BITS = 6;
+	static constexpr unsigned SIZE = 1 << (BITS*3);
+
+	// the ccm (row major), whether it's active, the number of colors, the color mode
+	using context = std::array<float, 12>;
+
+protected:
+	static constexpr uint16_t VALID = 0x8000;
+	static constexpr uint16_t TAG_MASK = 0xFF00;
+	static constexpr uint16_t VALUE_MASK = 0x00FF;
+
+public:
+	ColorLookup()
+		: _table(SIZE, 0)
+	{}
+
+	void clear()
+	{
+		if (_dirty)
+			std::fill(_table.begin(), _table.end(), 0);
+		_dirty = false;
+	}
+
+	void set_context(const context& ctx)
+	{
+		// bitwise, so a NaN in the ccm doesn't clear the table on every call
+		if (std::memcmp(ctx.data(), _context.data(), sizeof(context)) == 0)
+			return;
+		clear();
+		_context = ctx;
+	}
+
+	// classify() -> the color index, for when we don't have it yet
+	template <typename FUN>
+	unsigned get(uint8_t r, uint8_t g, uint8_t b, const FUN& classify)
+	{
+		unsigned idx = ((unsigned)(r >> 2) << (BITS*2)) | ((unsigned)(g >> 2) << BITS) | (b >> 2);
+		uint16_t tag = VALID | ((r & 3) << 12) | ((g & 3) << 10) | ((b & 3) << 8);
+
+		uint16_t& entry = _table[idx];
+		if ((entry & TAG_MASK) == tag)
+			return entry & VALUE_MASK;
+
+		unsigned res = classify();
+		entry = tag | (res & VALUE_MASK);
+		_dirty = true;
+		return res;
+	}
+
+protected:
+	std::vector<uint16_t> _table;
+	context _context = {};
+	bool _dirty = false;
+};
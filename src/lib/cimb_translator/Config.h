@@ -8,12 +8,23 @@ namespace cimbar
 	class Config
 	{
 	protected:
-		static cimbar::conf& active_conf()
+		static cimbar::conf& own_conf()
 		{
-			static thread_local cimbar::conf cc = cimbar::Conf8x8();
+			static thread_local cimbar::conf cc = temp_conf();
 			return cc;
 		}
 
+		static cimbar::conf*& current_conf()
+		{
+			static thread_local cimbar::conf* current = &own_conf();
+			return current;
+		}
+
+		static cimbar::conf& active_conf()
+		{
+			return *current_conf();
+		}
+
 
 	public:
 		static cimbar::conf temp_conf(int mode_val=0)
@@ -26,21 +37,33 @@ namespace cimbar
 					cc.color_bits = 2;
 					cc.legacy_mode = true;
 					cc.fountain_chunks_scalar = -10;
-					return cc;
+					break;
 				case 8:
 					cc = cimbar::Conf8x8();
 					cc.color_bits = 3;
 					cc.legacy_mode = true;
 					cc.fountain_chunks_scalar = -10;
-					return cc;
+					break;
+				case 83:
+					cc = cimbar::Conf5x5();
+					break;
+				case 84:
+					cc = cimbar::Conf5x5d();
+					break;
 				case 66:
-					return cimbar::Conf8x8_micro();
+					cc = cimbar::Conf8x8_micro();
+					break;
 				case 67:
-					return cimbar::Conf8x8_mini();
+					cc = cimbar::Conf8x8_mini();
+					break;
 				case 68:
 				default:
-					return cimbar::Conf8x8();
+					cc = cimbar::Conf8x8();
+					mode_val = 68;
+					break;
 			}
+			cc.mode_val = mode_val;
+			return cc;
 		}
 
 		static void update(int mode_val=0)
@@ -48,6 +71,20 @@ namespace cimbar
 			active_conf() = temp_conf(mode_val);
 		}
 
+		// point this thread at somebody else's conf (nullptr == back to the thread's own).
+		// returns the previous one, so it can be put back. See DecodeSession.
+		static cimbar::conf* swap_conf(cimbar::conf* cc)
+		{
+			cimbar::conf* prev = current_conf();
+			current_conf() = cc? cc : &own_conf();
+			return prev;
+		}
+
+		static unsigned mode_val()
+		{
+			return active_conf().mode_val;
+		}
+
 		static bool dark()
 		{
 			return true;
@@ -103,10 +140,9 @@ namespace cimbar
 			return 30;
 		}
 
-		static constexpr unsigned cell_size()
+		static unsigned cell_size()
 		{
-			// TODO: runtime
-			return 8;
+			return active_conf().cell_size;
 		}
 
 		static unsigned cell_spacing_x()
@@ -0,0 +1,166 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "Config.h"
+#include "util/vec_xy.h"
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// a tiny bit of metadata in the bottom right corner of the frame -- so a receiver can figure out the mode on its own.
+// 16 bits: the mode id, then the mode id ^ CHECK. Drawn as a 4x4 grid of 5x5 blocks, just to the left of the secondary anchor.
+// every mode has at least ~60px of empty space in the corners (the grid's corner padding), so we aren't stepping on any cells.
+//
+// positions are relative to the bottom right deskew point (width-30, height-30), which lands in the same spot for every mode.
+// If we extracted with the wrong image size, everything around it is just scaled -- so we can check each mode's geometry
+// without re-extracting. See read().
+class FrameHeader
+{
+public:
+	static constexpr unsigned BLOCK = 5;
+	static constexpr unsigned GRID = 4;
+	static constexpr unsigned BITS = GRID*GRID;
+	static constexpr int LEFT = -26; // relative to the deskew point
+	static constexpr int TOP = 4;
+	static constexpr uint8_t CHECK = 0x5A;
+	static constexpr int MIN_CONTRAST = 48;
+
+	static constexpr std::array<unsigned, 7> MODES = {68, 67, 66, 4, 8, 83, 84};
+
+public:
+	static uint16_t encode(unsigned mode_val)
+	{
+		return ((mode_val & 0xFF) << 8) | ((mode_val & 0xFF) ^ CHECK);
+	}
+
+	// 0 == not a header we know
+	static unsigned decode(uint16_t bits)
+	{
+		unsigned mode_val = bits >> 8;
+		if ((bits & 0xFF) != (mode_val ^ CHECK))
+			return 0;
+		if (std::find(MODES.begin(), MODES.end(), mode_val) == MODES.end())
+			return 0;
+		return mode_val;
+	}
+
+	// img is the whole frame. (offset_x, offset_y) is where the (width x height) cimbar image starts inside it
+	static void draw(cv::Mat& img, unsigned mode_val, bool dark, unsigned offset_x, unsigned offset_y, cimbar::vec_xy size)
+	{
+		cv::Scalar color = dark? cv::Scalar(0xFF, 0xFF, 0xFF) : cv::Scalar(0, 0, 0);
+		int left = offset_x + size.width() - anchor() + LEFT;
+		int top = offset_y + size.height() - anchor() + TOP;
+
+		uint16_t bits = encode(mode_val);
+		for (unsigned i = 0; i < BITS; ++i)
+		{
+			if (!(bits & (1 << (BITS-1-i))))
+				continue;
+			cv::Rect block(left + (i % GRID) * BLOCK, top + (i / GRID) * BLOCK, BLOCK, BLOCK);
+			img(block).setTo(color);
+		}
+	}
+
+	// img is a deskewed frame, extracted as image_size (+ padding on each side).
+	// returns the mode id, or 0 if there's no header.
+	static unsigned read(const cv::Mat& img, cimbar::vec_xy image_size, bool dark=true)
+	{
+		if (img.channels() < 3 or img.depth() != CV_8U)
+			return 0;
+
+		// the geometry we extracted with is by far the most likely, so we try it first
+		std::vector<cimbar::vec_xy> tried;
+		unsigned res = read_as(img, image_size, image_size, dark);
+		if (res)
+			return res;
+		tried.push_back(image_size);
+
+		for (unsigned mode_val : MODES)
+		{
+			cimbar::conf cc = cimbar::Config::temp_conf(mode_val);
+			cimbar::vec_xy native{cc.image_size_x, cc.image_size_y};
+			if (std::any_of(tried.begin(), tried.end(), [&](const cimbar::vec_xy& t) { return t.x == native.x and t.y == native.y; }))
+				continue;
+			tried.push_back(native);
+
+			res = read_as(img, image_size, native, dark);
+			if (res)
+				return res;
+		}
+		return 0;
+	}
+
+	static unsigned read(const cv::UMat& img, cimbar::vec_xy image_size, bool dark=true)
+	{
+		return read(img.getMat(cv::ACCESS_READ), image_size, dark);
+	}
+
+protected:
+	static int anchor()
+	{
+		return cimbar::Config::anchor_size();
+	}
+
+	// read the header, assuming the frame was really native_size, but was extracted as image_size
+	static unsigned read_as(const cv::Mat& img, cimbar::vec_xy image_size, cimbar::vec_xy native_size, bool dark)
+	{
+		int padX = (img.cols - (int)image_size.width()) / 2;
+		int padY = (img.rows - (int)image_size.height()) / 2;
+		float refX = padX + image_size.width() - anchor();
+		float refY = padY + image_size.height() - anchor();
+		float scaleX = (image_size.width() - 2.0f*anchor()) / (native_size.width() - 2.0f*anchor());
+		float scaleY = (image_size.height() - 2.0f*anchor()) / (native_size.height() - 2.0f*anchor());
+
+		std::array<int, BITS> samples;
+		for (unsigned i = 0; i < BITS; ++i)
+		{
+			float dx = LEFT + (i % GRID) * BLOCK + BLOCK/2.0f;
+			float dy = TOP + (i / GRID) * BLOCK + BLOCK/2.0f;
+			int x = std::lround(refX + dx*scaleX);
+			int y = std::lround(refY + dy*scaleY);
+			if (x < 1 or y < 1 or x+1 >= img.cols or y+1 >= img.rows)
+				return 0;
+			samples[i] = sample(img, x, y);
+		}
+
+		auto [lo, hi] = std::minmax_element(samples.begin(), samples.end());
+		if (*hi - *lo < MIN_CONTRAST)
+			return 0;
+		int threshold = (*hi + *lo) / 2;
+
+		uint16_t bits = 0;
+		for (unsigned i = 0; i < BITS; ++i)
+		{
+			bool on = dark? samples[i] > threshold : samples[i] < threshold;
+			bits |= on << (BITS-1-i);
+		}
+
+		unsigned mode_val = decode(bits);
+		if (!mode_val)
+			return 0;
+
+		// the header has to agree with the geometry we read it with
+		cimbar::conf cc = cimbar::Config::temp_conf(mode_val);
+		if (cc.image_size_x != native_size.width() or cc.image_size_y != native_size.height())
+			return 0;
+		return mode_val;
+	}
+
+	// avg brightness of the 3x3 around (x,y)
+	static int sample(const cv::Mat& img, int x, int y)
+	{
+		int channels = img.channels();
+		int total = 0;
+		for (int row = y-1; row <= y+1; ++row)
+		{
+			const uchar* p = img.ptr<uchar>(row) + (x-1)*channels;
+			for (int col = 0; col < 3; ++col, p += channels)
+				total += p[0] + p[1] + p[2];
+		}
+		return total / 27;
+	}
+};
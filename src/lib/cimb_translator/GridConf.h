@@ -23,6 +23,7 @@ namespace cimbar
 
 		int fountain_chunks_scalar = 2;
 		bool legacy_mode = false;
+		unsigned mode_val = 0; // the id Config::temp_conf() knows it by
 
 		unsigned bits_per_cell() const
 		{
@@ -1,6 +1,10 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
 #include <vector>
 
 namespace Interleave
@@ -35,17 +39,43 @@ namespace Interleave
 		return inverted;
 	}
 
+	// interleave_indices() and interleave_reverse() only depend on the mode, so we compute them once and keep them around.
+	// uint16_t is plenty -- the biggest grid we have is ~21k cells.
+	struct table
+	{
+		std::vector<uint16_t> indices; // slot -> cell
+		std::vector<uint16_t> reverse; // cell -> slot
+	};
+
+	// the returned reference is good forever. Safe to call from any thread.
+	inline const table& lookup(unsigned size, unsigned num_chunks, unsigned partitions)
+	{
+		static std::mutex mutex;
+		static std::map<std::tuple<unsigned, unsigned, unsigned>, table> cache;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto [it, isNew] = cache.try_emplace({size, num_chunks, partitions});
+		table& t = it->second;
+		if (isNew)
+		{
+			std::vector<unsigned> indices = interleave_indices(size, num_chunks, partitions);
+			t.indices.assign(indices.begin(), indices.end());
+			t.reverse.resize(indices.size(), 0);
+			for (unsigned src = 0; src < indices.size(); ++src)
+				t.reverse[indices[src]] = src;
+		}
+		return t;
+	}
+
 	template <typename PT>
 	inline std::vector<PT> interleave(const std::vector<PT>& positions, unsigned num_chunks, unsigned partitions)
 	{
-		std::vector<PT> res;
+		const std::vector<uint16_t>& indices = lookup(positions.size(), num_chunks, partitions).indices;
 
-		std::vector<unsigned> indices = interleave_indices(positions.size(), num_chunks, partitions);
-		for (unsigned i = 0; i < indices.size(); ++i)
-		{
-			unsigned interleaveIdx = indices[i];
+		std::vector<PT> res;
+		res.reserve(indices.size());
+		for (uint16_t interleaveIdx : indices)
 			res.push_back(positions[interleaveIdx]);
-		}
 		return res;
 	}
 }
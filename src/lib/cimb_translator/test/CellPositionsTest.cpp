@@ -26,3 +26,20 @@ TEST_CASE( "CellPositionsTest/testSimple", "[unit]" )
 
 	assertEquals(12400, count);
 }
+
+TEST_CASE( "CellPositionsTest/testInterleave", "[unit]" )
+{
+	// walks the same path as the interleaved copy compute() makes
+	CellPositions::positions_list expected = CellPositions::compute(cimbar::vec_xy{9, 9}, cimbar::vec_xy{112, 112}, 8, cimbar::vec_xy{6, 6}, 155, 2);
+	CellPositions cells(cimbar::vec_xy{9, 9}, cimbar::vec_xy{112, 112}, 8, cimbar::vec_xy{6, 6}, 155, 2);
+	assertEquals( expected.size(), cells.count() );
+
+	unsigned i = 0;
+	for (; !cells.done(); ++i)
+	{
+		CellPositions::coordinate xy = cells.next();
+		if (xy != expected[i])
+			break;
+	}
+	assertEquals( 12400, i );
+}
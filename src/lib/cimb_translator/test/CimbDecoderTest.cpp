@@ -46,6 +46,22 @@ TEST_CASE( "CimbDecoderTest/testSimpleDecode", "[unit]" )
 	}
 }
 
+TEST_CASE( "CimbDecoderTest/testSimpleDecode.5x5", "[unit]" )
+{
+	// the cell size is a runtime choice, rather than whatever Config says
+	CimbDecoder cd(2, 0, true, 0, 5);
+	assertEquals( 5, cd.cell_size() );
+
+	for (unsigned i = 0; i < 4; ++i)
+	{
+		cv::Mat tile = cimbar::getTile(2, i, true);
+		cv::Mat sevenxseven(7, 7, tile.type(), cv::Scalar(0, 0, 0));
+		tile.copyTo(sevenxseven(cv::Rect(cv::Point(1, 1), tile.size())));
+		unsigned res = decode(cd, sevenxseven);
+		assertEquals(i, res);
+	}
+}
+
 TEST_CASE( "CimbDecoderTest/testPrethresholdDecode", "[unit]" )
 {
 	// validate the bitmatrix version acts as we expect
@@ -130,6 +146,31 @@ TEST_CASE( "CimbDecoderTest/test_get_best_color_mode1", "[unit]" )
 	assertEquals(1, cd.get_best_color(50, 155, 155, 1));
 }
 
+TEST_CASE( "CimbDecoderTest/testLookupBestColor", "[unit]" )
+{
+	CimbDecoder cd(4, 2);
+
+	// the lookup table should never disagree with the slow path. Same colors twice, so we check the hits too
+	auto mismatches = [&cd](unsigned color_mode) {
+		unsigned res = 0;
+		for (unsigned pass = 0; pass < 2; ++pass)
+			for (unsigned r = 0; r < 256; r += 5)
+				for (unsigned g = 0; g < 256; g += 5)
+					for (unsigned b = 0; b < 256; b += 5)
+						res += cd.lookup_best_color(r, g, b, color_mode) != cd.get_best_color(r, g, b, color_mode);
+		return res;
+	};
+
+	cd.update_color_correction(cv::Matx<float, 3, 3>(1.625f, 0.002f, -0.458f, -0.291f, 2.292f, -0.67f, -1.219f, -2.745f, 5.048f));
+	assertEquals( 0, mismatches(1) );
+	assertEquals( 0, mismatches(0) );
+
+	// new ccm, new table
+	cd.update_color_correction(cv::Matx<float, 3, 3>::eye());
+	assertEquals( 0, mismatches(1) );
+	assertEquals( 1, cd.lookup_best_color(0, 255, 255, 1) );
+}
+
 TEST_CASE( "CimbDecoderTest/testColorDecode", "[unit]" )
 {
 	CimbDecoder cd(4, 2);
@@ -164,6 +205,39 @@ TEST_CASE( "CimbDecoderTest/testAllColorDecodes", "[unit]" )
 		}
 }
 
+TEST_CASE( "CimbDecoderTest/testDecodeColors", "[unit]" )
+{
+	CimbDecoder cd(4, 2);
+
+	// every color/symbol combo, side by side
+	cv::Mat img(32, 128, CV_8UC3, cv::Scalar(0, 0, 0));
+	std::vector<PositionData> positions;
+	for (unsigned c = 0; c < 4; ++c)
+		for (unsigned i = 0; i < 16; ++i)
+		{
+			PositionData pos;
+			pos.x = i*8;
+			pos.y = c*8;
+			cimbar::getTile(4, i, true, 4, c).copyTo(img(cv::Rect(pos.x, pos.y, 8, 8)));
+			positions.push_back(pos);
+		}
+
+	cv::Mat rgba;
+	cv::cvtColor(img, rgba, cv::COLOR_RGB2RGBA);
+	for (const cv::Mat& mat : {img, rgba})
+	{
+		std::vector<uint8_t> colors;
+		cd.decode_colors(mat, positions, 1, colors);
+		assertEquals( positions.size(), colors.size() );
+
+		for (unsigned k = 0; k < positions.size(); ++k)
+		{
+			assertEquals( k/16, colors[k] );
+			assertEquals( cd.decode_color(Cell(mat, positions[k].x, positions[k].y, 8, 8), 1), colors[k] );
+		}
+	}
+}
+
 TEST_CASE( "CimbDecoderTest/test_decode_symbol_sloppy", "[unit]" )
 {
 	CimbDecoder cd(4, 2);
@@ -162,6 +162,33 @@ TEST_CASE( "CimbReaderTest/testSampleMessy", "[unit]" )
 	assertTrue(cr.done());
 }
 
+TEST_CASE( "CimbReaderTest/testReadColors", "[unit]" )
+{
+	cv::Mat sample = TestCimbar::loadSample("6bit/4_30_f0_627_extract.jpg");
+
+	CimbDecoder decoder(4, 2);
+	CimbReader cr(sample, decoder, 1);
+
+	std::vector<PositionData> positions;
+	while (!cr.done())
+	{
+		PositionData pos;
+		cr.read(pos);
+		positions.push_back(pos);
+	}
+	assertEquals( 12400, positions.size() );
+
+	// the batched color pass should agree with the cell-at-a-time one, everywhere
+	std::vector<uint8_t> colors;
+	cr.read_colors(positions, colors);
+	assertEquals( positions.size(), colors.size() );
+
+	unsigned mismatches = 0;
+	for (unsigned k = 0; k < positions.size(); ++k)
+		mismatches += colors[k] != cr.read_color(positions[k]);
+	assertEquals( 0, mismatches );
+}
+
 TEST_CASE( "CimbReaderTest/testBad", "[unit]" )
 {
 	// this is a non-extracted image, and it's dimensions are too small.
@@ -0,0 +1,54 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FrameHeader.h"
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace {
+	cv::Mat make_frame(unsigned mode_val, cimbar::vec_xy size)
+	{
+		cv::Mat img(size.height(), size.width(), CV_8UC3, cv::Scalar(0, 0, 0));
+		FrameHeader::draw(img, mode_val, true, 0, 0, size);
+		return img;
+	}
+}
+
+TEST_CASE( "FrameHeaderTest/testEncodeDecode", "[unit]" )
+{
+	for (unsigned mode_val : FrameHeader::MODES)
+		assertEquals( mode_val, FrameHeader::decode(FrameHeader::encode(mode_val)) );
+
+	// blank, full, or flipped bits aren't headers
+	assertEquals( 0, FrameHeader::decode(0) );
+	assertEquals( 0, FrameHeader::decode(0xFFFF) );
+	assertEquals( 0, FrameHeader::decode(FrameHeader::encode(68) ^ 0x10) );
+	// not a mode we know
+	assertEquals( 0, FrameHeader::decode(FrameHeader::encode(69)) );
+}
+
+TEST_CASE( "FrameHeaderTest/testRead", "[unit]" )
+{
+	cv::Mat img = make_frame(67, {1024, 720});
+	assertEquals( 67, FrameHeader::read(img, {1024, 720}) );
+
+	// no header -> nothing
+	cv::Mat blank(1024, 1024, CV_8UC3, cv::Scalar(0, 0, 0));
+	assertEquals( 0, FrameHeader::read(blank, {1024, 1024}) );
+}
+
+TEST_CASE( "FrameHeaderTest/testReadWrongSize", "[unit]" )
+{
+	// a mode Bu frame, extracted as if it were mode B
+	cimbar::vec_xy native{736, 637};
+	cv::Mat img = make_frame(66, native);
+
+	std::vector<cv::Point2f> from = {{30, 30}, {706, 30}, {30, 607}};
+	std::vector<cv::Point2f> to = {{30, 30}, {994, 30}, {30, 994}};
+	cv::Mat transform = cv::getAffineTransform(from, to);
+
+	cv::Mat extracted;
+	cv::warpAffine(img, extracted, transform, cv::Size(1024, 1024), cv::INTER_LINEAR);
+	assertEquals( 66, FrameHeader::read(extracted, {1024, 1024}) );
+}
@@ -57,3 +57,21 @@ TEST_CASE( "InterleaveTest/testCellPositions", "[unit]" )
 	assertEquals( 80, indices[1] );
 	assertEquals( 160, indices[2] );
 }
+
+TEST_CASE( "InterleaveTest/testLookup", "[unit]" )
+{
+	const Interleave::table& t = Interleave::lookup(20, 5, 2);
+	assertEquals( "0 5 1 6 2 7 3 8 4 9 10 15 11 16 12 17 13 18 14 19", turbo::str::join(t.indices) );
+	std::vector<unsigned> invert = Interleave::interleave_reverse(20, 5, 2);
+	assertEquals( turbo::str::join(invert), turbo::str::join(t.reverse) );
+
+	// same one, every time
+	assertEquals( &t, &Interleave::lookup(20, 5, 2) );
+	assertTrue( &t != &Interleave::lookup(20, 5, 1) );
+
+	// mode B
+	const Interleave::table& modeB = Interleave::lookup(12400, 155, 1);
+	assertEquals( 12400, modeB.reverse.size() );
+	assertEquals( 80, modeB.reverse[1] );
+	assertEquals( 160, modeB.reverse[2] );
+}
@@ -2,10 +2,14 @@
 #include "cimbar_js.h"
 
 #include "cimb_translator/Config.h"
+#include "compression/archive.h"
+#include "compression/compression_probe.h"
 #include "compression/zstd_compressor.h"
 #include "encoder/Encoder.h"
 #include "gui/window_glfw.h"
 #include "util/byte_istream.h"
+#include <chrono>
+#include <future>
 #include <sstream>
 
 namespace {
@@ -14,7 +18,16 @@ namespace {
 	std::optional<cv::Mat> _next;
 
 	// compressing the file
-	std::unique_ptr<cimbar::zstd_compressor<std::stringstream>> _comp;
+	using compressor = cimbar::zstd_compressor<std::stringstream>;
+	std::unique_ptr<compressor> _comp;
+	bool _probed = false;
+	bool _archive = false;
+
+	// the next file, being compressed + encoded in the background. See cimbare_prepare_next()
+	std::future<fountain_encoder_stream::ptr> _pending;
+	uint8_t _pendingEncodeId = 0;
+	unsigned _pendingChunkSize = 0;
+	unsigned _pendingChunksPerFrame = 0;
 
 	int _frameCount = 0;
 	// start encode_id is 109. This is mostly unimportant (it only needs to wrap between [0,127]), but useful
@@ -24,6 +37,41 @@ namespace {
 	// settings, will be overriden by first call to configure()
 	int _modeVal = 68;
 	int _compressionLevel = cimbar::Config::compression_level();
+	unsigned _compressionBudget = 0;
+
+	// these may run off the main thread (so no Config:: calls -- it's thread_local)
+	void probe(compressor& comp, const unsigned char* buffer, unsigned size, int level, unsigned budget)
+	{
+		// we only get to see the first buffer before committing to a strategy. Usually that's plenty.
+		cimbar::compression_probe::choice choice = cimbar::compression_probe::choose(reinterpret_cast<const char*>(buffer), size, level, budget);
+		comp.set_compression_level(choice.level);
+		if (choice.strat != cimbar::compression_probe::STRONG)
+			comp.write_strategy(choice.strat, choice.level);
+	}
+
+	fountain_encoder_stream::ptr finish_encode(compressor& comp, unsigned chunkSize, unsigned chunksPerFrame, uint8_t encodeId)
+	{
+		if (!comp.finish())
+			return nullptr;
+		size_t compressedSize = comp.size();
+		if (compressedSize < chunkSize)
+			comp.pad(chunkSize - compressedSize + 1);
+		fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(comp, chunkSize, encodeId);
+		// we show the file on a loop, and receivers can join at any point. Don't repeat ourselves.
+		if (fes)
+			fes->set_schedule(chunksPerFrame);
+		return fes;
+	}
+
+	// no threads in the single-threaded wasm build. There, the work happens when we swap.
+	std::launch prepare_policy()
+	{
+#if defined(__EMSCRIPTEN__) and !defined(__EMSCRIPTEN_PTHREADS__)
+		return std::launch::deferred;
+#else
+		return std::launch::async;
+#endif
+	}
 }
 
 extern "C" {
@@ -111,10 +159,8 @@ int cimbare_next_frame(bool color_balance)
 	if (!_fes)
 		return -1;
 
-	// we generate 8x the amount of required symbol blocks.
-	// this number is somewhat arbitrary, but needs to not be
-	// *too* low (1-2), or we risk long runs of blocks the decoder
-	// has already seen.
+	// every 8x the amount of required symbol blocks, we call it a loop.
+	// the block ids don't start over (see FountainSchedule), but callers use the loop to decide when to move on to the next file.
 	unsigned required = _fes->blocks_required() * 8;
 	if (_fes->block_count() > required)
 	{
@@ -128,6 +174,7 @@ int cimbare_next_frame(bool color_balance)
 	if (color_balance) // default is: disabled
 		enc.set_color_mode(cimbar::Config::color_mode() + 0x100);
 	enc.set_encode_id(_encodeId);
+	enc.set_frame_header(true);
 	_next = enc.encode_next(*_fes, _window? cimbar::vec_xy{_window->width(), _window->height()} : cimbar::vec_xy{});
 	return ++_frameCount;
 }
@@ -150,7 +197,7 @@ int cimbare_init_encode(const char* filename, unsigned fnsize, int encode_id)
 	else
 		_encodeId = encode_id;
 
-	_comp = std::make_unique<cimbar::zstd_compressor<std::stringstream>>();
+	_comp = std::make_unique<compressor>();
 	if (!_comp)
 		return -1;
 
@@ -158,14 +205,54 @@ int cimbare_init_encode(const char* filename, unsigned fnsize, int encode_id)
 
 	if (fnsize > 0 and filename != nullptr)
 		_comp->write_header(filename, fnsize);
+	_probed = false;
+	_archive = false;
 
 	_fes.reset();
 	return 0;
 }
 
+// like cimbare_init_encode(), but for many files in one stream. The receiver unpacks them into a directory called `name`.
+// add files with cimbare_archive_add(), then finish with cimbare_encode(nullptr, 0).
+int cimbare_init_archive(const char* name, unsigned namesize, int encode_id)
+{
+	if (namesize == 0 or name == nullptr)
+		return -4;
+
+	int res = cimbare_init_encode(nullptr, 0, encode_id);
+	if (res < 0)
+		return res;
+
+	// one zstd frame over the whole archive, so small files get to share a context
+	_comp->set_streaming(true);
+	_comp->write_archive_header(name, namesize);
+	// there's no single first buffer to look at. Assume the level we were given is what we want.
+	_probed = true;
+	_archive = true;
+	return 0;
+}
+
+int cimbare_archive_add(const char* filename, unsigned fnsize, const unsigned char* buffer, unsigned size)
+{
+	if (!_comp or !_archive)
+		return -1;
+
+	std::string name(filename, fnsize);
+	if (!cimbar::archive::safe_name(name))
+		return -4;
+
+	std::string header = cimbar::archive::entry_header(name, size);
+	if (!_comp->write(header.data(), header.size()))
+		return -2;
+	if (size > 0 and !_comp->write(reinterpret_cast<const char*>(buffer), size))
+		return -2;
+	return 0;
+}
+
 int cimbare_encode_bufsize()
 {
-	return cimbar::zstd_compressor<std::stringstream>::CHUNK_SIZE;
+	// a few chunks at a time, so compression_probe gets a decent look at the first buffer
+	return compressor::CHUNK_SIZE * 4;
 }
 
 int cimbare_encode(const unsigned char* buffer, unsigned size)
@@ -173,22 +260,23 @@ int cimbare_encode(const unsigned char* buffer, unsigned size)
 	if (!_comp)
 		return -1;
 
+	if (size > 0 and !_probed)
+	{
+		probe(*_comp, buffer, size, _compressionLevel, _compressionBudget);
+		_probed = true;
+	}
+
 	if (size > 0)
 	{
-		if (!_comp->write(reinterpret_cast<const char*>(buffer), size))
+		// archive contents go through cimbare_archive_add()
+		if (_archive or !_comp->write(reinterpret_cast<const char*>(buffer), size))
 			return -2;
 	}
 	if (size%cimbare_encode_bufsize() == 0 and size != 0)
 		return 1; // more to do
 
-	// otherwise, we're ready
-	unsigned fountainChunkSize = cimbar::Config::fountain_chunk_size();
-	size_t compressedSize = _comp->size();
-	if (compressedSize < fountainChunkSize)
-		_comp->pad(fountainChunkSize - compressedSize + 1);
-
-	// create the encoder stream
-	_fes = fountain_encoder_stream::create(*_comp, fountainChunkSize, _encodeId);
+	// otherwise, we're ready. Create the encoder stream
+	_fes = finish_encode(*_comp, cimbar::Config::fountain_chunk_size(), cimbar::Config::fountain_chunks_per_frame(), _encodeId);
 	_comp.reset();
 	if (!_fes)
 		return -3;
@@ -197,6 +285,85 @@ int cimbare_encode(const unsigned char* buffer, unsigned size)
 	return 0;
 }
 
+// compress + encode a whole file in the background, while the current one keeps rendering.
+// `buffer` must stay valid until cimbare_swap_next() has returned 1 (or failed).
+// a second call waits for the first one's work to finish, then replaces it.
+int cimbare_prepare_next(const char* filename, unsigned fnsize, const unsigned char* buffer, unsigned size, int encode_id)
+{
+	if (!FountainInit::init())
+	{
+		std::cerr << "failed FountainInit :(" << std::endl;
+		return -5;
+	}
+	if (size == 0 or buffer == nullptr)
+		return -4;
+
+	_pendingEncodeId = (encode_id < 0)? _encodeId + 1 : encode_id;
+	_pendingChunkSize = cimbar::Config::fountain_chunk_size();
+	_pendingChunksPerFrame = cimbar::Config::fountain_chunks_per_frame();
+
+	std::string name = (fnsize > 0 and filename != nullptr)? std::string(filename, fnsize) : std::string();
+	_pending = std::async(prepare_policy(),
+		[name, buffer, size, level=_compressionLevel, budget=_compressionBudget, chunkSize=_pendingChunkSize, chunksPerFrame=_pendingChunksPerFrame, encodeId=_pendingEncodeId] () -> fountain_encoder_stream::ptr
+		{
+			compressor comp;
+			comp.set_compression_level(level);
+			if (!name.empty())
+				comp.write_header(name.data(), name.size());
+			probe(comp, buffer, size, level, budget);
+			if (!comp.write(reinterpret_cast<const char*>(buffer), size))
+				return nullptr;
+			return finish_encode(comp, chunkSize, chunksPerFrame, encodeId);
+		}
+	);
+	return 0;
+}
+
+// 1 == the prepared file is ready to swap in
+int cimbare_next_ready()
+{
+	if (!_pending.valid())
+		return -1;
+	return _pending.wait_for(std::chrono::seconds(0)) != std::future_status::timeout;
+}
+
+// make the prepared file the current one. The frame on screen stays put until the next call to cimbare_next_frame().
+// returns 1 if we swapped, 0 if it isn't ready yet (and wait == false), <0 on failure.
+int cimbare_swap_next(bool wait)
+{
+	if (!_pending.valid())
+		return -1;
+	if (!wait and !cimbare_next_ready())
+		return 0;
+
+	fountain_encoder_stream::ptr fes = _pending.get();
+	if (!fes)
+		return -3;
+
+	// the mode may have changed while we were busy
+	unsigned chunkSize = cimbar::Config::fountain_chunk_size();
+	if (chunkSize != _pendingChunkSize)
+	{
+		if (!fes->restart_and_resize_buffer(chunkSize))
+			return -3;
+		fes->set_schedule(cimbar::Config::fountain_chunks_per_frame());
+	}
+
+	_comp.reset();
+	_fes = fes;
+	_encodeId = _pendingEncodeId;
+	_frameCount = 0;
+	if (_window)
+		_window->shake(0);
+	return 1;
+}
+
+int cimbare_set_compression_budget(unsigned ms)
+{
+	_compressionBudget = ms;
+	return 0;
+}
+
 int cimbare_configure(int mode_val, int compression)
 {
 	if (compression < 0 or compression > 22)
@@ -231,6 +398,8 @@ int cimbare_configure(int mode_val, int compression)
 					_window->clear();
 				_next.reset();
 			}
+			else
+				_fes->set_schedule(cimbar::Config::fountain_chunks_per_frame());
 			_frameCount = 0;
 			if (_window)
 				_window->shake(0);
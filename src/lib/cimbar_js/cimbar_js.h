@@ -11,9 +11,15 @@ int cimbare_rotate_window(bool rotate);
 int cimbare_render();
 int cimbare_next_frame(bool color_balance=false);
 int cimbare_init_encode(const char* filename, unsigned fnsize, int encode_id);
+int cimbare_init_archive(const char* name, unsigned namesize, int encode_id);
+int cimbare_archive_add(const char* filename, unsigned fnsize, const unsigned char* buffer, unsigned size);
 int cimbare_encode_bufsize();
 int cimbare_encode(const unsigned char* buffer, unsigned size);
+int cimbare_prepare_next(const char* filename, unsigned fnsize, const unsigned char* buffer, unsigned size, int encode_id);
+int cimbare_next_ready();
+int cimbare_swap_next(bool wait=false);
 int cimbare_configure(int mode_val, int compression);
+int cimbare_set_compression_budget(unsigned ms); // 0 == no limit
 float cimbare_get_aspect_ratio();
 
 // internal usage
@@ -2,8 +2,9 @@
 #include "cimbar_recv_js.h"
 
 #include "cimb_translator/Config.h"
+#include "cimb_translator/FrameHeader.h"
 #include "compression/zstd_header_check.h"
-#include "encoder/Decoder.h"
+#include "encoder/DecodeSession.h"
 #include "encoder/escrow_buffer_writer.h"
 #include "extractor/Extractor.h"
 #include "fountain/fountain_decoder_sink.h"
@@ -19,8 +20,8 @@
 
 
 namespace {
-	// for decode
-	std::shared_ptr<fountain_decoder_sink> _sink;
+	// for decode. The session has the mode, the ccm, and the fountain sink -- a mode change means a new one
+	std::unique_ptr<DecodeSession> _session;
 
 	// for decompress
 	// we support only one decompress at a time!
@@ -34,9 +35,19 @@ namespace {
 	TimeAccumulator _tScanExtract;
 	TimeAccumulator _tImgDecode;
 
-	// settings
+	// settings. 0 == auto: start out as mode B, and follow the frame header from there
 	int _modeVal = 68;
 
+	DecodeSession& session()
+	{
+		if (!_session)
+		{
+			_session = std::make_unique<DecodeSession>(_modeVal? _modeVal : 68);
+			_session->set_auto_mode(_modeVal == 0);
+		}
+		return *_session;
+	}
+
 	// set up stateful decompressor
 	// for api simplicity, this is coupled to recover_contents()
 	// ... but we *could* split them up
@@ -59,13 +70,14 @@ namespace {
 	{
 		if (id != _decId)
 		{
-			if (!_sink)
+			fountain_decoder_sink* sink = session().sink();
+			if (!sink)
 				return -1;
-			if (_sink->is_done(id))
+			if (sink->is_done(id))
 				return -2; // it's gone man
 
 			_reassembled.resize(cimbard_get_filesize(id));
-			if (!_sink->recover(id, _reassembled.data(), _reassembled.size()))
+			if (!sink->recover(id, _reassembled.data(), _reassembled.size()))
 				return -3;
 			_decId = id;
 
@@ -81,14 +93,13 @@ namespace {
 
 	unsigned fountain_chunks_per_frame()
 	{
-		return cimbar::Config::fountain_chunks_per_frame(
-			cimbar::Config::bits_per_cell()
-		);
+		const cimbar::conf& cc = session().conf();
+		return cc.fountain_chunks_per_frame(cc.bits_per_cell());
 	}
 
 	unsigned fountain_chunk_size()
 	{
-		return cimbar::Config::fountain_chunk_size();
+		return session().conf().fountain_chunk_size();
 	}
 
 	cv::UMat get_rgb(void* imgdata, int width, int height, int type)
@@ -142,7 +153,22 @@ unsigned cimbard_get_debug(uchar* buff, unsigned maxlen)
 
 int cimbard_get_bufsize()
 {
-	return fountain_chunks_per_frame() * fountain_chunk_size();
+	if (_modeVal != 0)
+		return fountain_chunks_per_frame() * fountain_chunk_size();
+
+	// in auto mode, any of them could show up
+	unsigned bufsize = 0;
+	for (unsigned mode_val : FrameHeader::MODES)
+	{
+		cimbar::conf cc = cimbar::Config::temp_conf(mode_val);
+		bufsize = std::max(bufsize, cc.fountain_chunks_per_frame(cc.bits_per_cell()) * cc.fountain_chunk_size());
+	}
+	return bufsize;
+}
+
+int cimbard_get_mode()
+{
+	return session().conf().mode_val;
 }
 
 int cimbard_scan_extract_decode(const uchar* imgdata, unsigned imgw, unsigned imgh, int format, uchar* bufspace, unsigned bufsize)
@@ -152,17 +178,11 @@ int cimbard_scan_extract_decode(const uchar* imgdata, unsigned imgw, unsigned im
 	if (imgw == 0 or imgh == 0)
 		return -1;
 
-	unsigned chunksPerFrame = fountain_chunks_per_frame();
-	unsigned chunkSize = fountain_chunk_size();
 	// early bail if bufsize doesn't match config params (fountain chunk size * count)
-	if (bufsize < chunkSize * chunksPerFrame)
+	// in auto mode, the extract can change those, so we check again after.
+	if (bufsize < fountain_chunk_size() * fountain_chunks_per_frame())
 		return -2;
 
-	// interface to take the aligned output buffers of chunkSize and dump them into bufspace
-	escrow_buffer_writer ebw(bufspace, chunksPerFrame, chunkSize);
-	Extractor ext;
-	Decoder dec;
-
 	cv::UMat img = get_rgb((void*)imgdata, imgw, imgh, format);
 	_debugFrame = img.getMat(cv::ACCESS_READ).clone();
 
@@ -171,18 +191,26 @@ int cimbard_scan_extract_decode(const uchar* imgdata, unsigned imgw, unsigned im
 	bool shouldPreprocess = true;
 	{
 		Timer t(_tScanExtract);
-		int res = ext.extract(img, img);
+		int res = session().extract(img, img);
 		if (!res)
 			return -3;
 		else if (res == Extractor::NEEDS_SHARPEN)
 			shouldPreprocess = true;
 	}
 
+	unsigned chunksPerFrame = fountain_chunks_per_frame();
+	unsigned chunkSize = fountain_chunk_size();
+	if (bufsize < chunkSize * chunksPerFrame)
+		return -2;
+
+	// interface to take the aligned output buffers of chunkSize and dump them into bufspace
+	escrow_buffer_writer ebw(bufspace, chunksPerFrame, chunkSize);
+
 	// decode
 	int bytes = 0;
 	{
 		Timer t(_tImgDecode);
-		dec.decode_fountain(img, ebw, shouldPreprocess);
+		session().decode_fountain(img, ebw, shouldPreprocess);
 	}
 	_reporting = fmt::format("sce: {}, imgdec: {}, decoded {} bytes!!! {}", _tScanExtract.avg(), _tImgDecode.avg(), bytes, ebw.buffers_in_use() * chunkSize);
 	return ebw.buffers_in_use() * chunkSize;
@@ -192,8 +220,9 @@ int cimbard_scan_extract_decode(const uchar* imgdata, unsigned imgw, unsigned im
 int64_t cimbard_fountain_decode(const unsigned char* buffer, unsigned size)
 {
 	unsigned chunkSize = fountain_chunk_size();
-	if (!_sink) // lazy-create the sink on first run
-		_sink = std::make_shared<fountain_decoder_sink>(chunkSize);
+	if (!session().sink()) // lazy-create the sink on first run
+		session().set_sink(std::make_shared<fountain_decoder_sink>(chunkSize));
+	fountain_decoder_sink& sink = *session().sink();
 
 	if (size == 0 or size % chunkSize != 0)
 		return -5;
@@ -203,13 +232,13 @@ int64_t cimbard_fountain_decode(const unsigned char* buffer, unsigned size)
 	{
 		/*std::cout << fmt::format("buff {} of {} -- {},{},{},{},{},{}", i, size, (unsigned)buffer[0+i], (unsigned)buffer[1+i],
 				(unsigned)buffer[2+i], (unsigned)buffer[3+i], (unsigned)buffer[4+i], (unsigned)buffer[5+i]) << std::endl;*/
-		res = _sink->decode_frame(reinterpret_cast<const char*>(buffer+i), chunkSize);
+		res = sink.decode_frame(reinterpret_cast<const char*>(buffer+i), chunkSize);
 	}
 
 	std::cout << "fountain decode res is " << res << std::endl;
 
 	// res will be the file id on completion, 0 otherwise
-	_reporting = fmt::format("[ {} ]", turbo::str::join(_sink->get_progress(), ','));
+	_reporting = fmt::format("[ {} ]", turbo::str::join(sink.get_progress(), ','));
 	std::cout << _reporting << std::endl;
 	return res;
 }
@@ -271,17 +300,16 @@ int cimbard_get_decompress_bufsize()
 
 int cimbard_configure_decode(int mode_val)
 {
-	// defaults
-	if (mode_val <= 0)
+	// defaults. 0 is auto
+	if (mode_val < 0)
 		mode_val = 68;
 
 	bool refresh = (mode_val != _modeVal);
 	if (refresh)
 	{
-		// update config
+		// new mode, new session (and sink, and ccm -- different palette)
 		_modeVal = mode_val;
-		cimbar::Config::update(mode_val);
-		_sink.reset();
+		_session.reset();
 	}
 
 	return 0;
@@ -14,6 +14,8 @@ unsigned cimbard_get_debug(unsigned char* buff, unsigned maxlen);
 // imgsize=width*height*channels for rgba. Other formats are weirder.
 // output of scan is stored in `bufspace`
 int cimbard_get_bufsize();
+// the mode we're decoding as. With auto mode (see cimbard_configure_decode()), check after each scan_extract_decode
+int cimbard_get_mode();
 int cimbard_scan_extract_decode(const unsigned char* imgdata, unsigned imgw, unsigned imgh, int format, unsigned char* bufspace, unsigned bufsize);
 
 // returns id of final file (can be used to get size of `finish_copy`'s buffer) if complete, 0 if success, negative on error
@@ -33,6 +35,7 @@ int cimbard_get_filename(uint32_t id, char* filename, unsigned fnsize);
 int cimbard_get_decompress_bufsize();
 int cimbard_decompress_read(uint32_t id, unsigned char* buffer, unsigned size);
 
+// mode_val == 0 for auto mode: follow the frame header, when the sender draws one. < 0 for the default (mode B)
 int cimbard_configure_decode(int mode_val);
 
 // testing usage only!
@@ -106,3 +106,70 @@ TEST_CASE( "cimbar_jsTest/testEncodeBufsizeMult", "[unit]" )
 
 	assertEquals( -1, cimbare_encode(nullptr, 0) );
 }
+
+TEST_CASE( "cimbar_jsTest/testPrepareNext", "[unit]" )
+{
+	std::vector<unsigned char> decbuff;
+	decbuff.resize(cimbard_get_bufsize());
+
+	std::string contents = random_string(7000);
+	std::string filename = "/tmp/next.txt";
+	assertEquals( 0, cimbare_prepare_next(filename.data(), filename.size(), reinterpret_cast<unsigned char*>(contents.data()), contents.size(), 101) );
+	assertEquals( 1, cimbare_swap_next(true) );
+	// nothing left to swap
+	assertEquals( -1, cimbare_swap_next() );
+	assertEquals( -1, cimbare_next_ready() );
+
+	assertEquals( 1, cimbare_next_frame() );
+
+	unsigned char* imgbuff;
+	int imgsize = cimbare_get_frame_buff(&imgbuff);
+	assertEquals( 1024*1024*3, imgsize );
+
+	int bytes = cimbard_scan_extract_decode(imgbuff, 1024, 1024, 3, decbuff.data(), decbuff.size());
+	int64_t res = cimbard_fountain_decode(decbuff.data(), bytes);
+	assertTrue( res > 0 );
+
+	std::string actualFilename(255, '\0');
+	int fnsz = cimbard_get_filename(res, actualFilename.data(), actualFilename.size());
+	actualFilename.resize(fnsz);
+	assertEquals( "next.txt", actualFilename );
+}
+
+TEST_CASE( "cimbar_jsTest/testAutoMode", "[unit]" )
+{
+	// a mode 4C sender, a receiver in auto mode
+	assertEquals( 0, cimbare_configure(4, -1) );
+	assertEquals( 0, cimbard_configure_decode(0) );
+	assertEquals( 68, cimbard_get_mode() );
+
+	std::vector<unsigned char> decbuff;
+	decbuff.resize(cimbard_get_bufsize());
+
+	std::string contents = random_string(3000);
+	std::string filename = "/tmp/auto.txt";
+	assertEquals( 0, cimbare_init_encode(filename.data(), filename.size(), 102) );
+	assertEquals( 0, cimbare_encode(reinterpret_cast<unsigned char*>(contents.data()), contents.size()) );
+	assertEquals( 1, cimbare_next_frame() );
+
+	unsigned char* imgbuff;
+	int imgsize = cimbare_get_frame_buff(&imgbuff);
+	assertEquals( 1024*1024*3, imgsize );
+
+	int bytes = cimbard_scan_extract_decode(imgbuff, 1024, 1024, 3, decbuff.data(), decbuff.size());
+	assertTrue( bytes > 0 );
+	assertEquals( 4, cimbard_get_mode() );
+	assertEquals( 0, bytes % cimbar::Config::temp_conf(4).fountain_chunk_size() );
+
+	int64_t res = cimbard_fountain_decode(decbuff.data(), bytes);
+	assertTrue( res > 0 );
+
+	std::string actualFilename(255, '\0');
+	int fnsz = cimbard_get_filename(res, actualFilename.data(), actualFilename.size());
+	actualFilename.resize(fnsz);
+	assertEquals( "auto.txt", actualFilename );
+
+	// back to the defaults
+	assertEquals( 0, cimbare_configure(68, -1) );
+	assertEquals( 0, cimbard_configure_decode(68) );
+}
@@ -0,0 +1,236 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace cimbar {
+
+// many (small) files in one stream. What goes through zstd is a run of entries:
+//   varint name length, name, varint size, <size bytes of file>
+// names are relative paths, '/' separated.
+// everything is written/read front to back, so neither side needs to hold more than the current file.
+// the zstd header says it's an archive (see zstd_compressor::write_archive_header), and names the directory to unpack into.
+class archive
+{
+public:
+	static const unsigned MAX_NAME_LENGTH = 4096;
+
+public:
+	static std::string entry_header(const std::string& name, uint64_t size)
+	{
+		std::string res;
+		put_varint(res, name.size());
+		res += name;
+		put_varint(res, size);
+		return res;
+	}
+
+	// the name `entry` goes in under, when it was found under the directory `dir`.
+	// directories go in whole, under their own name: "a/b/" + "a/b/c/d.txt" -> "b/c/d.txt"
+	static std::string entry_name(const std::filesystem::path& dir, const std::filesystem::path& entry)
+	{
+		std::filesystem::path top = dir.lexically_normal();
+		if (!top.has_filename()) // trailing slash
+			top = top.parent_path();
+		return entry.lexically_normal().lexically_relative(top.parent_path()).generic_string();
+	}
+
+	// no absolute paths, no "..": everything has to land under the output directory
+	static bool safe_name(const std::string& name)
+	{
+		if (name.empty() or name.size() > MAX_NAME_LENGTH)
+			return false;
+		std::filesystem::path p(name);
+		if (p.is_absolute() or p.has_root_path())
+			return false;
+		for (const auto& part : p)
+			if (part == "..")
+				return false;
+		return true;
+	}
+
+protected:
+	static void put_varint(std::string& out, uint64_t val)
+	{
+		while (val >= 0x80)
+		{
+			out += (char)((val & 0x7F) | 0x80);
+			val >>= 7;
+		}
+		out += (char)val;
+	}
+};
+
+// the receiving end. Use it as the STREAM of a zstd_decompressor.
+class archive_unpacker
+{
+public:
+	archive_unpacker(std::string dir)
+		: _dir(std::move(dir))
+	{
+	}
+
+	bool good() const
+	{
+		return _good;
+	}
+
+	// the archive ended cleanly, between files
+	bool done() const
+	{
+		return _good and _state == NAME_LENGTH and _varintShift == 0;
+	}
+
+	// everything we've started writing, relative to the output directory. (if !done(), the last one is incomplete)
+	const std::vector<std::string>& files() const
+	{
+		return _files;
+	}
+
+	// directories that didn't exist until we made them (the output directory included), parents first
+	const std::vector<std::filesystem::path>& created_dirs() const
+	{
+		return _createdDirs;
+	}
+
+	// undo everything: the files, then whatever directories we made for them
+	void remove_all()
+	{
+		_out.close();
+		std::error_code ec;
+		for (const std::string& name : _files)
+			std::filesystem::remove(std::filesystem::path(_dir) / name, ec);
+		// children first. remove() leaves anything non-empty alone, so we won't take out files we didn't write
+		for (auto it = _createdDirs.rbegin(); it != _createdDirs.rend(); ++it)
+			std::filesystem::remove(*it, ec);
+		_files.clear();
+		_createdDirs.clear();
+	}
+
+	archive_unpacker& write(const char* data, std::streamsize len)
+	{
+		while (len > 0 and _good)
+		{
+			if (_state == BODY)
+			{
+				std::streamsize writeLen = std::min<uint64_t>(len, _remaining);
+				_out.write(data, writeLen);
+				data += writeLen;
+				len -= writeLen;
+				_remaining -= writeLen;
+				if (_remaining == 0)
+					close_file();
+				continue;
+			}
+
+			if (_state == NAME)
+			{
+				unsigned readLen = std::min<uint64_t>(len, _remaining);
+				_name.append(data, readLen);
+				data += readLen;
+				len -= readLen;
+				_remaining -= readLen;
+				if (_remaining == 0)
+					_state = SIZE;
+				continue;
+			}
+
+			// NAME_LENGTH or SIZE: a varint, a byte at a time
+			uint8_t b = *data++;
+			--len;
+			_varint |= (uint64_t)(b & 0x7F) << _varintShift;
+			_varintShift += 7;
+			if (b & 0x80)
+			{
+				if (_varintShift > 63)
+					_good = false;
+				continue;
+			}
+
+			uint64_t val = _varint;
+			_varint = 0;
+			_varintShift = 0;
+			if (_state == NAME_LENGTH)
+			{
+				if (val == 0 or val > archive::MAX_NAME_LENGTH)
+					_good = false;
+				_name.clear();
+				_remaining = val;
+				_state = NAME;
+			}
+			else
+			{
+				_remaining = val;
+				open_file();
+			}
+		}
+		return *this;
+	}
+
+protected:
+	void open_file()
+	{
+		if (!archive::safe_name(_name))
+		{
+			_good = false;
+			return;
+		}
+
+		std::filesystem::path path = std::filesystem::path(_dir) / _name;
+		make_dirs(std::filesystem::path(_name).parent_path());
+		_out.open(path, std::ios::binary | std::ios::trunc);
+		if (!_out)
+		{
+			_good = false;
+			return;
+		}
+
+		_files.push_back(_name);
+		_state = BODY;
+		if (_remaining == 0)
+			close_file();
+	}
+
+	// like create_directories(_dir / rel), but we remember which ones are new
+	void make_dirs(const std::filesystem::path& rel)
+	{
+		std::filesystem::path path = _dir;
+		std::vector<std::filesystem::path> parts = {path};
+		for (const auto& part : rel)
+			parts.push_back(path /= part);
+
+		for (const std::filesystem::path& dir : parts)
+		{
+			std::error_code ec;
+			if (std::filesystem::create_directory(dir, ec))
+				_createdDirs.push_back(dir);
+		}
+	}
+
+	void close_file()
+	{
+		_out.close();
+		_good &= !_out.fail();
+		_state = NAME_LENGTH;
+	}
+
+protected:
+	enum state { NAME_LENGTH, NAME, SIZE, BODY };
+
+	std::string _dir;
+	bool _good = true;
+	state _state = NAME_LENGTH;
+	uint64_t _varint = 0;
+	unsigned _varintShift = 0;
+	uint64_t _remaining = 0;
+	std::string _name;
+	std::ofstream _out;
+	std::vector<std::string> _files;
+	std::vector<std::filesystem::path> _createdDirs;
+};
+
+}
@@ -0,0 +1,156 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "zstd/zstd.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace cimbar {
+
+// a quick look at the input before we commit to compressing it.
+// jpegs, videos, zips etc won't get any smaller, so there's no point spending seconds at level 16 on them.
+// we sample a few slices of the input, and check:
+//  1. byte entropy. Near 8 bits/byte => store.
+//  2. the fast level's ratio on the samples. No real savings => store.
+//  3. the strong level vs the fast level, on one sample. Not much better => fast.
+//  4. (with a time budget) the strong level's speed on that sample, extrapolated to the whole input. Too slow => fast.
+class compression_probe
+{
+public:
+	// recorded in the zstd header (see zstd_compressor::write_strategy). No header == STRONG, which is what we always did.
+	enum strategy : uint8_t
+	{
+		STRONG = 0,
+		FAST = 1,
+		STORE = 2,
+	};
+
+	struct choice
+	{
+		strategy strat;
+		int level;
+	};
+
+	static constexpr size_t SAMPLE_SIZE = 0x4000;
+	static constexpr unsigned MAX_SAMPLES = 8;
+	static constexpr size_t MIN_PROBE_SIZE = 0x10000; // anything smaller is cheap to compress anyway
+
+	static constexpr int FAST_LEVEL = 1;
+	static constexpr double STORE_ENTROPY = 7.95; // bits per byte
+	static constexpr double STORE_RATIO = 0.97;
+	static constexpr double MIN_STRONG_GAIN = 0.02; // vs FAST_LEVEL's output
+
+public:
+	// for STORE, there's no "level 0" in zstd. The fastest negative level is ~memcpy, and every receiver already understands it.
+	static int store_level()
+	{
+		return ZSTD_minCLevel();
+	}
+
+	static choice choose(const char* data, size_t len, int level, unsigned budget_ms=0)
+	{
+		if (len < MIN_PROBE_SIZE or level <= FAST_LEVEL)
+			return {STRONG, level};
+
+		std::vector<std::pair<const char*, size_t>> samples = sample(data, len);
+		if (entropy(samples) >= STORE_ENTROPY)
+			return {STORE, store_level()};
+
+		ZSTD_CCtx* cctx = ZSTD_createCCtx();
+		if (!cctx)
+			return {STRONG, level};
+		std::vector<char> buff(ZSTD_compressBound(SAMPLE_SIZE));
+
+		size_t sampled = 0;
+		size_t fastSize = 0;
+		for (const auto& [ptr, sz] : samples)
+		{
+			sampled += sz;
+			fastSize += compressed_size(cctx, buff, ptr, sz, FAST_LEVEL);
+		}
+
+		choice res = {STRONG, level};
+		if (fastSize >= sampled * STORE_RATIO)
+			res = {STORE, store_level()};
+		else
+		{
+			// the middle sample is as good as any
+			const auto& [ptr, sz] = samples[samples.size() / 2];
+			size_t fastMid = compressed_size(cctx, buff, ptr, sz, FAST_LEVEL);
+
+			auto start = std::chrono::steady_clock::now();
+			size_t strongMid = compressed_size(cctx, buff, ptr, sz, level);
+			double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			if (strongMid >= fastMid * (1.0 - MIN_STRONG_GAIN))
+				res = {FAST, FAST_LEVEL};
+			else if (budget_ms > 0 and elapsedMs * len / sz > budget_ms)
+				res = {FAST, FAST_LEVEL};
+		}
+
+		ZSTD_freeCCtx(cctx);
+		return res;
+	}
+
+	// order-0 shannon entropy, in bits per byte
+	static double entropy(const std::vector<std::pair<const char*, size_t>>& samples)
+	{
+		std::array<size_t, 256> counts = {};
+		size_t total = 0;
+		for (const auto& [ptr, sz] : samples)
+		{
+			const uint8_t* d = reinterpret_cast<const uint8_t*>(ptr);
+			for (size_t i = 0; i < sz; ++i)
+				++counts[d[i]];
+			total += sz;
+		}
+		if (total == 0)
+			return 0;
+
+		double res = 0;
+		for (size_t c : counts)
+		{
+			if (c == 0)
+				continue;
+			double p = (double)c / total;
+			res -= p * std::log2(p);
+		}
+		return res;
+	}
+
+	static double entropy(const char* data, size_t len)
+	{
+		return entropy({{data, len}});
+	}
+
+protected:
+	// evenly spaced slices, first and last included
+	static std::vector<std::pair<const char*, size_t>> sample(const char* data, size_t len)
+	{
+		std::vector<std::pair<const char*, size_t>> samples;
+		size_t count = std::min<size_t>(MAX_SAMPLES, (len + SAMPLE_SIZE - 1) / SAMPLE_SIZE);
+		if (count <= 1)
+		{
+			samples.push_back({data, len});
+			return samples;
+		}
+
+		size_t stride = (len - SAMPLE_SIZE) / (count - 1);
+		for (size_t i = 0; i < count; ++i)
+			samples.push_back({data + i*stride, SAMPLE_SIZE});
+		return samples;
+	}
+
+	static size_t compressed_size(ZSTD_CCtx* cctx, std::vector<char>& buff, const char* data, size_t len, int level)
+	{
+		size_t res = ZSTD_compressCCtx(cctx, buff.data(), buff.size(), data, len, level);
+		return ZSTD_isError(res)? len : res;
+	}
+};
+
+}
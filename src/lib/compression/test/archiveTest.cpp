@@ -0,0 +1,177 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "archive.h"
+#include "zstd_compressor.h"
+#include "zstd_decompressor.h"
+#include "zstd_header_check.h"
+
+#include "serialize/format.h"
+#include "util/File.h"
+#include "util/MakeTempDirectory.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using namespace cimbar;
+
+namespace {
+	string pack(const std::vector<std::pair<string, string>>& files)
+	{
+		zstd_compressor<std::stringstream> comp;
+		comp.set_streaming(true);
+		string name = "stuff";
+		comp.write_archive_header(name.data(), name.size());
+		for (const auto& [fn, contents] : files)
+		{
+			string header = archive::entry_header(fn, contents.size());
+			comp.write(header.data(), header.size());
+			comp.write(contents.data(), contents.size());
+		}
+		comp.finish();
+		return comp.str();
+	}
+}
+
+TEST_CASE( "archiveTest/testEntryHeader", "[unit]" )
+{
+	assertEquals( string("\x05hello\x0a", 7), archive::entry_header("hello", 10) );
+	assertEquals( string("\x01" "a" "\x80\x01", 4), archive::entry_header("a", 128) );
+
+	assertTrue( archive::safe_name("a/b/c.txt") );
+	assertFalse( archive::safe_name("") );
+	assertFalse( archive::safe_name("/etc/passwd") );
+	assertFalse( archive::safe_name("a/../../b") );
+	assertFalse( archive::safe_name(string(archive::MAX_NAME_LENGTH+1, 'a')) );
+}
+
+TEST_CASE( "archiveTest/testRoundTrip", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	std::vector<std::pair<string, string>> files = {
+		{"readme.txt", "hello world\n"},
+		{"empty", ""},
+		{"docs/a.txt", string(50000, 'a')},
+		{"docs/nested/b.txt", "bbbbbbbb"},
+	};
+	string compressed = pack(files);
+	assertTrue( zstd_header_check::is_archive((const unsigned char*)compressed.data(), compressed.size()) );
+	assertEquals( "stuff", zstd_header_check::get_filename((const unsigned char*)compressed.data(), compressed.size()) );
+
+	zstd_decompressor<archive_unpacker> unpacker(tempdir.path() / "stuff");
+	// a few bytes at a time, so headers get split across writes
+	for (size_t i = 0; i < compressed.size(); i += 7)
+		assertTrue( unpacker.write(compressed.data() + i, std::min<size_t>(7, compressed.size() - i)) );
+	assertTrue( unpacker.done() );
+
+	assertEquals( 4, unpacker.files().size() );
+	for (const auto& [fn, contents] : files)
+	{
+		std::filesystem::path path = tempdir.path() / "stuff" / fn;
+		assertTrue( std::filesystem::exists(path) );
+		assertEquals( contents, File(path).read_all() );
+	}
+}
+
+TEST_CASE( "archiveTest/testBadNames", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	string compressed = pack({{"ok.txt", "fine"}, {"../escape.txt", "not fine"}, {"after.txt", "never"}});
+
+	zstd_decompressor<archive_unpacker> unpacker(tempdir.path() / "stuff");
+	unpacker.write(compressed.data(), compressed.size());
+	assertFalse( unpacker.good() );
+	assertFalse( unpacker.done() );
+
+	assertEquals( 1, unpacker.files().size() );
+	assertFalse( std::filesystem::exists(tempdir.path() / "escape.txt") );
+	assertFalse( std::filesystem::exists(tempdir.path() / "stuff" / "after.txt") );
+}
+
+TEST_CASE( "archiveTest/testTruncated", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	// the last file is incomplete
+	string data = archive::entry_header("big.txt", 10000) + string(9000, 'x');
+
+	archive_unpacker unpacker(tempdir.path() / "stuff");
+	unpacker.write(data.data(), data.size());
+	assertTrue( unpacker.good() );
+	assertFalse( unpacker.done() );
+	assertEquals( 1, unpacker.files().size() );
+
+	string rest(1000, 'x');
+	unpacker.write(rest.data(), rest.size());
+	assertTrue( unpacker.done() );
+	assertEquals( string(10000, 'x'), File(tempdir.path() / "stuff" / "big.txt").read_all() );
+}
+
+TEST_CASE( "archiveTest/testRemoveAll", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+	std::filesystem::create_directories(tempdir.path() / "stuff" / "old");
+
+	// a complete file in a new subdirectory, then a partial one two levels further down
+	string data = archive::entry_header("new/a.txt", 5) + "aaaaa"
+	            + archive::entry_header("new/deeper/b.txt", 100) + string(10, 'b');
+
+	archive_unpacker unpacker(tempdir.path() / "stuff");
+	unpacker.write(data.data(), data.size());
+	assertFalse( unpacker.done() );
+	assertEquals( 2, unpacker.created_dirs().size() );
+
+	unpacker.remove_all();
+	assertFalse( std::filesystem::exists(tempdir.path() / "stuff" / "new") );
+	// not ours, so it stays
+	assertTrue( std::filesystem::exists(tempdir.path() / "stuff" / "old") );
+
+	// if we made the output directory, that goes too
+	archive_unpacker fresh(tempdir.path() / "fresh");
+	fresh.write(data.data(), data.size());
+	assertEquals( 3, fresh.created_dirs().size() );
+	fresh.remove_all();
+	assertFalse( std::filesystem::exists(tempdir.path() / "fresh") );
+}
+
+TEST_CASE( "archiveTest/testEntryName", "[unit]" )
+{
+	assertEquals( "mydir/sub/a.txt", archive::entry_name("some/mydir", "some/mydir/sub/a.txt") );
+	assertEquals( "mydir/sub/a.txt", archive::entry_name("some/mydir/", "some/mydir/sub/a.txt") );
+	assertEquals( "mydir/sub/a.txt", archive::entry_name("some/./mydir//", "some/mydir/sub/a.txt") );
+	assertEquals( "mydir/a.txt", archive::entry_name("mydir/", "mydir/a.txt") );
+}
+
+TEST_CASE( "archiveTest/testRoundTrip.TrailingSlash", "[unit]" )
+{
+	// two directories with the same layout, one of them given as "dir/". They shouldn't land on top of each other
+	MakeTempDirectory tempdir;
+	for (string dir : {"one", "two"})
+	{
+		std::filesystem::create_directories(tempdir.path() / "in" / dir / "sub");
+		std::ofstream f(tempdir.path() / "in" / dir / "sub" / "a.txt");
+		f << "from " << dir;
+	}
+
+	std::vector<std::pair<string, string>> files;
+	for (string arg : {(tempdir.path() / "in" / "one").string() + "/", (tempdir.path() / "in" / "two").string()})
+		for (const auto& entry : std::filesystem::recursive_directory_iterator(arg))
+			if (entry.is_regular_file())
+				files.push_back({archive::entry_name(arg, entry.path()), File(entry.path()).read_all()});
+	assertEquals( 2, files.size() );
+
+	string compressed = pack(files);
+	zstd_decompressor<archive_unpacker> unpacker(tempdir.path() / "stuff");
+	assertTrue( unpacker.write(compressed.data(), compressed.size()) );
+	assertTrue( unpacker.done() );
+
+	assertEquals( 2, unpacker.files().size() );
+	assertEquals( "from one", File(tempdir.path() / "stuff" / "one" / "sub" / "a.txt").read_all() );
+	assertEquals( "from two", File(tempdir.path() / "stuff" / "two" / "sub" / "a.txt").read_all() );
+}
@@ -0,0 +1,130 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "compression_probe.h"
+#include "zstd_compressor.h"
+#include "zstd_decompressor.h"
+#include "zstd_header_check.h"
+
+#include "serialize/format.h"
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using namespace cimbar;
+
+namespace {
+	using random_bytes_engine = std::independent_bits_engine<std::default_random_engine, CHAR_BIT, unsigned char>;
+
+	string big_random(size_t size)
+	{
+		random_bytes_engine rbe;
+		std::string data;
+		data.resize(size);
+		std::generate(begin(data), end(data), std::ref(rbe));
+		return data;
+	}
+
+	string big_text(size_t size)
+	{
+		std::vector<string> words = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog", "fountain", "codes", "are", "neat",
+		                             "color", "symbol", "camera", "frame", "decode", "encode", "and", "or", "not", "with", "some", "bits"};
+		std::default_random_engine rng;
+		std::string data;
+		while (data.size() < size)
+		{
+			data += words[rng() % words.size()];
+			data += (rng() % 12 == 0)? fmt::format(" {}\n", rng() % 10000) : " ";
+		}
+		data.resize(size);
+		return data;
+	}
+
+	string repetitive_text(size_t size)
+	{
+		std::string data;
+		for (unsigned i = 0; data.size() < size; ++i)
+			data += fmt::format("line {}: the quick brown fox jumps over {} lazy dogs\n", i, i*7 % 1000);
+		data.resize(size);
+		return data;
+	}
+}
+
+TEST_CASE( "compression_probeTest/testEntropy", "[unit]" )
+{
+	string zeros(10000, '\0');
+	assertEquals( 0, compression_probe::entropy(zeros.data(), zeros.size()) );
+
+	string ab;
+	for (unsigned i = 0; i < 5000; ++i)
+		ab += "ab";
+	assertEquals( 1.0, compression_probe::entropy(ab.data(), ab.size()) );
+
+	string random = big_random(100000);
+	assertInRange( 7.99, compression_probe::entropy(random.data(), random.size()), 8.0 );
+}
+
+TEST_CASE( "compression_probeTest/testChoose", "[unit]" )
+{
+	string random = big_random(1000000);
+	compression_probe::choice c = compression_probe::choose(random.data(), random.size(), 16);
+	assertEquals( compression_probe::STORE, c.strat );
+	assertEquals( compression_probe::store_level(), c.level );
+
+	string text = big_text(1000000);
+	c = compression_probe::choose(text.data(), text.size(), 16);
+	assertEquals( compression_probe::STRONG, c.strat );
+	assertEquals( 16, c.level );
+
+	// the fast level already does about as well as we're going to do
+	string repetitive = repetitive_text(1000000);
+	c = compression_probe::choose(repetitive.data(), repetitive.size(), 16);
+	assertEquals( compression_probe::FAST, c.strat );
+	assertEquals( compression_probe::FAST_LEVEL, c.level );
+
+	// small inputs aren't worth probing
+	c = compression_probe::choose(random.data(), 1000, 16);
+	assertEquals( compression_probe::STRONG, c.strat );
+	assertEquals( 16, c.level );
+}
+
+TEST_CASE( "compression_probeTest/testChoose.Budget", "[unit]" )
+{
+	// level 19 over 20MB won't happen in 1ms
+	string text = big_text(20000000);
+	compression_probe::choice c = compression_probe::choose(text.data(), text.size(), 19, 1);
+	assertEquals( compression_probe::FAST, c.strat );
+	assertEquals( compression_probe::FAST_LEVEL, c.level );
+
+	// ... but with no budget, we take our time
+	c = compression_probe::choose(text.data(), text.size(), 19);
+	assertEquals( compression_probe::STRONG, c.strat );
+}
+
+TEST_CASE( "compression_probeTest/testStoreRoundTrip", "[unit]" )
+{
+	string random = big_random(200000);
+
+	zstd_compressor<std::stringstream> comp;
+	string name = "foo.jpg";
+	comp.write_header(name.data(), name.size());
+	comp.write_strategy(compression_probe::STORE, compression_probe::store_level());
+	comp.set_compression_level(compression_probe::store_level());
+	assertTrue( comp.write(random.data(), random.size()) );
+
+	string compressed = comp.str();
+	assertInRange( random.size(), compressed.size(), random.size() + 1000 );
+
+	auto strategy = zstd_header_check::get_strategy((const unsigned char*)compressed.data(), compressed.size());
+	assertTrue( strategy );
+	assertEquals( compression_probe::STORE, strategy->strategy );
+	assertEquals( compression_probe::store_level(), strategy->level );
+	assertEquals( name, zstd_header_check::get_filename((const unsigned char*)compressed.data(), compressed.size()) );
+
+	zstd_decompressor<std::stringstream> dec;
+	std::stringstream input(compressed);
+	dec.decompress(input);
+	assertEquals( random, dec.str() );
+}
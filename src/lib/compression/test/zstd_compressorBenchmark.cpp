@@ -0,0 +1,115 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "zstd_compressor.h"
+
+#include "serialize/format.h"
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using namespace cimbar;
+using namespace std;
+
+// not run by default. `compression_test [benchmark]` to see the numbers.
+
+namespace {
+	const size_t PAYLOAD_SIZE = 0x1000000;
+
+	string text_payload()
+	{
+		// log-ish lines: repetitive structure, varying numbers
+		std::default_random_engine rng;
+		std::uniform_int_distribution<unsigned> dist(0, 99999);
+		string res;
+		for (unsigned i = 0; res.size() < PAYLOAD_SIZE; ++i)
+			res += fmt::format("2024-01-01T00:{:02}:{:02} worker={} status=ok latency_us={} bytes={}\n", (i/60)%60, i%60, i%8, dist(rng), dist(rng)*3);
+		res.resize(PAYLOAD_SIZE);
+		return res;
+	}
+
+	string binary_payload()
+	{
+		// fixed-size records of small-ish integers, a la a table dump
+		std::default_random_engine rng;
+		std::uniform_int_distribution<uint32_t> dist(0, 1000);
+		string res;
+		res.reserve(PAYLOAD_SIZE);
+		for (uint32_t i = 0; res.size() < PAYLOAD_SIZE; ++i)
+		{
+			uint32_t rec[4] = {i, dist(rng), dist(rng) * dist(rng), 0xCAFE};
+			res.append((const char*)rec, sizeof(rec));
+		}
+		res.resize(PAYLOAD_SIZE);
+		return res;
+	}
+
+	string random_payload()
+	{
+		std::independent_bits_engine<std::default_random_engine, CHAR_BIT, unsigned char> rbe;
+		string res(PAYLOAD_SIZE, '\0');
+		std::generate(begin(res), end(res), std::ref(rbe));
+		return res;
+	}
+
+	string repeats_payload()
+	{
+		// a few MB of random data, repeated: the repeats are well outside a 16KB chunk.
+		// (think: an archive with several near-identical files)
+		string block = random_payload().substr(0, PAYLOAD_SIZE/4);
+		string res;
+		while (res.size() < PAYLOAD_SIZE)
+			res += block;
+		return res;
+	}
+
+	void run(const string& name, const string& payload, const std::function<void(zstd_compressor<std::stringstream>&)>& configure)
+	{
+		zstd_compressor<std::stringstream> comp;
+		configure(comp);
+
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < payload.size(); i+=zstd_compressor<std::stringstream>::CHUNK_SIZE)
+			comp.write(payload.data()+i, std::min<size_t>(zstd_compressor<std::stringstream>::CHUNK_SIZE, payload.size()-i));
+		comp.finish();
+		auto end = std::chrono::steady_clock::now();
+
+		double secs = std::chrono::duration<double>(end - start).count();
+		size_t outSize = comp.str().size();
+		fmt::print("  {:<24} ratio {:>7.3f}  {:>8.1f} MB/s\n", name, payload.size() * 1.0 / outSize, payload.size() / secs / 1000000);
+	}
+}
+
+TEST_CASE( "zstd_compressorTest/benchmark", "[.][benchmark]" )
+{
+	unsigned workers = std::max(2u, std::thread::hardware_concurrency());
+
+	std::vector<std::pair<string, string>> payloads = {
+		{"text", text_payload()},
+		{"binary", binary_payload()},
+		{"random", random_payload()},
+		{"repeats", repeats_payload()},
+	};
+
+	for (auto&& [name, payload] : payloads)
+	{
+		fmt::print("{} ({} bytes)\n", name, payload.size());
+		run("chunked", payload, [](auto&) {});
+		run("stream", payload, [](auto& c) {
+			c.set_streaming(true);
+		});
+		run(fmt::format("stream x{}", workers), payload, [workers](auto& c) {
+			c.set_streaming(true);
+			c.set_workers(workers);
+		});
+		run(fmt::format("stream x{} +ldm", workers), payload, [workers](auto& c) {
+			c.set_streaming(true);
+			c.set_workers(workers);
+			c.set_long_distance_matching(true);
+		});
+	}
+}
@@ -174,3 +174,56 @@ TEST_CASE( "zstd_compressorTest/testRoundTrip.BeeegNotSoRandom", "[unit]" )
 	assertEquals( original, recovered );
 }
 
+
+TEST_CASE( "zstd_compressorTest/testRoundTrip.Streaming", "[unit]" )
+{
+	const int SIZE = 3000000;
+	string original;
+	for (unsigned i = 0; original.size() < SIZE; ++i)
+		original += fmt::format("{} {}\n", i, i*i);
+
+	zstd_compressor<std::stringstream> chunked;
+	assertTrue( chunked.write(original.data(), original.size()) );
+
+	zstd_compressor<std::stringstream> comp;
+	comp.set_streaming(true);
+	comp.set_workers(2);
+	comp.set_long_distance_matching(true);
+	comp.set_window_log(23);
+
+	// odd sizes are fine in streaming mode
+	for (unsigned i = 0; i < original.size(); i+=10007)
+		assertTrue( comp.write(original.data()+i, std::min<size_t>(10007, original.size()-i)) );
+	assertTrue( comp.finish() );
+
+	string output = comp.str();
+	assertTrue( output.size() < chunked.str().size() );
+
+	zstd_decompressor<std::stringstream> dec;
+	assertTrue( dec.write(output.data(), output.size()) );
+
+	string recovered = dec.str();
+	assertEquals( original.size(), recovered.size() );
+	assertEquals( original, recovered );
+}
+
+TEST_CASE( "zstd_compressorTest/testStreaming.Compress", "[unit]" )
+{
+	// compress() finishes the frame for us. And the header still leads the way.
+	std::stringstream ss;
+	for (int i = 0; i < 100000; ++i)
+		ss << "0123456789";
+
+	zstd_compressor<std::stringstream> comp;
+	comp.set_streaming(true);
+	comp.write_header("foo.txt", 7);
+	assertEquals( 1000000, comp.compress(ss) );
+	assertTrue( comp.finish() ); // no-op
+
+	string output = comp.str();
+	assertInRange( 30, output.size(), 200 );
+
+	zstd_decompressor<std::stringstream> dec;
+	assertTrue( dec.write(output.data(), output.size()) );
+	assertEquals( ss.str(), dec.str() );
+}
@@ -0,0 +1,115 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "zstd_compressor.h"
+#include "zstd_decompressor.h"
+#include "zstd_dictionary.h"
+#include "zstd_header_check.h"
+
+#include "serialize/format.h"
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using namespace cimbar;
+
+namespace {
+	// small, similar-looking json blobs
+	string sample_json(std::default_random_engine& rng)
+	{
+		std::vector<string> levels = {"debug", "info", "warning", "error"};
+		std::vector<string> services = {"frontend", "scheduler", "storage", "auth", "billing"};
+		string res = "[";
+		for (unsigned i = 0; i < 10; ++i)
+		{
+			if (i)
+				res += ",";
+			res += fmt::format(R"({{"timestamp": "2024-05-{:02}T{:02}:{:02}:{:02}Z", "level": "{}", "service": "{}", "request_id": "{:08x}", "latency_ms": {}}})",
+			                   rng() % 28 + 1, rng() % 24, rng() % 60, rng() % 60, levels[rng() % levels.size()], services[rng() % services.size()], rng(), rng() % 1000);
+		}
+		return res + "]";
+	}
+
+	string compress(const string& input, const zstd_dictionary* dict)
+	{
+		zstd_compressor<std::stringstream> comp;
+		if (dict)
+			comp.set_dictionary(*dict);
+		string name = "log.json";
+		comp.write_header(name.data(), name.size());
+		comp.write(input.data(), input.size());
+		return comp.str();
+	}
+}
+
+TEST_CASE( "zstd_dictionaryTest/testTrain", "[unit]" )
+{
+	std::default_random_engine rng;
+	std::vector<string> samples;
+	for (unsigned i = 0; i < 500; ++i)
+		samples.push_back(sample_json(rng));
+
+	zstd_dictionary dict = zstd_dictionary::train(samples, 0x4000);
+	assertInRange( 0x1000, dict.size(), 0x4000 );
+	assertTrue( dict.id() != 0 );
+
+	// same content, same id
+	assertEquals( dict.id(), zstd_dictionary(dict.str()).id() );
+	assertTrue( dict.id() != zstd_dictionary(dict.str() + "!").id() );
+}
+
+TEST_CASE( "zstd_dictionaryTest/testRoundTrip", "[unit]" )
+{
+	std::default_random_engine rng;
+	std::vector<string> samples;
+	for (unsigned i = 0; i < 500; ++i)
+		samples.push_back(sample_json(rng));
+	zstd_dictionary dict = zstd_dictionary::train(samples);
+
+	string input = sample_json(rng);
+	string plain = compress(input, nullptr);
+	string withDict = compress(input, &dict);
+
+	// a lot smaller. (the timestamps, ids and latencies are random, so there's a limit)
+	assertTrue( withDict.size() < plain.size() * 3 / 4 );
+
+	// the header says which dictionary we need
+	const unsigned char* header = reinterpret_cast<const unsigned char*>(withDict.data());
+	assertEquals( dict.id(), zstd_header_check::get_dictionary_id(header, withDict.size()) );
+	assertEquals( "log.json", zstd_header_check::get_filename(header, withDict.size()) );
+	assertEquals( 0, zstd_header_check::get_dictionary_id(reinterpret_cast<const unsigned char*>(plain.data()), plain.size()) );
+
+	zstd_decompressor<std::stringstream> dec;
+	assertTrue( dec.set_dictionary(dict) );
+	assertTrue( dec.write(withDict.data(), withDict.size()) );
+	assertEquals( input, dec.str() );
+
+	// without it, no dice
+	zstd_decompressor<std::stringstream> nodict;
+	assertFalse( nodict.write(withDict.data(), withDict.size()) );
+	assertTrue( input != nodict.str() );
+}
+
+TEST_CASE( "zstd_dictionaryTest/testStreaming", "[unit]" )
+{
+	std::default_random_engine rng;
+	std::vector<string> samples;
+	for (unsigned i = 0; i < 100; ++i)
+		samples.push_back(sample_json(rng));
+	zstd_dictionary dict = zstd_dictionary::train(samples);
+
+	string input = sample_json(rng) + sample_json(rng);
+	zstd_compressor<std::stringstream> comp;
+	comp.set_streaming(true);
+	comp.set_dictionary(dict);
+	comp.write(input.data(), input.size());
+	comp.finish();
+	string compressed = comp.str();
+
+	zstd_decompressor<std::stringstream> dec;
+	dec.set_dictionary(dict);
+	assertTrue( dec.write(compressed.data(), compressed.size()) );
+	assertEquals( input, dec.str() );
+}
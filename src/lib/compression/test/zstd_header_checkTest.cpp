@@ -29,3 +29,21 @@ TEST_CASE( "zstd_header_checkTest/testGetFilename", "[unit]" )
 	std::string actualfn = zstd_header_check::get_filename(reinterpret_cast<unsigned char*>(zstdblob), sizeof(zstdblob)-1);
 	assertEquals( actualfn, expectedfn );
 }
+
+TEST_CASE( "zstd_header_checkTest/testGetStrategy", "[unit]" )
+{
+	zstd_compressor<std::stringstream> comp;
+	std::string fn = "foobar.txt";
+	comp.write_header(fn.data(), fn.size());
+	assertEquals( 14, comp.write_strategy(1, -5) );
+
+	std::string header = comp.str();
+	auto strategy = zstd_header_check::get_strategy(reinterpret_cast<const unsigned char*>(header.data()), header.size());
+	assertTrue( strategy );
+	assertEquals( 1, strategy->strategy );
+	assertEquals( -5, strategy->level );
+
+	// filename only: nothing to see
+	header.resize(19);
+	assertFalse( zstd_header_check::get_strategy(reinterpret_cast<const unsigned char*>(header.data()), header.size()) );
+}
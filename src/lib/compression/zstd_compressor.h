@@ -1,6 +1,7 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "zstd_dictionary.h"
 #include "zstd/zstd.h"
 
 #include "serialize/format.h"
@@ -26,14 +27,20 @@ public:
 
 	// if you call write directly, len should be a multiple of CHUNK_SIZE
 	// .. or the final bytes of the input
+	// in streaming mode, any len is fine -- but call finish() after the last write.
 	bool write(const char* data, size_t len)
 	{
+		if (_streaming)
+			return write_stream(data, len, ZSTD_e_continue);
+
 		size_t writeLen = CHUNK_SIZE;
 		while (len > 0)
 		{
 			if (len < writeLen)
 				writeLen = len;
-			size_t compressedBytes = ZSTD_compressCCtx(_cctx, _compBuff.data(), _compBuff.size(), data, writeLen, _compressionLevel);
+			size_t compressedBytes = _dictId?
+				compress_with_dictionary(data, writeLen) :
+				ZSTD_compressCCtx(_cctx, _compBuff.data(), _compBuff.size(), data, writeLen, _compressionLevel);
 			if (ZSTD_isError(compressedBytes))
 			{
 				fmt::print("error? {}\n", ZSTD_getErrorName(compressedBytes));
@@ -47,12 +54,56 @@ public:
 		return true;
 	}
 
+	// ends the frame. No-op in chunked mode, where every write() is its own frame(s).
+	// (in streaming mode, write_header() and pad() shouldn't land between write() and finish())
+	bool finish()
+	{
+		if (!_streaming)
+			return true;
+		return write_stream(nullptr, 0, ZSTD_e_end);
+	}
+
+	// 0 == keep the current level. Negative levels are zstd's "fast" modes.
 	void set_compression_level(int level)
 	{
-		if (level > 0)
+		if (level != 0)
 			_compressionLevel = level;
 	}
 
+	// streaming mode: a single zstd frame over the whole input, via ZSTD_compressStream2,
+	// rather than an independent frame per CHUNK_SIZE. Better ratio, no context reset every 16KB.
+	void set_streaming(bool streaming)
+	{
+		_streaming = streaming;
+	}
+
+	// the following only apply in streaming mode.
+	// workers > 0 needs a ZSTD_MULTITHREAD build of zstd. If we don't have it, we quietly compress on this thread.
+	void set_workers(unsigned workers)
+	{
+		_workers = workers;
+	}
+
+	void set_long_distance_matching(bool ldm)
+	{
+		_ldm = ldm;
+	}
+
+	// log2 of the match window. The decompressor needs a buffer this large (or the file size, if smaller).
+	// 0 lets zstd pick -- which, with long distance matching on, means 2^27.
+	void set_window_log(int window_log)
+	{
+		_windowLog = window_log;
+	}
+
+	// the receiver needs the same dictionary. Its id goes in write_header(), so call this first.
+	bool set_dictionary(const zstd_dictionary& dict)
+	{
+		_dict = dict.str();
+		_dictId = dict.id();
+		return load_dictionary();
+	}
+
 	template <typename INSTREAM>
 	size_t compress(INSTREAM& raw, int compression_level=0)
 	{
@@ -73,6 +124,7 @@ public:
 			if (!write(rawBuff.data(), bytesRead))
 				break;
 		}
+		finish();
 		return totalBytesRead;
 	}
 
@@ -90,13 +142,38 @@ public:
 
 	size_t write_header(const char* data, unsigned len)
 	{
-		std::string temp = "\x01";
+		// with a dictionary: type 5, dictionary id, then the filename
+		std::string temp = _dictId? "\x05" : "\x01";
+		for (unsigned i = 0; _dictId and i < 4; ++i)
+			temp += (char)((_dictId >> (i*8)) & 0xFF);
 		temp += std::string_view(data, len);
 		size_t writ = ZSTD_writeSkippableFrame(_compBuff.data(), _compBuff.size(), temp.data(), temp.size(), 0);
 		STREAM::write(_compBuff.data(), writ);
 		return writ;
 	}
 
+	// instead of write_header(): the stream is an archive (see archive.h), to be unpacked into a directory called `name`
+	size_t write_archive_header(const char* name, unsigned len)
+	{
+		std::string temp = "\x06";
+		temp += std::string_view(name, len);
+		size_t writ = ZSTD_writeSkippableFrame(_compBuff.data(), _compBuff.size(), temp.data(), temp.size(), 0);
+		STREAM::write(_compBuff.data(), writ);
+		return writ;
+	}
+
+	// records which compression_probe strategy (and level) we went with. Goes after the filename header.
+	size_t write_strategy(uint8_t strategy, int level)
+	{
+		std::string temp = "\x04";
+		temp += (char)strategy;
+		for (unsigned i = 0; i < 4; ++i)
+			temp += (char)(((uint32_t)level >> (i*8)) & 0xFF);
+		size_t writ = ZSTD_writeSkippableFrame(_compBuff.data(), _compBuff.size(), temp.data(), temp.size(), 0);
+		STREAM::write(_compBuff.data(), writ);
+		return writ;
+	}
+
 	size_t size()
 	{
 		STREAM::seekg(0, std::ios::end);
@@ -105,8 +182,76 @@ public:
 		return len;
 	}
 
+protected:
+	void init_stream()
+	{
+		ZSTD_CCtx_reset(_cctx, ZSTD_reset_session_and_parameters);
+		ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, _compressionLevel);
+		ZSTD_CCtx_setParameter(_cctx, ZSTD_c_nbWorkers, _workers); // errors out if !ZSTD_MULTITHREAD. That's fine.
+		if (_ldm)
+			ZSTD_CCtx_setParameter(_cctx, ZSTD_c_enableLongDistanceMatching, 1);
+		if (_windowLog)
+			ZSTD_CCtx_setParameter(_cctx, ZSTD_c_windowLog, _windowLog);
+		load_dictionary(); // the reset dropped it
+		_streamStarted = true;
+	}
+
+	bool load_dictionary()
+	{
+		if (!_dictId)
+			return true;
+		size_t res = ZSTD_CCtx_loadDictionary_advanced(_cctx, _dict.data(), _dict.size(), ZSTD_dlm_byRef, ZSTD_dct_rawContent);
+		return !ZSTD_isError(res);
+	}
+
+	// ZSTD_compressCCtx() would drop the dictionary, so we use the advanced API
+	size_t compress_with_dictionary(const char* data, size_t len)
+	{
+		ZSTD_CCtx_setParameter(_cctx, ZSTD_c_compressionLevel, _compressionLevel);
+		return ZSTD_compress2(_cctx, _compBuff.data(), _compBuff.size(), data, len);
+	}
+
+	bool write_stream(const char* data, size_t len, ZSTD_EndDirective mode)
+	{
+		if (!_streamStarted)
+		{
+			if (mode == ZSTD_e_end)
+				return true; // nothing to finish
+			init_stream();
+		}
+
+		ZSTD_inBuffer input = {data, len, 0};
+		while (true)
+		{
+			ZSTD_outBuffer output = {_compBuff.data(), _compBuff.size(), 0};
+			size_t remaining = ZSTD_compressStream2(_cctx, &output, &input, mode);
+			if (ZSTD_isError(remaining))
+			{
+				fmt::print("error? {}\n", ZSTD_getErrorName(remaining));
+				return false;
+			}
+			if (output.pos > 0)
+				STREAM::write(_compBuff.data(), output.pos);
+
+			// continue: done once the input is consumed. end: done once zstd says it has flushed everything.
+			if (mode == ZSTD_e_end? remaining == 0 : input.pos == input.size)
+				break;
+		}
+
+		if (mode == ZSTD_e_end)
+			_streamStarted = false;
+		return true;
+	}
+
 protected:
 	int _compressionLevel = 16;
+	bool _streaming = false;
+	bool _streamStarted = false;
+	unsigned _workers = 0;
+	bool _ldm = false;
+	int _windowLog = 0;
+	std::string _dict;
+	uint32_t _dictId = 0;
 	ZSTD_CCtx* _cctx = ZSTD_createCCtx();
 	std::vector<char> _compBuff = std::vector<char>(ZSTD_compressBound(CHUNK_SIZE));
 };
@@ -1,6 +1,7 @@
 /* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
 #pragma once
 
+#include "zstd_dictionary.h"
 #include "zstd_dstream.h"
 
 #include "zstd/zstd.h"
@@ -49,6 +50,15 @@ public:
 		return false;
 	}
 
+	// must match the compressor's. (zstd_header_check::get_dictionary_id() says which one that was)
+	bool set_dictionary(const zstd_dictionary& dict)
+	{
+		if (!_ds)
+			return false;
+		size_t res = ZSTD_DCtx_loadDictionary_advanced(_ds, dict.data(), dict.size(), ZSTD_dlm_byCopy, ZSTD_dct_rawContent);
+		return !ZSTD_isError(res);
+	}
+
 	bool init_decompress(const char* data, size_t len)
 	{
 		if (!_ds)
@@ -62,7 +72,11 @@ public:
 		if (!init_decompress(data, len))
 			return false;
 		while (_inBuff.size() > 0)
-			write_once();
+		{
+			// a decode error leaves the input where it was. Don't spin on it
+			if (!write_once() and _inBuff.size() > 0)
+				return false;
+		}
 		return true;
 	}
 
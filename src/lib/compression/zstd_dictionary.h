@@ -0,0 +1,156 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cimbar {
+
+// a zstd dictionary, for small files -- a few KB of JSON compresses much better when both sides have seen similar JSON.
+// we use zstd's "raw content" dictionaries: the dictionary is just bytes the compressor can match against.
+// so the dictionary ID is ours (zstd's is always 0 for these), and goes in our filename header. See zstd_compressor::write_header.
+class zstd_dictionary
+{
+public:
+	static constexpr size_t DEFAULT_SIZE = 0x8000;
+
+public:
+	zstd_dictionary(std::string content)
+		: _content(std::move(content))
+		, _id(make_id(_content))
+	{
+	}
+
+	uint32_t id() const
+	{
+		return _id;
+	}
+
+	const char* data() const
+	{
+		return _content.data();
+	}
+
+	size_t size() const
+	{
+		return _content.size();
+	}
+
+	const std::string& str() const
+	{
+		return _content;
+	}
+
+	// a cut down version of zstd's COVER: score every d-mer by how many samples it shows up in,
+	// then (per epoch) take the k-byte segment with the best total score, and stop counting the d-mers it covers.
+	// the best segments go last -- they'll be closest to the data, so they're the cheapest matches.
+	static zstd_dictionary train(const std::vector<std::string>& samples, size_t max_size=DEFAULT_SIZE)
+	{
+		std::string all;
+		for (const std::string& s : samples)
+			all += s;
+		if (all.size() <= max_size)
+			return zstd_dictionary(all);
+
+		// how many samples each d-mer (well, d-mer hash) appears in
+		std::vector<uint32_t> freq(TABLE_SIZE, 0);
+		std::vector<uint32_t> lastSample(TABLE_SIZE, 0);
+		for (unsigned i = 0; i < samples.size(); ++i)
+		{
+			const std::string& s = samples[i];
+			for (size_t pos = 0; pos + D <= s.size(); ++pos)
+			{
+				uint32_t h = dmer_hash(s.data() + pos);
+				if (lastSample[h] == i+1)
+					continue;
+				lastSample[h] = i+1;
+				++freq[h];
+			}
+		}
+
+		struct segment
+		{
+			uint64_t score;
+			size_t offset;
+			size_t length;
+		};
+		std::vector<segment> picked;
+		size_t epochs = std::max<size_t>(1, max_size / K);
+		size_t epochSize = all.size() / epochs;
+		size_t total = 0;
+		for (size_t e = 0; e < epochs and total < max_size; ++e)
+		{
+			size_t begin = e * epochSize;
+			size_t end = std::min(all.size(), begin + epochSize);
+			if (end - begin < K)
+				continue;
+
+			// sliding window over the epoch: the score of a segment is the sum over its d-mers
+			uint64_t score = 0;
+			for (size_t pos = begin; pos < begin + K - D + 1; ++pos)
+				score += freq[dmer_hash(all.data() + pos)];
+
+			uint64_t best = score;
+			size_t bestPos = begin;
+			for (size_t pos = begin + 1; pos + K <= end; ++pos)
+			{
+				score -= freq[dmer_hash(all.data() + pos - 1)];
+				score += freq[dmer_hash(all.data() + pos + K - D)];
+				if (score > best)
+				{
+					best = score;
+					bestPos = pos;
+				}
+			}
+
+			// single-sample d-mers aren't worth keeping
+			if (best <= K - D + 1)
+				continue;
+
+			size_t len = std::min(K, max_size - total);
+			picked.push_back({best, bestPos, len});
+			total += len;
+			for (size_t pos = bestPos; pos + D <= bestPos + K; ++pos)
+				freq[dmer_hash(all.data() + pos)] = 0;
+		}
+
+		// most valuable last
+		std::stable_sort(picked.begin(), picked.end(), [](const segment& a, const segment& b) {
+			return a.score < b.score;
+		});
+		std::string content;
+		for (const segment& seg : picked)
+			content.append(all.data() + seg.offset, seg.length);
+		return zstd_dictionary(content);
+	}
+
+protected:
+	static constexpr size_t D = 8;
+	static constexpr size_t K = 256;
+	static constexpr size_t TABLE_SIZE = 1 << 20;
+
+	static uint32_t dmer_hash(const char* data)
+	{
+		uint64_t val = 0;
+		for (size_t i = 0; i < D; ++i)
+			val = (val << 8) | (uint8_t)data[i];
+		return (val * 0x9E3779B97F4A7C15ULL) >> (64 - 20);
+	}
+
+	static uint32_t make_id(const std::string& content)
+	{
+		// fnv-1a. 0 means "no dictionary"
+		uint32_t h = 2166136261u;
+		for (char c : content)
+			h = (h ^ (uint8_t)c) * 16777619u;
+		return h? h : 1;
+	}
+
+protected:
+	std::string _content;
+	uint32_t _id;
+};
+
+}
@@ -2,12 +2,29 @@
 #pragma once
 
 #include "zstd/zstd.h"
+#include <cstdint>
+#include <optional>
 #include <string>
 
 namespace cimbar {
 
 class zstd_header_check
 {
+public:
+	static const unsigned MAX_PAYLOAD = 500;
+	static const unsigned MAX_HEADER_SIZE = ZSTD_SKIPPABLEHEADERSIZE + MAX_PAYLOAD; // enough bytes to read any header we'd write
+
+	static const char FILENAME_TYPE = 1;
+	static const char STRATEGY_TYPE = 4;
+	static const char DICTIONARY_FILENAME_TYPE = 5; // dictionary id, then the filename
+	static const char ARCHIVE_TYPE = 6; // the name of the directory to unpack into. See archive.h
+
+	struct strategy_info
+	{
+		uint8_t strategy;
+		int level;
+	};
+
 public:
 	static std::string get_filename(const unsigned char* data, size_t len)
 	{
@@ -15,21 +32,78 @@ public:
 			return "";
 
 		std::string res;
-		res.resize(500, '\0');
+		res.resize(MAX_PAYLOAD, '\0');
 		size_t sz = ZSTD_readSkippableFrame(res.data(), res.size(), nullptr, data, len);
 		if (sz <= 1)
 			return "";
 
 		switch (res[0])
 		{
-			case 1:
+			case FILENAME_TYPE:
+			case ARCHIVE_TYPE:
 				return std::string(&res[1], sz-1);
+			case DICTIONARY_FILENAME_TYPE:
+				if (sz > 5)
+					return std::string(&res[5], sz-5);
+				break;
 			default:
 				break;
 		}
 		return "";
 	}
 
+	static bool is_archive(const unsigned char* data, size_t len)
+	{
+		if (!ZSTD_isSkippableFrame(data, len))
+			return false;
+
+		std::string res(MAX_PAYLOAD, '\0');
+		size_t sz = ZSTD_readSkippableFrame(res.data(), res.size(), nullptr, data, len);
+		return !ZSTD_isError(sz) and sz >= 1 and res[0] == ARCHIVE_TYPE;
+	}
+
+	// 0 == no dictionary
+	static uint32_t get_dictionary_id(const unsigned char* data, size_t len)
+	{
+		if (!ZSTD_isSkippableFrame(data, len))
+			return 0;
+
+		std::string res(MAX_PAYLOAD, '\0');
+		size_t sz = ZSTD_readSkippableFrame(res.data(), res.size(), nullptr, data, len);
+		if (ZSTD_isError(sz) or sz < 5 or res[0] != DICTIONARY_FILENAME_TYPE)
+			return 0;
+
+		uint32_t id = 0;
+		for (unsigned i = 0; i < 4; ++i)
+			id |= (uint32_t)(uint8_t)res[1+i] << (i*8);
+		return id;
+	}
+
+	// the strategy header, if there is one, in the run of skippable frames at the start of the data.
+	// nullopt means the sender didn't probe: a normal compression level.
+	static std::optional<strategy_info> get_strategy(const unsigned char* data, size_t len)
+	{
+		std::string res(MAX_PAYLOAD, '\0');
+		while (ZSTD_isSkippableFrame(data, len))
+		{
+			size_t frameSize = ZSTD_findFrameCompressedSize(data, len);
+			if (ZSTD_isError(frameSize) or frameSize > len)
+				break;
+
+			size_t sz = ZSTD_readSkippableFrame(res.data(), res.size(), nullptr, data, len);
+			if (!ZSTD_isError(sz) and sz >= 6 and res[0] == STRATEGY_TYPE)
+			{
+				uint32_t level = 0;
+				for (unsigned i = 0; i < 4; ++i)
+					level |= (uint32_t)(uint8_t)res[2+i] << (i*8);
+				return strategy_info{(uint8_t)res[1], (int)level};
+			}
+
+			data += frameSize;
+			len -= frameSize;
+		}
+		return std::nullopt;
+	}
 };
 
 }
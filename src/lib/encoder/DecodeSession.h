@@ -0,0 +1,194 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "Decoder.h"
+#include "cimb_translator/CimbDecoder.h"
+#include "cimb_translator/Config.h"
+#include "chromatic_adaptation/color_correction_session.h"
+#include "extractor/Extractor.h"
+#include "fountain/fountain_decoder_sink.h"
+
+#include <memory>
+#include <mutex>
+
+// everything one decode stream needs: the conf (mode), the ccm + color lookup, the Decoder (and its scratch buffers),
+// and optionally the fountain sink the chunks go to.
+// Config and CimbDecoder normally keep this state per thread. A session carries its own, and installs it on whatever
+// thread is doing the work for the duration of the call -- so N sessions (in different modes) can share M worker threads.
+// one call at a time per session. Calls on different sessions can run in parallel.
+class DecodeSession
+{
+public:
+	// put a session's state in place on this thread, and put the old state back after
+	class scope
+	{
+	public:
+		scope(DecodeSession& session)
+			: _prevConf(cimbar::Config::swap_conf(&session._conf))
+			, _prevColors(CimbDecoder::swap_color_state(&session._colorState))
+		{}
+
+		~scope()
+		{
+			CimbDecoder::swap_color_state(_prevColors);
+			cimbar::Config::swap_conf(_prevConf);
+		}
+
+	protected:
+		cimbar::conf* _prevConf;
+		CimbDecoder::color_state* _prevColors;
+	};
+
+public:
+	DecodeSession(int mode_val=68, bool use_ecc=true, bool interleave=true);
+
+	const cimbar::conf& conf() const;
+	Decoder& decoder();
+
+	void set_ecc_threads(unsigned threads);
+
+	// switch modes. Starts the ccm over, since the palette (probably) changed.
+	// the sink is kept, but if the chunk size changed, its in-progress streams are dropped. See fountain_decoder_sink::set_chunk_size().
+	void reconfigure(unsigned mode_val);
+
+	// follow the frame header (see FrameHeader): if extract() finds one for a different mode, we reconfigure() to it.
+	void set_auto_mode(bool enabled);
+
+	// the sink is optional. If it's there, decode_fountain(img) will feed it.
+	void set_sink(std::shared_ptr<fountain_decoder_sink> sink);
+	fountain_decoder_sink* sink() const;
+
+	template <typename MAT>
+	int extract(const MAT& img, MAT& out);
+
+	template <typename MAT, typename STREAM>
+	unsigned decode(const MAT& img, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
+
+	template <typename MAT, typename STREAM>
+	unsigned decode_fountain(const MAT& img, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
+
+	template <typename MAT>
+	unsigned decode_fountain(const MAT& img, bool should_preprocess=false, int color_correction=2);
+
+protected:
+	void do_reconfigure(unsigned mode_val);
+
+protected:
+	cimbar::conf _conf;
+	CimbDecoder::color_state _colorState;
+	std::shared_ptr<color_correction_session> _colorSession;
+	std::shared_ptr<fountain_decoder_sink> _sink;
+	std::unique_ptr<Decoder> _decoder;
+	bool _useEcc;
+	bool _interleave;
+	unsigned _eccThreads = 1;
+	bool _autoMode = false;
+	std::mutex _mutex;
+};
+
+inline DecodeSession::DecodeSession(int mode_val, bool use_ecc, bool interleave)
+	: _colorSession(std::make_shared<color_correction_session>())
+	, _useEcc(use_ecc)
+	, _interleave(interleave)
+{
+	do_reconfigure(mode_val);
+}
+
+inline void DecodeSession::do_reconfigure(unsigned mode_val)
+{
+	_conf = cimbar::Config::temp_conf(mode_val);
+	_colorState.ccm = color_correction();
+	_colorSession->reset();
+	if (_sink)
+		_sink->set_chunk_size(_conf.fountain_chunk_size());
+
+	// the Decoder picks up symbol/color bits from the conf, so it needs to be made inside the scope
+	scope s(*this);
+	_decoder = std::make_unique<Decoder>(_useEcc, _interleave);
+	_decoder->set_ecc_threads(_eccThreads);
+	_decoder->set_color_session(_colorSession);
+}
+
+inline const cimbar::conf& DecodeSession::conf() const
+{
+	return _conf;
+}
+
+// for setup (ecc threads, etc). Decoding should go through the session.
+inline Decoder& DecodeSession::decoder()
+{
+	return *_decoder;
+}
+
+inline void DecodeSession::set_ecc_threads(unsigned threads)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_eccThreads = threads;
+	_decoder->set_ecc_threads(threads);
+}
+
+inline void DecodeSession::reconfigure(unsigned mode_val)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (mode_val != _conf.mode_val)
+		do_reconfigure(mode_val);
+}
+
+inline void DecodeSession::set_auto_mode(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_autoMode = enabled;
+}
+
+inline void DecodeSession::set_sink(std::shared_ptr<fountain_decoder_sink> sink)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_sink = sink;
+}
+
+inline fountain_decoder_sink* DecodeSession::sink() const
+{
+	return _sink.get();
+}
+
+template <typename MAT>
+inline int DecodeSession::extract(const MAT& img, MAT& out)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	scope s(*this);
+	Extractor ext;
+	if (!_autoMode)
+		return ext.extract(img, out);
+
+	unsigned mode_val = 0;
+	int res = ext.extract(img, out, mode_val);
+	if (res and mode_val and mode_val != _conf.mode_val)
+		do_reconfigure(mode_val);
+	return res;
+}
+
+template <typename MAT, typename STREAM>
+inline unsigned DecodeSession::decode(const MAT& img, STREAM& ostream, bool should_preprocess, int color_correction)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	scope s(*this);
+	return _decoder->decode(img, ostream, should_preprocess, color_correction);
+}
+
+template <typename MAT, typename STREAM>
+inline unsigned DecodeSession::decode_fountain(const MAT& img, STREAM& ostream, bool should_preprocess, int color_correction)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	scope s(*this);
+	return _decoder->decode_fountain(img, ostream, should_preprocess, color_correction);
+}
+
+template <typename MAT>
+inline unsigned DecodeSession::decode_fountain(const MAT& img, bool should_preprocess, int color_correction)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (!_sink)
+		return 0;
+	scope s(*this);
+	return _decoder->decode_fountain(img, *_sink, should_preprocess, color_correction);
+}
@@ -2,7 +2,7 @@
 #pragma once
 
 #include "reed_solomon_stream.h"
-#include "bit_file/bitbuffer.h"
+#include "bit_file/wordwriter.h"
 #include "cimb_translator/CimbDecoder.h"
 #include "cimb_translator/CimbReader.h"
 #include "cimb_translator/Config.h"
@@ -11,12 +11,16 @@
 
 #include <opencv2/opencv.hpp>
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 class Decoder
 {
 public:
 	Decoder(bool use_ecc=true, bool interleave=true);
+	void set_ecc_threads(unsigned threads);
+	void set_color_session(std::shared_ptr<color_correction_session> session);
 
 	template <typename MAT, typename STREAM>
 	unsigned decode(const MAT& img, STREAM& ostream, bool should_preprocess=false, int color_correction=2);
@@ -31,10 +35,23 @@ protected:
 	template <typename STREAM>
 	unsigned do_decode_coupled(CimbReader& reader, STREAM& ostream);
 
+	ReedSolomonBatch& ecc_batch(unsigned ecc_bytes);
+
+	template <typename STREAM, typename VALUE>
+	unsigned flush_bits(STREAM& rss, const std::vector<VALUE>& values, const std::vector<uint16_t>& order, unsigned bits, unsigned capacity);
+
 protected:
 	bool _useEcc;
 	bool _interleave;
+	unsigned _eccThreads = 1;
+	std::unique_ptr<ReedSolomonBatch> _eccBatch; // the ecc codecs, and worker threads if _eccThreads > 1. Made on first use
 	CimbDecoder _decoder;
+
+	// scratch space, reused frame to frame
+	std::vector<PositionData> _colorPositions;
+	std::vector<uint8_t> _colors;
+	std::vector<uint8_t> _symbols;
+	std::vector<char> _bits;
 };
 
 inline Decoder::Decoder(bool use_ecc, bool interleave)
@@ -44,6 +61,29 @@ inline Decoder::Decoder(bool use_ecc, bool interleave)
 {
 }
 
+// the ecc blocks in a frame are independent, so they can be decoded in parallel.
+// 1 (the default) keeps everything on the calling thread. Otherwise, the worker threads stick around for the life of the Decoder.
+inline void Decoder::set_ecc_threads(unsigned threads)
+{
+	_eccThreads = threads? threads : 1;
+}
+
+// the (thread-local) config could change under us, so we check the parity before handing it out
+inline ReedSolomonBatch& Decoder::ecc_batch(unsigned ecc_bytes)
+{
+	unsigned threads = ecc_bytes? _eccThreads : 1;
+	if (!_eccBatch or _eccBatch->parity() != ecc_bytes or _eccBatch->threads() != threads)
+		_eccBatch = std::make_unique<ReedSolomonBatch>(ecc_bytes, threads);
+	return *_eccBatch;
+}
+
+// keep the color correction matrix around between frames (and between Decoders, if they share the session),
+// instead of starting over every time. See color_correction_session.
+inline void Decoder::set_color_session(std::shared_ptr<color_correction_session> session)
+{
+	_decoder.set_color_session(session);
+}
+
 /* while bits == f.read_tile()
  *     decode(bits)
  *
@@ -74,12 +114,13 @@ inline unsigned Decoder::do_decode(CimbReader& reader, STREAM& ostream)
 	unsigned bitsPerOp = cimbar::Config::bits_per_cell();
 	unsigned fountain_chunks_per_frame = cimbar::Config::fountain_chunks_per_frame(bitsPerOp);
 
-	std::vector<unsigned> interleaveLookup = Interleave::interleave_reverse(reader.num_reads(), interleaveBlocks, interleavePartitions);
-	std::vector<PositionData> colorPositions;
+	const Interleave::table& interleave = Interleave::lookup(reader.num_reads(), interleaveBlocks, interleavePartitions);
+	std::vector<PositionData>& colorPositions = _colorPositions;
 	colorPositions.resize(reader.num_reads()); // the number of cells == reader.num_reads(). Can we calculate this from config at compile time? Do we care?
+	std::vector<uint8_t>& symbols = _symbols;
+	symbols.assign(reader.num_reads(), 0);
 
 	{
-		bitbuffer symbolBuff(symCapacity);
 		// read symbols first
 		while (!reader.done())
 		{
@@ -87,34 +128,28 @@ inline unsigned Decoder::do_decode(CimbReader& reader, STREAM& ostream)
 			// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
 			PositionData pos;
 			unsigned bits = reader.read(pos);
-
-			unsigned bitPos = interleaveLookup[pos.i] * bitsPerSymbol; // bitspersymbol, *iff* we're in the new mode
-			symbolBuff.write(bits, bitPos, bitsPerSymbol);
+			symbols[pos.i] = bits;
 
 			// TODO: simplify this function by not storing colorPositions?
 			// this is how it was originally done (see `do_decode_coupled()`), but we should be able to calculate them on the fly now
-			colorPositions[pos.i] = {interleaveLookup[pos.i] * colorBits, pos.x, pos.y};
+			colorPositions[pos.i] = {interleave.reverse[pos.i] * colorBits, pos.x, pos.y};
 		}
 
-		// flush symbols
-		reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
-		symbolBuff.flush(rss);
+		// flush symbols. They go to their interleaved slot (bitsPerSymbol wide, *iff* we're in the new mode)
+		reed_solomon_stream rss(ostream, ecc_batch(eccBytes), eccBlockSize);
+		flush_bits(rss, symbols, interleave.indices, bitsPerSymbol, symCapacity);
 	}
 
 	// do color correction init, now that we (hopefully) have some fountain headers from the symbol decode
 	reader.init_ccm(colorBits, interleaveBlocks, interleavePartitions, fountain_chunks_per_frame);
 
-	bitbuffer colorBuff(colorCapacity);
-	// then decode colors.
-	for (const PositionData& p : colorPositions)
-	{
-		unsigned bits = reader.read_color(p);
-		colorBuff.write(bits, p.i, colorBits);
-	}
+	// then decode colors. All at once, then write them out.
+	std::vector<uint8_t>& colors = _colors;
+	reader.read_colors(colorPositions, colors);
 
-	reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
-	// flush() will return the (good) cumulative bytes written to the underlying stream
-	return colorBuff.flush(rss);
+	reed_solomon_stream rss(ostream, ecc_batch(eccBytes), eccBlockSize);
+	// flush_bits() will return the (good) cumulative bytes written to the underlying stream
+	return flush_bits(rss, colors, interleave.indices, colorBits, colorCapacity);
 }
 
 template <typename STREAM>
@@ -129,10 +164,11 @@ inline unsigned Decoder::do_decode_coupled(CimbReader& reader, STREAM& ostream)
 	unsigned interleaveBlocks = _interleave? cimbar::Config::interleave_blocks() : 0;
 	unsigned interleavePartitions = cimbar::Config::interleave_partitions();
 
-	bitbuffer bb(cimbar::Config::capacity(bitsPerOp));
-	std::vector<unsigned> interleaveLookup = Interleave::interleave_reverse(reader.num_reads(), interleaveBlocks, interleavePartitions);
-	std::vector<PositionData> colorPositions;
+	const Interleave::table& interleave = Interleave::lookup(reader.num_reads(), interleaveBlocks, interleavePartitions);
+	std::vector<PositionData>& colorPositions = _colorPositions;
 	colorPositions.resize(reader.num_reads());
+	std::vector<uint8_t>& cells = _symbols;
+	cells.assign(reader.num_reads(), 0);
 
 	// read symbols first
 	while (!reader.done())
@@ -141,23 +177,34 @@ inline unsigned Decoder::do_decode_coupled(CimbReader& reader, STREAM& ostream)
 		// we can compute the bitindex ('index') here, but only the reader will know the right cell index...
 		PositionData pos;
 		unsigned bits = reader.read(pos);
+		cells[pos.i] = bits;
 
-		unsigned bitPos = interleaveLookup[pos.i] * bitsPerOp;
-		bb.write(bits, bitPos, bitsPerOp);
-
-		colorPositions[pos.i] = {bitPos, pos.x, pos.y};
+		colorPositions[pos.i] = {interleave.reverse[pos.i] * bitsPerOp, pos.x, pos.y};
 	}
 
-	// then decode colors.
+	// then decode colors. They're the high bits of each cell.
 	// the symbol+color decode could be done as one pass, but doing it as two gives us better cache utilization
-	for (const PositionData& p : colorPositions)
-	{
-		unsigned bits = reader.read_color(p);
-		bb.write(bits, p.i, colorBits);
-	}
+	std::vector<uint8_t>& colors = _colors;
+	reader.read_colors(colorPositions, colors);
+	for (unsigned k = 0; k < colors.size() and k < cells.size(); ++k)
+		cells[k] |= colors[k] << (bitsPerOp - colorBits);
+
+	reed_solomon_stream rss(ostream, ecc_batch(eccBytes), eccBlockSize);
+	return flush_bits(rss, cells, interleave.indices, bitsPerOp, cimbar::Config::capacity(bitsPerOp));
+}
+
+// pack values into a capacity sized buffer, `bits` each, in interleaved order: slot s gets values[order[s]].
+// then it goes out through the ecc stream. Returns the (good) cumulative bytes written to the underlying stream.
+template <typename STREAM, typename VALUE>
+inline unsigned Decoder::flush_bits(STREAM& rss, const std::vector<VALUE>& values, const std::vector<uint16_t>& order, unsigned bits, unsigned capacity)
+{
+	_bits.assign(capacity, 0);
+	wordwriter ww(_bits.data(), _bits.size());
+	if (values.size() == order.size())
+		ww.gather(values.data(), order.data(), order.size(), bits);
 
-	reed_solomon_stream rss(ostream, eccBytes, eccBlockSize);
-	return bb.flush(rss);
+	rss.write(_bits.data(), _bits.size());
+	return rss.tellp();
 }
 
 template <typename MAT, typename STREAM>
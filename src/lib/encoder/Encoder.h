@@ -3,15 +3,19 @@
 
 #include "reed_solomon_stream.h"
 #include "bit_file/bitreader.h"
-#include "bit_file/bitbuffer.h"
+#include "bit_file/bit_expand.h"
 #include "cimb_translator/CimbWriter.h"
 #include "cimb_translator/Config.h"
+#include "compression/compression_probe.h"
 #include "compression/zstd_compressor.h"
 #include "fountain/fountain_encoder_stream.h"
+#include "util/string_sink.h"
 
 #include <opencv2/opencv.hpp>
+#include <iterator>
 #include <optional>
 #include <string>
+#include <vector>
 
 class Encoder
 {
@@ -19,17 +23,26 @@ public:
 	Encoder(unsigned bits_per_symbol=0, int bits_per_color=-1);
 	void set_encode_id(uint8_t encode_id); // [0-127] -- the high bit is ignored.
 	void set_color_mode(unsigned color_mode);
+	void set_compression_budget(unsigned ms); // 0 == no limit
+	void set_compression_dictionary(const cimbar::zstd_dictionary& dict);
+	void set_frame_header(bool enabled);
 
 	template <typename STREAM>
 	std::optional<cv::Mat> encode_next(STREAM& stream, cimbar::vec_xy canvas_size={});
 
 	template <typename STREAM>
 	fountain_encoder_stream::ptr create_fountain_encoder(STREAM& stream, const std::string_view& filename, int compression_level=16);
+	fountain_encoder_stream::ptr create_fountain_encoder(const char* data, size_t len, const std::string_view& filename, int compression_level=16);
 
 protected:
 	template <typename STREAM>
 	std::optional<cv::Mat> encode_next_coupled(STREAM& stream, cimbar::vec_xy canvas_size={});
 
+	template <typename RSS>
+	void read_cells(RSS& rss, unsigned bits, unsigned shift);
+
+	static fountain_encoder_stream::ptr with_run_length(fountain_encoder_stream::ptr fes);
+
 protected:
 	unsigned _eccBytes;
 	unsigned _eccBlockSize;
@@ -39,6 +52,14 @@ protected:
 	bool _coupled;
 	unsigned _colorMode;
 	uint8_t _encodeId = 0;
+	unsigned _compressionBudget = 0;
+	std::optional<cimbar::zstd_dictionary> _dictionary;
+	unsigned _modeVal;
+	bool _frameHeader = false;
+
+	// scratch space, reused frame to frame
+	std::vector<char> _frameBits;
+	std::vector<uint16_t> _cells;
 };
 
 inline Encoder::Encoder(unsigned bits_per_symbol, int bits_per_color)
@@ -49,6 +70,7 @@ inline Encoder::Encoder(unsigned bits_per_symbol, int bits_per_color)
 	, _dark(cimbar::Config::dark())
 	, _coupled(cimbar::Config::legacy_mode())
 	, _colorMode(cimbar::Config::color_mode())
+	, _modeVal(cimbar::Config::mode_val())
 {
 }
 
@@ -65,6 +87,25 @@ inline void Encoder::set_color_mode(unsigned color_mode)
 	_colorMode = color_mode;
 }
 
+// roughly how long we're willing to spend compressing a file. If the requested level looks like it'd take longer,
+// we drop to compression_probe::FAST_LEVEL.
+inline void Encoder::set_compression_budget(unsigned ms)
+{
+	_compressionBudget = ms;
+}
+
+// for small files. The receiver will need the same one.
+inline void Encoder::set_compression_dictionary(const cimbar::zstd_dictionary& dict)
+{
+	_dictionary = dict;
+}
+
+// stamp the mode on each frame (see FrameHeader), so receivers don't have to be told what it is.
+inline void Encoder::set_frame_header(bool enabled)
+{
+	_frameHeader = enabled;
+}
+
 template <typename STREAM>
 inline std::optional<cv::Mat> Encoder::encode_next(STREAM& stream, cimbar::vec_xy canvas_size)
 {
@@ -74,60 +115,53 @@ inline std::optional<cv::Mat> Encoder::encode_next(STREAM& stream, cimbar::vec_x
 	if (!stream.good())
 		return std::nullopt;
 
-	unsigned bits_per_op = _bitsPerColor + _bitsPerSymbol;
 	CimbWriter writer(_bitsPerSymbol, _bitsPerColor, _dark, _colorMode, canvas_size);
+	if (_frameHeader)
+		writer.write_header(_modeVal, _dark);
 
-	unsigned numCells = writer.num_cells();
-	bitbuffer bb(cimbar::Config::capacity(bits_per_op));
-
-	unsigned bitPos = 0;
-	unsigned endBitPos = numCells*bits_per_op;
-
-	int progress = 0;
-	unsigned bitsPerRead = _bitsPerSymbol;
-	unsigned bitsPerWrite = bits_per_op;
+	// reorder. We're encoding the symbol bits and striping them across the whole image
+	// then encoding the color bits and striping them in the same way (filling in the gaps)
+	// so each cell ends up as (color << bitsPerSymbol) | symbol
+	_cells.assign(writer.num_cells(), 0);
 
 	reed_solomon_stream rss(stream, _eccBytes, _eccBlockSize);
-	bitreader br;
-	while (rss.good() and progress < 2)  // 1 symbol pass + 1 color pass
-	{
-		unsigned bytes = rss.readsome();
-		if (bytes == 0)
-			break;
-		br.assign_new_buffer(rss.buffer(), bytes);
-
-		// reorder. We're encoding the symbol bits and striping them across the whole image
-		// then encoding the color bits and striping them in the same way (filling in the gaps)
-		while (!br.empty())
-		{
-			unsigned bits = br.read(bitsPerRead);
-			if (!br.partial())
-				bb.write(bits, bitPos, bitsPerWrite);
-			bitPos += bits_per_op;
-
-			if (bitPos >= endBitPos)
-			{
-				// switch to color section
-				bitsPerRead = _bitsPerColor;
-				bitsPerWrite = _bitsPerColor;
-				bitPos = 0;
-				++progress;
-				break;
-			}
-		}
-	}
+	read_cells(rss, _bitsPerSymbol, 0);  // 1 symbol pass
+	read_cells(rss, _bitsPerColor, _bitsPerSymbol);  // + 1 color pass
 
 	// dump whatever we have to image
-	for (bitPos = 0; bitPos < endBitPos; bitPos+=bits_per_op)
-	{
-		unsigned bits = bb.read(bitPos, bits_per_op);
+	for (unsigned bits : _cells)
 		writer.write(bits);
-	}
 
 	// return what we've got
 	return writer.image();
 }
 
+// one pass of encode_next(): `bits` from the ecc stream for every cell, OR'd in at `shift`.
+// we pull in whole ecc blocks until we have enough, and the next pass starts on a fresh block -- leftovers are dropped.
+// if the stream runs dry, the cells we didn't get to stay 0.
+template <typename RSS>
+inline void Encoder::read_cells(RSS& rss, unsigned bits, unsigned shift)
+{
+	if (!bits)
+		return;
+
+	size_t bitsNeeded = _cells.size() * bits;
+	size_t bytes = 0;
+	while (bytes*8 < bitsNeeded and rss.good())
+	{
+		// readsome() writes (and ecc encodes) a full block in place
+		if (_frameBits.size() < bytes + _eccBlockSize)
+			_frameBits.resize(bytes + _eccBlockSize);
+		std::streamsize got = rss.readsome(_frameBits.data() + bytes);
+		if (got <= 0)
+			break;
+		bytes += got;
+	}
+
+	// straight from the byte stream to the per-cell tile indices
+	bit_expand::expand(_frameBits.data(), bytes, _cells.data(), _cells.size(), bits, shift);
+}
+
 template <typename STREAM>
 inline std::optional<cv::Mat> Encoder::encode_next_coupled(STREAM& stream, cimbar::vec_xy canvas_size)
 {
@@ -141,6 +175,8 @@ inline std::optional<cv::Mat> Encoder::encode_next_coupled(STREAM& stream, cimba
 
 	unsigned bits_per_op = _bitsPerColor + _bitsPerSymbol;
 	CimbWriter writer(_bitsPerSymbol, _bitsPerColor, _dark, _colorMode, canvas_size);
+	if (_frameHeader)
+		writer.write_header(_modeVal, _dark);
 
 	reed_solomon_stream rss(stream, _eccBytes, _eccBlockSize);
 	bitreader br;
@@ -165,27 +201,54 @@ inline std::optional<cv::Mat> Encoder::encode_next_coupled(STREAM& stream, cimba
 
 template <typename STREAM>
 inline fountain_encoder_stream::ptr Encoder::create_fountain_encoder(STREAM& stream, const std::string_view& filename, int compression_level)
+{
+	// the probe wants to see the whole input, so we read it in first
+	std::string data(std::istreambuf_iterator<char>(stream), {});
+	if (data.empty() and compression_level > 0)
+		return nullptr;
+	return create_fountain_encoder(data.data(), data.size(), filename, compression_level);
+}
+
+// for input that's already in memory (or mapped). Compresses into a single buffer, sized up front,
+// which fountain_encoder_stream then takes ownership of -- wirehair reads it in place.
+inline fountain_encoder_stream::ptr Encoder::create_fountain_encoder(const char* data, size_t len, const std::string_view& filename, int compression_level)
 {
 	unsigned chunk_size = cimbar::Config::fountain_chunk_size();
 
-	std::stringstream ss;
 	if (compression_level <= 0)
-		ss << stream.rdbuf();
-	else
-	{
-		cimbar::zstd_compressor<std::stringstream> f;
-		if (!filename.empty())
-			f.write_header(filename.data(), filename.size());
-		if (!f.compress(stream))
-			return nullptr;
-
-		// find size of compressed zstd stream, and pad it if necessary.
-		size_t compressedSize = f.size();
-		if (compressedSize < chunk_size)
-			f.pad(chunk_size - compressedSize + 1);
-		ss = std::move(f);
-	}
+		return with_run_length(fountain_encoder_stream::create(std::string(data, len), chunk_size, _encodeId));
+
+	// jpegs and zips get stored, not squeezed at level 16
+	cimbar::compression_probe::choice probe = cimbar::compression_probe::choose(data, len, compression_level, _compressionBudget);
+
+	using compressor = cimbar::zstd_compressor<string_sink>;
+	compressor f;
+	f.set_compression_level(probe.level);
 
-	return fountain_encoder_stream::create(ss, chunk_size, _encodeId);
+	// header + a bound for each CHUNK_SIZE frame + worst case padding
+	size_t chunks = (len / compressor::CHUNK_SIZE) + 1;
+	f.reserve(ZSTD_SKIPPABLEHEADERSIZE*2 + filename.size() + 11 + chunks * ZSTD_compressBound(compressor::CHUNK_SIZE) + chunk_size + 1);
+
+	if (_dictionary and !f.set_dictionary(*_dictionary))
+		return nullptr;
+	if (!filename.empty() or _dictionary) // the header carries the dictionary id
+		f.write_header(filename.data(), filename.size());
+	if (probe.strat != cimbar::compression_probe::STRONG)
+		f.write_strategy(probe.strat, probe.level);
+	if (!f.write(data, len))
+		return nullptr;
+
+	size_t compressedSize = f.str().size();
+	if (compressedSize < chunk_size)
+		f.pad(chunk_size - compressedSize + 1);
+
+	return with_run_length(fountain_encoder_stream::create(std::move(f.str()), chunk_size, _encodeId));
+}
+
+// a frame's worth of chunks at a time. Only matters for segmented streams
+inline fountain_encoder_stream::ptr Encoder::with_run_length(fountain_encoder_stream::ptr fes)
+{
+	fes->set_run_length(cimbar::Config::fountain_chunks_per_frame());
+	return fes;
 }
 
@@ -6,6 +6,7 @@
 #include "extractor/Scanner.h"
 #include "serialize/format.h"
 #include "util/File.h"
+#include "util/MappedFile.h"
 
 #include <opencv2/opencv.hpp>
 #include <filesystem>
@@ -44,8 +45,10 @@ inline unsigned EncoderPlus::encode(const std::string& filename, std::string out
 
 inline unsigned EncoderPlus::encode_fountain(const std::string& filename, const std::function<bool(const cv::Mat&, unsigned)>& on_frame, int compression_level, double redundancy)
 {
-	std::ifstream infile(filename, std::ios::binary);
-	fountain_encoder_stream::ptr fes = create_fountain_encoder(infile, File::basename(filename), compression_level);
+	MappedFile infile(filename);
+	if (!infile.good())
+		return 0;
+	fountain_encoder_stream::ptr fes = create_fountain_encoder(infile.data(), infile.size(), File::basename(filename), compression_level);
 	if (!fes)
 		return 0;
 
@@ -0,0 +1,150 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "ReedSolomon.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// decodes a run of independent ReedSolomon blocks across several threads.
+// libcorrect keeps its scratch space inside the codec, so each worker gets its own.
+// the workers are started once, and wait around for the next batch -- so keep one of these around
+// (the Decoder does) instead of making one per frame. The calling thread does its share of the work too.
+// one decode() at a time.
+
+class ReedSolomonBatch
+{
+public:
+	ReedSolomonBatch(size_t parity_bytes, unsigned threads)
+	{
+		if (threads == 0)
+			threads = 1;
+		for (unsigned i = 0; i < threads; ++i)
+			_rs.push_back(std::make_unique<ReedSolomon>(parity_bytes));
+		for (unsigned w = 1; w < threads; ++w)
+			_workers.emplace_back(&ReedSolomonBatch::work_loop, this, w);
+	}
+
+	~ReedSolomonBatch()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		for (std::thread& t : _workers)
+			t.join();
+	}
+
+	unsigned parity() const
+	{
+		return _rs.front()->parity();
+	}
+
+	unsigned threads() const
+	{
+		return _rs.size();
+	}
+
+	// the calling thread's codec. For anything that isn't a batch.
+	ReedSolomon& codec()
+	{
+		return *_rs.front();
+	}
+
+	// decode `count` consecutive blocks of `block_size` bytes.
+	// decoded block i goes to msgs + i*(block_size - parity()), and its result
+	// (decoded length, or <=0 on failure) to results[i]. Order is preserved.
+	void decode(const char* encoded, unsigned block_size, unsigned count, char* msgs, ssize_t* results)
+	{
+		if (count == 0)
+			return;
+
+		job j{encoded, block_size, count, msgs, results, std::min<unsigned>(threads(), count)};
+		if (j.workers > 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_job = j;
+				_pending = j.workers - 1;
+				++_generation;
+			}
+			_wake.notify_all();
+		}
+
+		run(0, j);
+
+		if (j.workers > 1)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_finished.wait(lock, [this]() { return _pending == 0; });
+		}
+	}
+
+protected:
+	struct job
+	{
+		const char* encoded;
+		unsigned blockSize;
+		unsigned count;
+		char* msgs;
+		ssize_t* results;
+		unsigned workers;
+	};
+
+	// blocks are striped across workers, so a cluster of damaged blocks doesn't land on one thread
+	void run(unsigned w, const job& j)
+	{
+		ReedSolomon& rs = *_rs[w];
+		unsigned msgSize = j.blockSize - rs.parity();
+		for (unsigned i = w; i < j.count; i += j.workers)
+			j.results[i] = rs.decode(j.encoded + i*j.blockSize, j.blockSize, j.msgs + i*msgSize);
+	}
+
+	void work_loop(unsigned w)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			job j;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this, seen]() { return _stopping or _generation != seen; });
+				if (_stopping)
+					return;
+				seen = _generation;
+				j = _job;
+			}
+
+			// small batches don't need everyone
+			if (w >= j.workers)
+				continue;
+			run(w, j);
+
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				last = (--_pending == 0);
+			}
+			if (last)
+				_finished.notify_one();
+		}
+	}
+
+protected:
+	std::vector<std::unique_ptr<ReedSolomon>> _rs;
+
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _finished;
+	job _job = {};
+	uint64_t _generation = 0;
+	unsigned _pending = 0;
+	bool _stopping = false;
+};
@@ -2,8 +2,11 @@
 #pragma once
 
 #include "ReedSolomon.h"
+#include "ReedSolomonBatch.h"
 #include "encoder/aligned_stream.h"
 #include <fstream>
+#include <memory>
+#include <optional>
 #include <sstream>
 #include <vector>
 
@@ -11,9 +14,22 @@ template <typename STREAM>
 class reed_solomon_stream
 {
 public:
-	reed_solomon_stream(STREAM& stream, unsigned ecc, unsigned buffer_size)
+	reed_solomon_stream(STREAM& stream, unsigned ecc, unsigned buffer_size, unsigned threads=1)
 		: _stream(stream)
-		, _rs(ecc)
+		, _ownRs(std::in_place, ecc)
+		, _rs(*_ownRs)
+		, _threads(ecc > 0? threads : 1)
+		, _good(stream.good())
+	{
+		_buffer.resize(buffer_size, 0);
+	}
+
+	// borrow the codecs (and worker threads) from someone who'll be around longer than we are. e.g. the Decoder
+	reed_solomon_stream(STREAM& stream, ReedSolomonBatch& batch, unsigned buffer_size)
+		: _stream(stream)
+		, _batch(&batch)
+		, _rs(batch.codec())
+		, _threads(batch.threads())
 		, _good(stream.good())
 	{
 		_buffer.resize(buffer_size, 0);
@@ -62,6 +78,9 @@ public:
 		}
 
 		// else
+		if (_threads > 1 and length >= _buffer.size()*2)
+			return write_batch(data, length);
+
 		while (length >= _buffer.size())
 		{
 			ssize_t bytes = _rs.decode(data, _buffer.size(), _buffer.data());
@@ -81,11 +100,45 @@ public:
 		return _buffer.data();
 	}
 
+protected:
+	reed_solomon_stream& write_batch(const char* data, unsigned length)
+	{
+		// decode every block up front (in parallel), then write them out in order
+		unsigned count = length / _buffer.size();
+		unsigned msgSize = _buffer.size() - _rs.parity();
+		_decoded.resize(count * msgSize);
+		_results.resize(count);
+
+		// the encode side never gets here, so don't pay for the worker threads until we need them
+		if (!_batch)
+		{
+			_ownBatch = std::make_unique<ReedSolomonBatch>(_rs.parity(), _threads);
+			_batch = _ownBatch.get();
+		}
+		_batch->decode(data, _buffer.size(), count, _decoded.data(), _results.data());
+
+		for (unsigned i = 0; i < count; ++i)
+		{
+			if (_results[i] <= 0)
+				_stream << ReedSolomon::BadChunk(msgSize);
+			else
+				_stream.write(_decoded.data() + i*msgSize, _results[i]);
+		}
+		return *this;
+	}
+
 protected:
 	std::vector<char> _buffer;
 	STREAM& _stream;
-	ReedSolomon _rs;
+	std::optional<ReedSolomon> _ownRs;
+	std::unique_ptr<ReedSolomonBatch> _ownBatch;
+	ReedSolomonBatch* _batch = nullptr;
+	ReedSolomon& _rs;
+	unsigned _threads;
 	bool _good;
+
+	std::vector<char> _decoded;
+	std::vector<ssize_t> _results;
 };
 
 inline std::ifstream& operator<<(std::ifstream& s, const ReedSolomon::BadChunk&)
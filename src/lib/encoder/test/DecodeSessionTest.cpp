@@ -0,0 +1,111 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+#include "TestHelpers.h"
+
+#include "DecodeSession.h"
+#include "Encoder.h"
+
+#include "util/ConfigScope.h"
+#include "PicoSHA2/picosha2.h"
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+	cv::Mat load_sample(std::string filename)
+	{
+		cv::Mat img = cv::imread(TestCimbar::getSample(filename));
+		cv::cvtColor(img, img, cv::COLOR_BGR2RGB);
+		return img;
+	}
+
+	std::string decode_hash(DecodeSession& session, const cv::Mat& img, unsigned& bytes)
+	{
+		std::stringstream ss;
+		bytes = session.decode(img, ss);
+		return picosha2::hash256_hex_string(ss.str());
+	}
+}
+
+TEST_CASE( "DecodeSessionTest/testConf", "[unit]" )
+{
+	DecodeSession session(4);
+	assertEquals( 2, session.conf().color_bits );
+	assertTrue( session.conf().legacy_mode );
+
+	// the thread's own conf is left alone
+	assertFalse( cimbar::Config::legacy_mode() );
+	{
+		DecodeSession::scope s(session);
+		assertTrue( cimbar::Config::legacy_mode() );
+	}
+	assertFalse( cimbar::Config::legacy_mode() );
+}
+
+TEST_CASE( "DecodeSessionTest/testSessionsAcrossThreads", "[unit]" )
+{
+	// two sessions in two modes, each bouncing between two threads. Should get the same answers as DecoderTest.
+	DecodeSession modeB(68);
+	DecodeSession mode4C(4);
+	cv::Mat imgB = load_sample("b/tr_0.png");
+	cv::Mat img4C = load_sample("6bit/4color_ecc30_fountain_0.png");
+
+	std::vector<std::string> hashes(4);
+	std::vector<unsigned> bytes(4);
+	std::thread first([&]() {
+		hashes[0] = decode_hash(modeB, imgB, bytes[0]);
+		hashes[1] = decode_hash(mode4C, img4C, bytes[1]);
+	});
+	std::thread second([&]() {
+		hashes[2] = decode_hash(mode4C, img4C, bytes[2]);
+		hashes[3] = decode_hash(modeB, imgB, bytes[3]);
+	});
+	first.join();
+	second.join();
+
+	for (unsigned b : bytes)
+		assertEquals( 7500, b );
+
+	assertEquals( "a0e9fff8cd5b13807fae215b8b07e38091d3f533ff46243b53ee7f74fbbee0d5", hashes[0] );
+	assertEquals( "a0e9fff8cd5b13807fae215b8b07e38091d3f533ff46243b53ee7f74fbbee0d5", hashes[3] );
+	assertEquals( "382c76644a4dff475c5793c5fe061e35e47be252010d29aeaf8d93ee6a3f7045", hashes[1] );
+	assertEquals( "382c76644a4dff475c5793c5fe061e35e47be252010d29aeaf8d93ee6a3f7045", hashes[2] );
+}
+
+TEST_CASE( "DecodeSessionTest/testAutoMode", "[unit]" )
+{
+	// a mode Bm frame, with a header
+	cv::Mat frame;
+	{
+		ConfigScope cs(67);
+		std::ifstream infile(TestCimbar::getProjectDir() + "/LICENSE");
+
+		Encoder enc;
+		enc.set_frame_header(true);
+		fountain_encoder_stream::ptr fes = enc.create_fountain_encoder(infile, "");
+		assertTrue( fes );
+		frame = *enc.encode_next(*fes, {1100, 1100});
+	}
+
+	// the session starts out as mode B, but follows the header
+	DecodeSession session(68);
+	session.set_auto_mode(true);
+	session.set_sink(std::make_shared<fountain_decoder_sink>(session.conf().fountain_chunk_size()));
+
+	cv::Mat extracted;
+	assertTrue( session.extract(frame, extracted) );
+	assertEquals( 67, session.conf().mode_val );
+	assertEquals( 1024, extracted.cols );
+	assertEquals( 720, extracted.rows );
+
+	// the sink comes along
+	assertEquals( cimbar::Config::temp_conf(67).fountain_chunk_size(), session.sink()->chunk_size() );
+
+	std::stringstream ss;
+	assertEquals( 5148, session.decode(extracted, ss) );
+	assertTrue( session.decode_fountain(extracted) > 0 );
+	assertEquals( 1, session.sink()->num_streams() );
+}
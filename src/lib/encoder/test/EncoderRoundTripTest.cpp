@@ -138,3 +138,74 @@ TEST_CASE( "EncoderRoundTripTest/testStreaming", "[unit]" )
 	assertEquals( 16727, decodedContents.size() );
 	assertStringContains( "Mozilla Public License Version 2.0", decodedContents );
 }
+
+TEST_CASE( "EncoderRoundTripTest/testStreaming.Segmented", "[unit]" )
+{
+	// too big for one fountain stream, so it goes out in segments.
+	// every frame is one segment's -- the color correction predicts a frame's headers from its first one
+	MakeTempDirectory tempdir;
+
+	std::string input;
+	input.reserve(0x2000000 + 20);
+	for (unsigned i = 0; input.size() < 0x2000000; ++i)
+		input += fmt::format("{}\n", i*i);
+
+	EncoderPlus enc(4, 2);
+	fountain_encoder_stream::ptr fes = enc.create_fountain_encoder(input.data(), input.size(), "", 0);
+	assertTrue( fes );
+	assertTrue( fes->good() );
+	assertEquals( 3, fes->num_segments() );
+
+	Decoder dec;
+	fountain_decoder_sink fds(cimbar::Config::fountain_chunk_size(), segmented_on_store(tempdir.path(), write_on_store<std::ofstream>(tempdir.path())));
+
+	for (int i = 0; i < 10; ++i)
+	{
+		std::optional<cv::Mat> frame = enc.encode_next(*fes);
+		assertTrue( frame );
+
+		unsigned bytesDecoded = dec.decode_fountain(*frame, fds, false, 2);
+		assertEquals( 7500, bytesDecoded );
+	}
+
+	// the first frame is the manifest's. Then the segments take turns, a frame each
+	assertEquals( 1, fds.num_done() );
+	assertEquals( 3, fds.num_streams() );
+	for (double progress : fds.get_progress())
+		assertTrue( progress > 0 );
+}
+
+TEST_CASE( "EncoderRoundTripTest/testStreaming.5x5", "[unit]" )
+{
+	// mode S. Same as above, but with the 5x5 kernels
+	MakeTempDirectory tempdir;
+	ConfigScope cs(83);
+
+	std::ifstream infile(TestCimbar::getProjectDir() + "/LICENSE");
+
+	EncoderPlus enc;
+	fountain_encoder_stream::ptr fes = enc.create_fountain_encoder(infile, "");
+	assertTrue( fes );
+	assertTrue( fes->good() );
+
+	Decoder dec;
+	fountain_decoder_sink fds(cimbar::Config::fountain_chunk_size(), write_on_store<cimbar::zstd_decompressor<std::ofstream>>(tempdir.path()));
+
+	for (int i = 0; i < 100; ++i)
+	{
+		std::optional<cv::Mat> frame = enc.encode_next(*fes);
+		assertTrue( frame );
+		assertEquals( 988, frame->cols );
+
+		unsigned bytesDecoded = dec.decode_fountain(*frame, fds);
+		assertEquals( 10560, bytesDecoded );
+
+		if (fds.num_done())
+			break;
+	}
+
+	assertEquals( 1, fds.num_done() );
+	std::string decodedContents = File(tempdir.path() / "0.5256").read_all();
+	assertEquals( 16727, decodedContents.size() );
+	assertStringContains( "Mozilla Public License Version 2.0", decodedContents );
+}
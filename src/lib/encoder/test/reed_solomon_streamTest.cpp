@@ -65,3 +65,64 @@ TEST_CASE( "reed_solomon_streamTest/testDecodeBad", "[unit]" )
 	assertEquals( string(140, '\0'), actual );
 }
 
+
+TEST_CASE( "reed_solomon_streamTest/testDecodeParallel", "[unit]" )
+{
+	stringstream outs;
+	reed_solomon_stream<stringstream> rss(outs, 15, 155, 3);
+
+	// 5 blocks, with a bad one in the middle. Output order must match input order.
+	string encoded = exampleEncodedBlock155() + exampleEncodedBlock155() + string(155, 'f') + exampleEncodedBlock155() + exampleEncodedBlock155();
+	rss.write(encoded.data(), encoded.size());
+
+	string expected = exampleDecodedBlock() + exampleDecodedBlock() + string(140, '\0') + exampleDecodedBlock() + exampleDecodedBlock();
+	string actual = outs.str();
+	assertEquals( 700, actual.size() );
+	assertEquals( expected, actual );
+}
+
+TEST_CASE( "reed_solomon_streamTest/testDecodeParallel.Aligned", "[unit]" )
+{
+	// the parallel path should look exactly like the serial one to an aligned_stream
+	string encoded = exampleEncodedBlock155() + string(155, 'f') + exampleEncodedBlock155() + exampleEncodedBlock155();
+
+	auto decode = [&encoded](unsigned threads, std::vector<bool>& flushes) {
+		stringstream outs;
+		aligned_stream aligner(outs, 140, 0, [&flushes](char* data, size_t) { flushes.push_back(data != nullptr); });
+		reed_solomon_stream rss(aligner, 15, 155, threads);
+		rss.write(encoded.data(), encoded.size());
+		return outs.str();
+	};
+
+	std::vector<bool> serialFlushes;
+	string serial = decode(1, serialFlushes);
+
+	std::vector<bool> parallelFlushes;
+	string parallel = decode(4, parallelFlushes);
+
+	assertEquals( serialFlushes, parallelFlushes );
+	assertEquals( serial, parallel );
+	assertEquals( 3, parallelFlushes.size() );
+}
+
+TEST_CASE( "reed_solomon_streamTest/testDecodeParallel.SharedBatch", "[unit]" )
+{
+	// the Decoder way: one batch (and its worker threads), lots of short-lived streams
+	ReedSolomonBatch batch(15, 3);
+	for (unsigned blocks = 1; blocks <= 6; ++blocks)
+	{
+		stringstream outs;
+		reed_solomon_stream rss(outs, batch, 155);
+
+		string encoded;
+		string expected;
+		for (unsigned i = 0; i < blocks; ++i)
+		{
+			bool bad = (i == 1);
+			encoded += bad? string(155, 'f') : exampleEncodedBlock155();
+			expected += bad? string(140, '\0') : exampleDecodedBlock();
+		}
+		rss.write(encoded.data(), encoded.size());
+		assertEquals( expected, outs.str() );
+	}
+}
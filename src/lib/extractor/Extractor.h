@@ -3,6 +3,8 @@
 
 #include "Deskewer.h"
 #include "Scanner.h"
+#include "cimb_translator/Config.h"
+#include "cimb_translator/FrameHeader.h"
 #include "util/vec_xy.h"
 
 #include <opencv2/opencv.hpp>
@@ -21,6 +23,10 @@ public:
 	template <typename MAT>
 	int extract(const MAT& img, MAT& out);
 
+	// same, but also reads the frame header (if any) into mode_val
+	template <typename MAT>
+	int extract(const MAT& img, MAT& out, unsigned& mode_val);
+
 protected:
 	cimbar::vec_xy _imageSize;
 	unsigned _anchorSize;
@@ -43,3 +49,37 @@ inline int Extractor::extract(const MAT& img, MAT& out)
 		return NEEDS_SHARPEN;
 	return SUCCESS;
 }
+
+// if the header says we're in a mode with a different image size, we deskew again (from the same corners) at that size.
+// that only happens when the mode changes -- the caller should be extracting with the new size after that.
+template <typename MAT>
+inline int Extractor::extract(const MAT& img, MAT& out, unsigned& mode_val)
+{
+	mode_val = 0;
+	Scanner scanner(img);
+	std::vector<Anchor> points = scanner.scan();
+	if (points.size() < 4)
+		return FAILURE;
+
+	MAT src = img; // in case out == img
+	Corners corners(points);
+	Deskewer de(_padding, _imageSize, _anchorSize);
+	out = de.deskew(src, corners);
+
+	cimbar::vec_xy imageSize = _imageSize;
+	mode_val = FrameHeader::read(out, _imageSize, cimbar::Config::dark());
+	if (mode_val)
+	{
+		cimbar::conf cc = cimbar::Config::temp_conf(mode_val);
+		if (cc.image_size_x != _imageSize.width() or cc.image_size_y != _imageSize.height())
+		{
+			imageSize = {cc.image_size_x, cc.image_size_y};
+			Deskewer resized(_padding, imageSize, _anchorSize);
+			out = resized.deskew(src, corners);
+		}
+	}
+
+	if ( !corners.is_granular_scale(imageSize) )
+		return NEEDS_SHARPEN;
+	return SUCCESS;
+}
@@ -0,0 +1,197 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "FountainMetadata.h"
+#include "util/MappedFile.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_set>
+
+// a flat file of the fountain chunks a decoder pulled out of some images -- without putting them back together.
+// the point is to split a long recording across several decoders (processes, machines...), and merge their logs afterwards.
+// see cimbar --chunk-log, and cimbar_merge.
+//
+// layout (all little endian):
+//  header, HEADER_SIZE bytes:
+//   0: "CIMBCLOG"
+//   8: version (u16), 10: header size (u16)
+//  12: chunk size (u32)
+//  16: fountain metadata size (u16), 18: reserved (u16)
+//  20: record count (u64) -- 0 if the writer didn't get to finish. The file size is what counts.
+//  28: reserved (u32)
+//  records, chunk size bytes each:
+//   the chunk, as it came out of the decoder. It starts with its FountainMetadata, so (fountain id, block id, payload) is
+//   md[0:4], md[4:6], and the rest.
+// fixed size records, so it can be mmap'd and indexed directly. A torn record at the end is ignored.
+class FountainChunkLog
+{
+public:
+	static constexpr char MAGIC[] = "CIMBCLOG";
+	static constexpr uint16_t VERSION = 1;
+	static constexpr unsigned HEADER_SIZE = 32;
+
+public:
+	FountainChunkLog(const std::string& path)
+		: _file(path)
+	{
+		if (!_file.good() or _file.size() < HEADER_SIZE)
+			return;
+
+		const char* d = _file.data();
+		if (std::memcmp(d, MAGIC, 8) != 0 or read_int<uint16_t>(d+8) != VERSION)
+			return;
+		_headerSize = read_int<uint16_t>(d+10);
+		_chunkSize = read_int<uint32_t>(d+12);
+		unsigned mdSize = read_int<uint16_t>(d+16);
+		if (_headerSize < HEADER_SIZE or _headerSize > _file.size() or mdSize != FountainMetadata::md_size or _chunkSize <= mdSize)
+			return;
+
+		_count = (_file.size() - _headerSize) / _chunkSize;
+		_good = true;
+	}
+
+	bool good() const
+	{
+		return _good;
+	}
+
+	unsigned chunk_size() const
+	{
+		return _chunkSize;
+	}
+
+	size_t size() const
+	{
+		return _count;
+	}
+
+	const char* chunk(size_t i) const
+	{
+		return _file.data() + _headerSize + i*_chunkSize;
+	}
+
+	FountainMetadata metadata(size_t i) const
+	{
+		return FountainMetadata(chunk(i), _chunkSize);
+	}
+
+	// fun(const char* chunk, unsigned len)
+	template <typename FUN>
+	void for_each(const FUN& fun) const
+	{
+		for (size_t i = 0; i < _count; ++i)
+			fun(chunk(i), _chunkSize);
+	}
+
+	static std::string header(unsigned chunk_size, uint64_t count=0)
+	{
+		std::string res(HEADER_SIZE, '\0');
+		std::memcpy(res.data(), MAGIC, 8);
+		write_int<uint16_t>(res.data()+8, VERSION);
+		write_int<uint16_t>(res.data()+10, HEADER_SIZE);
+		write_int<uint32_t>(res.data()+12, chunk_size);
+		write_int<uint16_t>(res.data()+16, FountainMetadata::md_size);
+		write_int<uint64_t>(res.data()+20, count);
+		return res;
+	}
+
+	template <typename INT>
+	static INT read_int(const char* d)
+	{
+		INT val = 0;
+		for (unsigned i = 0; i < sizeof(INT); ++i)
+			val |= (INT)(uint8_t)d[i] << (i*8);
+		return val;
+	}
+
+	template <typename INT>
+	static void write_int(char* d, INT val)
+	{
+		for (unsigned i = 0; i < sizeof(INT); ++i)
+			d[i] = (char)((val >> (i*8)) & 0xFF);
+	}
+
+protected:
+	MappedFile _file;
+	bool _good = false;
+	unsigned _headerSize = 0;
+	unsigned _chunkSize = 0;
+	size_t _count = 0;
+};
+
+// the writer. Goes where a fountain_decoder_sink would (ex: Decoder::decode_fountain()),
+// but only writes down chunks it hasn't seen before.
+class fountain_chunk_log_sink
+{
+public:
+	fountain_chunk_log_sink(const std::string& path, unsigned chunk_size)
+		: _chunkSize(chunk_size)
+	{
+		_f = std::fopen(path.c_str(), "wb");
+		if (!_f)
+			return;
+		std::string head = FountainChunkLog::header(_chunkSize);
+		_good = std::fwrite(head.data(), 1, head.size(), _f) == head.size();
+	}
+
+	~fountain_chunk_log_sink()
+	{
+		if (!_f)
+			return;
+		// now that we're done, the header gets the final count
+		if (_good and std::fseek(_f, 20, SEEK_SET) == 0)
+		{
+			char count[8];
+			FountainChunkLog::write_int<uint64_t>(count, _count);
+			std::fwrite(count, 1, sizeof(count), _f);
+		}
+		std::fclose(_f);
+	}
+
+	bool good() const
+	{
+		return _good;
+	}
+
+	unsigned chunk_size() const
+	{
+		return _chunkSize;
+	}
+
+	// how many (unique) chunks we've written
+	uint64_t count() const
+	{
+		return _count;
+	}
+
+	bool write(const char* data, unsigned length)
+	{
+		if (!_good)
+			return false;
+
+		for (; length >= _chunkSize; data += _chunkSize, length -= _chunkSize)
+		{
+			FountainMetadata md(data, _chunkSize);
+			if (!md.file_size())
+				continue;
+			uint64_t key = ((uint64_t)md.id() << 16) | md.block_id();
+			if (!_seen.insert(key).second)
+				continue;
+
+			if (std::fwrite(data, 1, _chunkSize, _f) != _chunkSize)
+				return _good = false;
+			++_count;
+		}
+		return true;
+	}
+
+protected:
+	unsigned _chunkSize;
+	std::FILE* _f = nullptr;
+	bool _good = false;
+	uint64_t _count = 0;
+	std::unordered_set<uint64_t> _seen;
+};
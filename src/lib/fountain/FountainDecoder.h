@@ -2,10 +2,12 @@
 #pragma once
 
 #include "FountainInit.h"
+#include "FountainRecoverPool.h"
 #include "wirehair/wirehair.h"
+#include <algorithm>
 #include <array>
+#include <cstdint>
 #include <optional>
-#include <set>
 #include <vector>
 
 // will need to split large files
@@ -15,9 +17,14 @@ class FountainDecoder
 public:
 	FountainDecoder(size_t length, size_t packet_size)
 	    : _length(length)
+	    , _packetSize(packet_size)
 	{
 		FountainInit::init();
 		_codec = wirehair_decoder_create(nullptr, length, packet_size);
+
+		// the bitmap grows on demand, but most block ids will land in the first few multiples of N
+		unsigned blocks = packet_size? (length / packet_size) + 1 : 0;
+		_seenBlocks.reserve(((blocks * 4) >> 6) + 1);
 	}
 
 	~FountainDecoder()
@@ -27,7 +34,7 @@ public:
 
 	unsigned progress() const
 	{
-		return _seenBlocks.size();
+		return _progress;
 	}
 
 	size_t length() const
@@ -35,6 +42,16 @@ public:
 		return _length;
 	}
 
+	size_t packet_size() const
+	{
+		return _packetSize;
+	}
+
+	unsigned block_count() const
+	{
+		return _packetSize? (_length + _packetSize - 1) / _packetSize : 0;
+	}
+
 	bool good() const
 	{
 		return _codec != nullptr;
@@ -45,10 +62,29 @@ public:
 		return _res;
 	}
 
+	// wirehair wants more blocks before it can solve
+	bool needs_more() const
+	{
+		return _res == Wirehair_NeedMore;
+	}
+
+	// enough blocks have been seen -- recover() should succeed
+	bool solvable() const
+	{
+		return _res == Wirehair_Success;
+	}
+
+	bool seen(unsigned block_num) const
+	{
+		unsigned word = block_num >> 6;
+		if (word >= _seenBlocks.size())
+			return false;
+		return _seenBlocks[word] & (1ULL << (block_num & 0x3F));
+	}
+
 	bool decode(unsigned block_num, uint8_t* data, size_t length)
 	{
-		auto pear = _seenBlocks.insert(block_num);
-		if (!pear.second)
+		if (!mark_seen(block_num))
 			return false;
 
 		_res = wirehair_decode(_codec, block_num, data, length);
@@ -75,9 +111,66 @@ public:
 		return bytes;
 	}
 
+	// reconstruct the message one block at a time, passing each to fun(data, len).
+	// per block this is slower than recover(), but we never hold more than a batch of output.
+	// with a pool, each batch of blocks is rebuilt in parallel. (once solved, the codec is read-only)
+	template <typename FUN>
+	bool recover_blocks(const FUN& fun, FountainRecoverPool* pool=nullptr)
+	{
+		unsigned threads = pool? pool->threads() : 1;
+		unsigned batch = (threads == 1)? 1 : threads * 256;
+		batch = std::min(batch, block_count());
+
+		std::vector<uint8_t> buff(batch * _packetSize);
+		std::vector<uint32_t> bytes(batch, 0);
+		std::vector<WirehairResult> results(batch, Wirehair_Success);
+
+		// the first batch is just block 0 -- so a caller that only wants a peek at the header doesn't pay for a whole batch
+		for (unsigned first = 0, count = 1; first < block_count(); first += count, count = std::min(batch, block_count() - first))
+		{
+			auto work = [&](unsigned i) {
+				results[i] = wirehair_recover_block(_codec, first + i, buff.data() + i*_packetSize, &bytes[i]);
+			};
+			if (threads > 1)
+				pool->run(count, work);
+			else
+				for (unsigned i = 0; i < count; ++i)
+					work(i);
+
+			for (unsigned i = 0; i < count; ++i)
+			{
+				_res = results[i];
+				if (_res != Wirehair_Success)
+					return false;
+				if (!fun(buff.data() + i*_packetSize, bytes[i]))
+					return false;
+			}
+		}
+		return true;
+	}
+
+protected:
+	bool mark_seen(unsigned block_num)
+	{
+		unsigned word = block_num >> 6;
+		if (word >= _seenBlocks.size())
+			_seenBlocks.resize(word+1, 0);
+
+		uint64_t bit = 1ULL << (block_num & 0x3F);
+		if (_seenBlocks[word] & bit)
+			return false;
+		_seenBlocks[word] |= bit;
+		++_progress;
+		return true;
+	}
+
 protected:
 	WirehairCodec _codec;
-	WirehairResult _res;
+	WirehairResult _res = Wirehair_NeedMore;
 	size_t _length;
-	std::set<unsigned> _seenBlocks; // giving wirehair_decode the same block too many times can make it very, very upset
+	size_t _packetSize;
+	// giving wirehair_decode the same block too many times can make it very, very upset
+	// block ids are dense-ish uint16_ts, so a bitmap does the job without a node alloc per block
+	std::vector<uint64_t> _seenBlocks;
+	unsigned _progress = 0;
 };
@@ -0,0 +1,459 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "FountainMetadata.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// an append-only log of the fountain chunks we've received, so a restarted receiver can pick up where it left off.
+// see fountain_decoder_sink::set_journal().
+// records are: type (1 byte), payload length (4 bytes LE), payload, fnv-1a of the payload (4 bytes LE)
+//  * CHUNK: a whole fountain chunk, header included. So FountainMetadata::id() and the block id are right there.
+//  * DONE: a finished stream -- FountainMetadata::id() (4 bytes LE), then the name it was stored under.
+//          (no name for a stream that's only part of a file. See fountain_decoder_sink::mark_piece_done)
+// a torn record at the end (we crashed mid-write) is where the journal ends.
+// writes are buffered, and a background thread writes + fsyncs them every `sync_interval_ms`.
+// chunks for streams that finish (or that the sink gives up on) are dead weight. Once that's at least half the journal,
+// it gets rewritten without them -- on the caller's thread, but that gets rarer as the journal grows.
+class FountainJournal
+{
+public:
+	static constexpr unsigned DEFAULT_SYNC_INTERVAL_MS = 1000;
+	static constexpr size_t MAX_PENDING = 0x400000; // past this, append() writes out on the caller's thread
+	static constexpr uint64_t COMPACT_MIN_DEAD = 1024; // chunks. Don't bother rewriting for less
+
+	static constexpr uint8_t CHUNK = 1;
+	static constexpr uint8_t DONE = 2;
+
+	// what's on disk (or about to be)
+	struct stats
+	{
+		uint64_t chunks = 0; // live ones -- for streams that haven't finished
+		uint64_t dead = 0; // duplicates, and chunks for finished (or forgotten) streams
+		unsigned done = 0;
+		bool torn = false;
+	};
+
+public:
+	FountainJournal(std::string path, unsigned sync_interval_ms=DEFAULT_SYNC_INTERVAL_MS)
+		: _path(std::move(path))
+		, _syncInterval(sync_interval_ms)
+	{
+		scan();
+	}
+
+	~FountainJournal()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_cv.notify_one();
+		if (_flusher.joinable())
+			_flusher.join();
+		sync();
+		if (_f)
+			std::fclose(_f);
+	}
+
+	bool good() const
+	{
+		return _good;
+	}
+
+	const stats& on_disk() const
+	{
+		return _stats;
+	}
+
+	// call once, before any append(). done_fun(id, filename) for every finished stream,
+	// then chunk_fun(data, len) for every chunk of every unfinished one, in the order they arrived.
+	// afterwards, the journal is rewritten without the dead weight (if there is any), and opened for appends.
+	bool replay(const std::function<void(uint32_t, const std::string&)>& done_fun, const std::function<void(const char*, unsigned)>& chunk_fun)
+	{
+		for (auto&& [id, filename] : _done)
+			done_fun(id, filename);
+
+		bool compact = _stats.dead > 0 or _stats.torn;
+		std::string tmpPath = _path + ".tmp";
+		std::FILE* out = nullptr;
+		if (compact)
+		{
+			out = std::fopen(tmpPath.c_str(), "wb");
+			if (!out)
+				return _good = false;
+			for (auto&& [id, filename] : _done)
+				write_record(out, DONE, done_payload(id, filename));
+		}
+
+		_index.clear();
+		read_records([&](uint8_t type, const std::string& payload) {
+			if (type != CHUNK or !is_new(payload))
+				return;
+			chunk_fun(payload.data(), payload.size());
+			if (out)
+				write_record(out, CHUNK, payload);
+		});
+
+		if (out)
+		{
+			std::fflush(out);
+			sync_file(out);
+			std::fclose(out);
+			std::error_code ec;
+			std::filesystem::rename(tmpPath, _path, ec);
+			if (ec)
+				return _good = false;
+			_stats.dead = 0;
+			_stats.torn = false;
+		}
+		return open_for_append(!compact);
+	}
+
+	// true if we wrote it down. (false for chunks we already have)
+	bool append(const char* data, unsigned len)
+	{
+		std::string payload(data, len);
+		if (!_f or !is_new(payload))
+			return false;
+		_forgotten.erase(FountainMetadata(data, len).id());
+		++_stats.chunks;
+		return queue(CHUNK, payload);
+	}
+
+	bool is_done(uint32_t id) const
+	{
+		return _done.find(id) != _done.end();
+	}
+
+	bool mark_done(uint32_t id, const std::string& filename)
+	{
+		if (!_f)
+			return false;
+		if (_done.insert_or_assign(id, filename).second)
+			++_stats.done;
+		drop_chunks(id);
+		bool res = queue(DONE, done_payload(id, filename));
+		maybe_compact();
+		return res;
+	}
+
+	// a stream the sink gave up on (evicted, say). If it comes back, it starts over -- so its chunks are dead weight.
+	void forget(uint32_t id)
+	{
+		if (!_f or !drop_chunks(id))
+			return;
+		_forgotten.insert(id);
+		maybe_compact();
+	}
+
+	// rewrite the journal without the dead weight
+	bool compact()
+	{
+		if (!_f)
+			return false;
+		sync();
+
+		std::lock_guard<std::mutex> lock(_fileMutex);
+		std::string tmpPath = _path + ".tmp";
+		std::FILE* out = std::fopen(tmpPath.c_str(), "wb");
+		if (!out)
+			return false;
+		for (auto&& [id, filename] : _done)
+			write_record(out, DONE, done_payload(id, filename));
+
+		std::unordered_map<uint32_t, std::unordered_set<uint16_t>> seen;
+		read_records([&](uint8_t type, const std::string& payload) {
+			if (type != CHUNK or payload.size() < FountainMetadata::md_size)
+				return;
+			FountainMetadata md(payload.data(), payload.size());
+			if (_done.find(md.id()) != _done.end() or _forgotten.find(md.id()) != _forgotten.end())
+				return;
+			if (seen[md.id()].insert(md.block_id()).second)
+				write_record(out, CHUNK, payload);
+		});
+		std::fflush(out);
+		sync_file(out);
+		std::fclose(out);
+
+		std::fclose(_f);
+		std::error_code ec;
+		std::filesystem::rename(tmpPath, _path, ec);
+		_f = std::fopen(_path.c_str(), "ab");
+		if (ec or !_f)
+			return _good = false;
+
+		_forgotten.clear();
+		_stats.dead = 0;
+		_stats.torn = false;
+		return true;
+	}
+
+	// write + fsync everything we have, right now
+	void sync()
+	{
+		std::string pending;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			pending.swap(_pending);
+		}
+		write_out(pending);
+	}
+
+protected:
+	// returns true if there was anything to drop
+	bool drop_chunks(uint32_t id)
+	{
+		auto it = _index.find(id);
+		if (it == _index.end())
+			return false;
+		_stats.chunks -= it->second.size();
+		_stats.dead += it->second.size();
+		_index.erase(it);
+		return true;
+	}
+
+	void maybe_compact()
+	{
+		if (_stats.dead >= COMPACT_MIN_DEAD and _stats.dead >= _stats.chunks)
+			compact();
+	}
+
+	bool queue(uint8_t type, const std::string& payload)
+	{
+		bool full;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_pending += record(type, payload);
+			full = _pending.size() >= MAX_PENDING;
+		}
+		if (full)
+			sync();
+		return true;
+	}
+
+	void write_out(const std::string& data)
+	{
+		std::lock_guard<std::mutex> lock(_fileMutex);
+		if (!_f or data.empty())
+			return;
+		if (std::fwrite(data.data(), 1, data.size(), _f) != data.size())
+			_good = false;
+		std::fflush(_f);
+		sync_file(_f);
+	}
+
+	void flush_loop()
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		while (!_stop)
+		{
+			_cv.wait_for(lock, std::chrono::milliseconds(_syncInterval));
+			if (_pending.empty())
+				continue;
+
+			std::string pending;
+			pending.swap(_pending);
+			lock.unlock();
+			write_out(pending);
+			lock.lock();
+		}
+	}
+
+	bool open_for_append(bool truncate_torn)
+	{
+		// if there's a torn record at the end, appending after it would hide everything we write from now on
+		std::error_code ec;
+		if (truncate_torn and std::filesystem::exists(_path, ec))
+			std::filesystem::resize_file(_path, _validEnd, ec);
+
+		_f = std::fopen(_path.c_str(), "ab");
+		if (!_f)
+			return _good = false;
+		_flusher = std::thread(&FountainJournal::flush_loop, this);
+		return _good;
+	}
+
+	// first pass: what's in here? Which streams are finished, and how much could we throw away?
+	void scan()
+	{
+		_stats = stats();
+		_done.clear();
+		_index.clear();
+		if (!std::filesystem::exists(_path))
+			return;
+
+		read_records([&](uint8_t type, const std::string& payload) {
+			if (type == DONE and payload.size() >= 4)
+			{
+				uint32_t id = read_u32(payload.data());
+				_done[id] = payload.substr(4);
+			}
+			else if (type == CHUNK)
+			{
+				if (is_new(payload))
+					++_stats.chunks;
+				else
+					++_stats.dead;
+			}
+		});
+
+		for (uint32_t id : done_ids())
+		{
+			auto it = _index.find(id);
+			if (it == _index.end())
+				continue;
+			_stats.chunks -= it->second.size();
+			_stats.dead += it->second.size();
+			_index.erase(it);
+		}
+		_stats.done = _done.size();
+		_stats.torn = _validEnd < std::filesystem::file_size(_path);
+		_index.clear();
+	}
+
+	template <typename FUN>
+	void read_records(const FUN& fun)
+	{
+		_validEnd = 0;
+		std::FILE* f = std::fopen(_path.c_str(), "rb");
+		if (!f)
+			return;
+
+		std::string payload;
+		while (true)
+		{
+			char head[5];
+			if (std::fread(head, 1, 5, f) != 5)
+				break;
+			uint8_t type = head[0];
+			uint32_t len = read_u32(head+1);
+			if ((type != CHUNK and type != DONE) or len > MAX_PENDING)
+				break;
+
+			payload.resize(len);
+			char check[4];
+			if (std::fread(payload.data(), 1, len, f) != len or std::fread(check, 1, 4, f) != 4)
+				break;
+			if (read_u32(check) != fnv(payload))
+				break;
+
+			_validEnd += 9 + len;
+			fun(type, payload);
+		}
+		std::fclose(f);
+	}
+
+	// dedupe on (FountainMetadata::id(), block id)
+	bool is_new(const std::string& chunk)
+	{
+		if (chunk.size() < FountainMetadata::md_size)
+			return false;
+		FountainMetadata md(chunk.data(), chunk.size());
+		if (_done.find(md.id()) != _done.end())
+			return false;
+		return _index[md.id()].insert(md.block_id()).second;
+	}
+
+	std::vector<uint32_t> done_ids() const
+	{
+		std::vector<uint32_t> ids;
+		for (auto&& [id, filename] : _done)
+			ids.push_back(id);
+		return ids;
+	}
+
+	static std::string done_payload(uint32_t id, const std::string& filename)
+	{
+		std::string payload;
+		put_u32(payload, id);
+		return payload + filename;
+	}
+
+	static std::string record(uint8_t type, const std::string& payload)
+	{
+		std::string rec;
+		rec += (char)type;
+		put_u32(rec, payload.size());
+		rec += payload;
+		put_u32(rec, fnv(payload));
+		return rec;
+	}
+
+	static void write_record(std::FILE* f, uint8_t type, const std::string& payload)
+	{
+		std::string rec = record(type, payload);
+		std::fwrite(rec.data(), 1, rec.size(), f);
+	}
+
+	static void sync_file(std::FILE* f)
+	{
+#ifdef _WIN32
+		::_commit(::_fileno(f));
+#else
+		::fsync(::fileno(f));
+#endif
+	}
+
+	static void put_u32(std::string& out, uint32_t val)
+	{
+		for (unsigned i = 0; i < 4; ++i)
+			out += (char)((val >> (i*8)) & 0xFF);
+	}
+
+	static uint32_t read_u32(const char* data)
+	{
+		uint32_t val = 0;
+		for (unsigned i = 0; i < 4; ++i)
+			val |= (uint32_t)(uint8_t)data[i] << (i*8);
+		return val;
+	}
+
+	static uint32_t fnv(const std::string& data)
+	{
+		uint32_t h = 2166136261u;
+		for (char c : data)
+			h = (h ^ (uint8_t)c) * 16777619u;
+		return h;
+	}
+
+protected:
+	std::string _path;
+	unsigned _syncInterval;
+	std::atomic<bool> _good = true;
+	stats _stats;
+	uint64_t _validEnd = 0;
+
+	// what's on disk (or about to be)
+	std::unordered_map<uint32_t, std::unordered_set<uint16_t>> _index;
+	std::unordered_map<uint32_t, std::string> _done;
+	std::unordered_set<uint32_t> _forgotten;
+
+	std::FILE* _f = nullptr;
+	std::mutex _fileMutex;
+
+	// the flusher
+	std::mutex _mutex;
+	std::condition_variable _cv;
+	std::string _pending;
+	bool _stop = false;
+	std::thread _flusher;
+};
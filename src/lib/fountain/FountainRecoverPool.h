@@ -0,0 +1,122 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// threads for rebuilding finished files a batch of blocks at a time (see FountainDecoder::recover_blocks).
+// same deal as ReedSolomonBatch: the workers are started once, and wait around for the next batch,
+// so keep one of these around (the sink does). The calling thread does its share of the work too.
+// one run() at a time.
+
+class FountainRecoverPool
+{
+public:
+	FountainRecoverPool(unsigned threads)
+	{
+		for (unsigned w = 1; w < threads; ++w)
+			_workers.emplace_back(&FountainRecoverPool::work_loop, this, w);
+	}
+
+	~FountainRecoverPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		for (std::thread& t : _workers)
+			t.join();
+	}
+
+	unsigned threads() const
+	{
+		return _workers.size() + 1;
+	}
+
+	// fun(i) for every i in [0, count). Striped across the threads, so neighbors run in parallel.
+	void run(unsigned count, const std::function<void(unsigned)>& fun)
+	{
+		if (count == 0)
+			return;
+
+		job j{&fun, count, std::min<unsigned>(threads(), count)};
+		if (j.workers > 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_job = j;
+				_pending = j.workers - 1;
+				++_generation;
+			}
+			_wake.notify_all();
+		}
+
+		work(0, j);
+
+		if (j.workers > 1)
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_finished.wait(lock, [this]() { return _pending == 0; });
+		}
+	}
+
+protected:
+	struct job
+	{
+		const std::function<void(unsigned)>* fun;
+		unsigned count;
+		unsigned workers;
+	};
+
+	static void work(unsigned w, const job& j)
+	{
+		for (unsigned i = w; i < j.count; i += j.workers)
+			(*j.fun)(i);
+	}
+
+	void work_loop(unsigned w)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			job j;
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_wake.wait(lock, [this, seen]() { return _stopping or _generation != seen; });
+				if (_stopping)
+					return;
+				seen = _generation;
+				j = _job;
+			}
+
+			// small batches don't need everyone
+			if (w >= j.workers)
+				continue;
+			work(w, j);
+
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				last = (--_pending == 0);
+			}
+			if (last)
+				_finished.notify_one();
+		}
+	}
+
+protected:
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _finished;
+	job _job = {};
+	uint64_t _generation = 0;
+	unsigned _pending = 0;
+	bool _stopping = false;
+};
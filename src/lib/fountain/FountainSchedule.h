@@ -0,0 +1,104 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+
+// which block id goes out next, for a stream that's shown on a loop (ex: cimbar_js).
+// a receiver can show up at any point, and miss any frame. So we want every frame it sees to be new to it:
+//  1. the first pass is the systematic blocks, in order. A receiver that's there from the start needs nothing else.
+//  2. after that, it's repair blocks -- and we never go back. Each pass is ~blocks_required() fresh ids, in shuffled order.
+//  3. each encode_id starts at a different spot in the repair id space, so consecutive files don't share ids.
+// ids only change at run (frame) boundaries. Within a run they count up by one -- the decoder's color correction
+// predicts the headers of a frame's chunks from the first one (see CimbReader::update_metadata).
+class FountainSchedule
+{
+public:
+	static constexpr unsigned MAX_BLOCK_ID = 0x10000; // 16 bits on the wire. See FountainMetadata
+	static constexpr unsigned ENCODE_IDS = 0x80;
+
+public:
+	FountainSchedule(uint8_t encode_id=0, unsigned systematic=0, unsigned run_length=1)
+		: _encodeId(encode_id & (ENCODE_IDS-1))
+		, _systematic(systematic)
+		, _runLength(run_length? run_length : 1)
+	{
+		// the first pass can run on for most of a frame past the systematic ids. Repair runs start after that.
+		unsigned base = _systematic + _runLength + 1;
+		_repairBase = base;
+		_runs = (base < MAX_BLOCK_ID)? (MAX_BLOCK_ID - base) / _runLength : 0;
+		_passRuns = std::max(1u, (_systematic + _runLength - 1) / _runLength);
+		if (_runs and _passRuns > _runs)
+			_passRuns = _runs;
+		_startRun = _runs? (uint64_t)_encodeId * _runs / ENCODE_IDS : 0;
+	}
+
+	// the id for the next chunk
+	unsigned next()
+	{
+		bool boundary = (_chunks % _runLength) == 0;
+		if (boundary and _chunks > 0 and _id + 1 >= _systematic and _runs > 0)
+			_id = run_start(_run++);
+		else
+			_id = (_id + 1) % MAX_BLOCK_ID;
+		++_chunks;
+		return _id;
+	}
+
+	// the encoder couldn't use the id next() gave it (the short, last systematic block). Move along without using up a chunk.
+	unsigned skip()
+	{
+		_id = (_id + 1) % MAX_BLOCK_ID;
+		return _id;
+	}
+
+	unsigned chunks() const
+	{
+		return _chunks;
+	}
+
+protected:
+	unsigned run_start(uint64_t run) const
+	{
+		uint64_t pass = run / _passRuns;
+		uint64_t i = run % _passRuns;
+
+		// an affine permutation of the pass's runs. Cheap, and different every pass.
+		uint64_t h = mix(((uint64_t)_encodeId << 32) | pass);
+		uint64_t a = 1;
+		if (_passRuns > 2)
+		{
+			a = 1 + (h % (_passRuns - 1));
+			while (std::gcd(a, (uint64_t)_passRuns) != 1)
+				a = (a % (_passRuns - 1)) + 1;
+		}
+		uint64_t b = (h >> 32) % _passRuns;
+		uint64_t slot = (a * i + b) % _passRuns;
+
+		uint64_t r = (_startRun + pass * _passRuns + slot) % _runs;
+		return _repairBase + r * _runLength;
+	}
+
+	static uint64_t mix(uint64_t x)
+	{
+		// splitmix64
+		x += 0x9E3779B97F4A7C15ULL;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+protected:
+	unsigned _encodeId;
+	unsigned _systematic;
+	unsigned _runLength;
+	unsigned _repairBase;
+	unsigned _runs;
+	unsigned _passRuns;
+	unsigned _startRun;
+
+	unsigned _id = MAX_BLOCK_ID - 1; // so the first next() is 0
+	unsigned _chunks = 0;
+	uint64_t _run = 0;
+};
@@ -0,0 +1,149 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// payloads too big for one fountain stream (25 bits of size in the header, 64000 blocks in wirehair)
+// are split into segments. Each segment is its own stream, and a small manifest stream ties them together.
+//
+// every segment and the manifest start with a zstd skippable frame (so zstd tooling ignores them):
+//   manifest: type=2, tag(4), count(4), total size(8)
+//   segment:  type=3, tag(4), index(4), offset(8)
+// followed, for segments, by the segment's slice of the payload.
+//
+// streams are keyed on the receiving end by (encode_id, size), so every segment must have a different size.
+// we get that by shrinking each successive segment by a byte.
+
+class FountainSegments
+{
+public:
+	static constexpr unsigned MAX_STREAM_SIZE = 0x1FFFFFF;
+	static constexpr unsigned MAX_STREAM_BLOCKS = 64000;
+	static constexpr unsigned MAX_SEGMENT_BLOCKS = 16000; // keep each wirehair solve cheap
+	static constexpr unsigned MIN_SEGMENT_SIZE = 0x10000; // > any chunk size, so the manifest never collides with a segment
+
+	// the sender works through a few segments at a time, giving each its block count (+1/PASS_OVERHEAD) per turn.
+	// anything a receiver misses, it picks up on the next lap
+	static constexpr unsigned WINDOW = 4;
+	static constexpr unsigned PASS_OVERHEAD = 4;
+	static constexpr unsigned MANIFEST_INTERVAL = 32; // it's only a couple blocks
+
+	static constexpr uint8_t MANIFEST_TYPE = 2;
+	static constexpr uint8_t SEGMENT_TYPE = 3;
+	static constexpr unsigned HEADER_SIZE = 8 + 1 + 4 + 4 + 8;
+
+	struct segment
+	{
+		uint64_t offset;
+		unsigned length;
+	};
+
+	struct header
+	{
+		uint8_t type = 0;
+		uint32_t tag = 0;
+		uint32_t count_or_index = 0;
+		uint64_t size_or_offset = 0;
+	};
+
+public:
+	static bool needed(uint64_t size, unsigned block_size)
+	{
+		return size > MAX_STREAM_SIZE or size / block_size >= MAX_STREAM_BLOCKS - 1;
+	}
+
+	static std::vector<segment> layout(uint64_t size, unsigned block_size)
+	{
+		uint64_t full = std::min<uint64_t>(MAX_STREAM_SIZE - HEADER_SIZE, (uint64_t)block_size * MAX_SEGMENT_BLOCKS);
+		full = std::max<uint64_t>(full, MIN_SEGMENT_SIZE * 2);
+
+		std::vector<segment> segs;
+		uint64_t offset = 0;
+		while (offset < size)
+		{
+			unsigned len = std::min<uint64_t>(size - offset, full - segs.size());
+			segs.push_back({offset, len});
+			offset += len;
+		}
+
+		// don't let the last one get tiny: borrow from its neighbor.
+		// the neighbor is still smaller than every segment before it, and much bigger than the last.
+		if (segs.size() >= 2 and segs.back().length < MIN_SEGMENT_SIZE)
+		{
+			segment& prev = segs[segs.size()-2];
+			prev.length -= MIN_SEGMENT_SIZE;
+			segs.back().offset -= MIN_SEGMENT_SIZE;
+			segs.back().length += MIN_SEGMENT_SIZE;
+		}
+		return segs;
+	}
+
+	static uint32_t tag(uint8_t encode_id, uint64_t size)
+	{
+		return ((uint32_t)encode_id << 25) ^ (uint32_t)size ^ (uint32_t)(size >> 32) * 0x9E3779B1;
+	}
+
+	static std::string manifest(uint32_t tag, uint32_t count, uint64_t size)
+	{
+		return write_header(MANIFEST_TYPE, tag, count, size);
+	}
+
+	static std::string segment_header(uint32_t tag, uint32_t index, uint64_t offset)
+	{
+		return write_header(SEGMENT_TYPE, tag, index, offset);
+	}
+
+	static std::optional<header> read_header(const char* data, size_t len)
+	{
+		if (len < HEADER_SIZE)
+			return std::nullopt;
+
+		const uint8_t* d = reinterpret_cast<const uint8_t*>(data);
+		if (get<uint32_t>(d) != SKIPPABLE_MAGIC or get<uint32_t>(d+4) != HEADER_SIZE - 8)
+			return std::nullopt;
+
+		header h;
+		h.type = d[8];
+		if (h.type != MANIFEST_TYPE and h.type != SEGMENT_TYPE)
+			return std::nullopt;
+		h.tag = get<uint32_t>(d+9);
+		h.count_or_index = get<uint32_t>(d+13);
+		h.size_or_offset = get<uint64_t>(d+17);
+		return h;
+	}
+
+protected:
+	static constexpr uint32_t SKIPPABLE_MAGIC = 0x184D2A50;
+
+	template <typename T>
+	static void put(std::string& out, T val)
+	{
+		for (unsigned i = 0; i < sizeof(T); ++i)
+			out += (char)((val >> (i*8)) & 0xFF);
+	}
+
+	template <typename T>
+	static T get(const uint8_t* d)
+	{
+		T res = 0;
+		for (unsigned i = 0; i < sizeof(T); ++i)
+			res |= (T)d[i] << (i*8);
+		return res;
+	}
+
+	static std::string write_header(uint8_t type, uint32_t tag, uint32_t count_or_index, uint64_t size_or_offset)
+	{
+		std::string out;
+		put<uint32_t>(out, SKIPPABLE_MAGIC);
+		put<uint32_t>(out, HEADER_SIZE - 8);
+		out += (char)type;
+		put<uint32_t>(out, tag);
+		put<uint32_t>(out, count_or_index);
+		put<uint64_t>(out, size_or_offset);
+		return out;
+	}
+};
@@ -4,14 +4,32 @@
 #include "fountain_decoder_sink.h"
 
 #include "concurrentqueue/concurrentqueue.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 class concurrent_fountain_decoder_sink
 {
 public:
-	concurrent_fountain_decoder_sink(unsigned chunk_size, const std::function<std::string(const std::string&, const std::vector<uint8_t>&)>& on_store=nullptr)
+	static const unsigned DEFAULT_POOL_SIZE = 256; // in chunks
+
+public:
+	concurrent_fountain_decoder_sink(unsigned chunk_size, const fountain_store_fun& on_store=nullptr, unsigned pool_size=DEFAULT_POOL_SIZE)
 		: _decoder(chunk_size, on_store)
+		, _pool(pool_size * chunk_size)
+		, _lengths(pool_size, 0)
+	{
+		for (unsigned i = 0; i < pool_size; ++i)
+			_free.enqueue(i);
+	}
+
+	~concurrent_fountain_decoder_sink()
 	{
+		stop_consumer();
 	}
 
 	bool good() const
@@ -34,6 +52,12 @@ public:
 		return _decoder.num_done();
 	}
 
+	// chunks we had to throw away because every pool buffer was in flight
+	unsigned num_dropped() const
+	{
+		return _dropped;
+	}
+
 	std::vector<std::string> get_done() const
 	{
 		std::lock_guard<std::mutex> lock(_readMutex);
@@ -55,39 +79,141 @@ public:
 		_progress = _decoder.get_progress();
 	}
 
+	// drain the backlog on a dedicated thread, rather than piggybacking on write() calls.
+	void start_consumer()
+	{
+		if (_running.exchange(true))
+			return;
+		_consumer = std::thread(&concurrent_fountain_decoder_sink::consume, this);
+	}
+
+	void stop_consumer()
+	{
+		if (!_running.exchange(false))
+			return;
+		notify();
+		_consumer.join();
+		process(); // anything that landed after the consumer's last pass
+	}
+
 	void process()
 	{
 		if (_writeMutex.try_lock())
 		{
-			// maybe a 2nd mutex for retrieving _decoder.has_file()??
-			std::string buff;
-			while (_backlog.try_dequeue(buff))
-				_decoder << buff;
-
-			update_status();
+			drain();
 			_writeMutex.unlock();
 		}
 	}
 
+	// blocks until everything currently enqueued has gone through the decoder
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(_writeMutex);
+		drain();
+	}
+
 	bool write(const char* data, unsigned length)
 	{
-		std::string buffer(data, length);
-		operator<<(buffer);
-		return true;
+		// each chunk is copied once, into a fixed-size pool buffer, and handed off by index.
+		// no allocations on this path.
+		bool res = true;
+		while (length > 0)
+		{
+			unsigned writeLen = std::min(length, chunk_size());
+			res &= enqueue(data, writeLen);
+			data += writeLen;
+			length -= writeLen;
+		}
+
+		if (_running)
+			notify();
+		else
+			process();
+		return res;
 	}
 
 	concurrent_fountain_decoder_sink& operator<<(const std::string& buffer)
 	{
-		_backlog.enqueue(buffer);
-		process();
+		write(buffer.data(), buffer.size());
 		return *this;
 	}
 
+protected:
+	bool enqueue(const char* data, unsigned length)
+	{
+		unsigned idx;
+		if (!_free.try_dequeue(idx))
+		{
+			// every buffer is in flight. Try to free some up ourselves before giving up on the chunk.
+			if (!_running)
+				process();
+			if (!_free.try_dequeue(idx))
+			{
+				++_dropped;
+				return false;
+			}
+		}
+
+		std::copy(data, data+length, _pool.data() + (idx * chunk_size()));
+		_lengths[idx] = length;
+		_backlog.enqueue(idx);
+		return true;
+	}
+
+	void drain()
+	{
+		// call with _writeMutex held
+		std::array<unsigned, 32> idxs;
+		size_t count;
+		while ((count = _backlog.try_dequeue_bulk(idxs.data(), idxs.size())) > 0)
+		{
+			for (unsigned i = 0; i < count; ++i)
+				_decoder.write(_pool.data() + (idxs[i] * chunk_size()), _lengths[idxs[i]]);
+			_free.enqueue_bulk(idxs.data(), count);
+		}
+		update_status();
+	}
+
+	void notify()
+	{
+		// take the lock so the consumer can't miss a wakeup between its check and its wait
+		{
+			std::lock_guard<std::mutex> lock(_wakeMutex);
+		}
+		_wake.notify_one();
+	}
+
+	void consume()
+	{
+		while (_running)
+		{
+			{
+				std::unique_lock<std::mutex> lock(_wakeMutex);
+				_wake.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+					return !_running or _backlog.size_approx() > 0;
+				});
+			}
+			flush();
+		}
+	}
+
 protected:
 	std::mutex _writeMutex;
 	mutable std::mutex _readMutex;
 	fountain_decoder_sink _decoder;
-	moodycamel::ConcurrentQueue< std::string > _backlog;
+
+	// fixed-size chunk buffers. Indices move between _free and _backlog.
+	std::vector<char> _pool;
+	std::vector<unsigned> _lengths;
+	moodycamel::ConcurrentQueue<unsigned> _free;
+	moodycamel::ConcurrentQueue<unsigned> _backlog;
+	std::atomic<unsigned> _dropped = 0;
+
+	// optional dedicated consumer
+	std::thread _consumer;
+	std::atomic<bool> _running = false;
+	std::mutex _wakeMutex;
+	std::condition_variable _wake;
 
 	std::vector<std::string> _done;
 	std::vector<double> _progress;
@@ -2,27 +2,55 @@
 #pragma once
 
 #include "fountain_decoder_stream.h"
+#include "FountainJournal.h"
 #include "FountainMetadata.h"
+#include "FountainSegments.h"
+#include "compression/archive.h"
 #include "compression/zstd_decompressor.h"
 #include "compression/zstd_header_check.h"
 #include "serialize/format.h"
 #include "util/File.h"
 
+#include <algorithm>
 #include <cstdio>
+#include <deque>
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// pulls a finished file through fun(const uint8_t* data, unsigned len) -> bool, a block at a time, in order.
+// returns false if recovery failed, or if fun() asked us to stop.
+using fountain_block_reader = std::function<bool(const std::function<bool(const uint8_t*, unsigned)>&)>;
+
+// called when a stream is complete, with the fallback filename and a reader for its contents.
+// returns the name it was stored under -- or "" on failure.
+using fountain_store_fun = std::function<std::string(const std::string&, const fountain_block_reader&)>;
+
 template <typename OUTSTREAM>
-std::function<std::string(const std::string&, const std::vector<uint8_t>&)> write_on_store(std::string data_dir, bool log_writes=false)
+fountain_store_fun write_on_store(std::string data_dir, bool log_writes=false)
 {
-	return [data_dir, log_writes](const std::string& filename, const std::vector<uint8_t>& data)
+	return [data_dir, log_writes](const std::string& filename, const fountain_block_reader& read) -> std::string
 	{
 		std::string file_path = fmt::format("{}/{}", data_dir, filename);
-		OUTSTREAM f(file_path, std::ios::binary);
-		f.write((char*)data.data(), data.size());
+		bool res;
+		{
+			OUTSTREAM f(file_path, std::ios::binary);
+			res = read([&f](const uint8_t* data, unsigned len) {
+				f.write((const char*)data, len);
+				return true;
+			});
+		}
+		if (!res)
+		{
+			std::filesystem::remove(file_path);
+			return "";
+		}
 		if (log_writes)
 			printf("%s\n", file_path.c_str());
 		return filename;
@@ -30,35 +58,266 @@ std::function<std::string(const std::string&, const std::vector<uint8_t>&)> writ
 }
 
 template <typename OUTSTREAM>
-std::function<std::string(const std::string&, const std::vector<uint8_t>&)> decompress_on_store(std::string data_dir, bool log_writes=false)
+fountain_store_fun decompress_on_store(std::string data_dir, bool log_writes=false, std::vector<cimbar::zstd_dictionary> dicts={})
 {
-	return [data_dir, log_writes](const std::string& fallback_name, const std::vector<uint8_t>& data)
+	return [data_dir, log_writes, dicts](const std::string& fallback_name, const fountain_block_reader& read) -> std::string
 	{
-		std::string filename = cimbar::zstd_header_check::get_filename(data.data(), data.size());
-		if (!filename.empty())
-			filename = File::basename(filename);
-		if (filename.empty())
-			filename = fallback_name;
+		// blocks go straight into the decompressor as they're recovered.
+		// we only hold back the first few, until we've seen enough to read the filename from the header.
+		std::string head;
+		std::string filename;
+		std::string file_path;
+		std::optional<cimbar::zstd_decompressor<OUTSTREAM>> f;
+		std::optional<cimbar::zstd_decompressor<cimbar::archive_unpacker>> arc;
+		std::optional<cimbar::zstd_header_check::strategy_info> strategy;
 
-		std::string file_path = fmt::format("{}/{}", data_dir, filename);
-		cimbar::zstd_decompressor<OUTSTREAM> f(file_path, std::ios::binary);
-		f.write((char*)data.data(), data.size());
-		if (log_writes)
+		auto open = [&]() {
+			filename = cimbar::zstd_header_check::get_filename((const unsigned char*)head.data(), head.size());
+			strategy = cimbar::zstd_header_check::get_strategy((const unsigned char*)head.data(), head.size());
+			if (!filename.empty())
+				filename = File::basename(filename);
+			if (filename.empty())
+				filename = fallback_name;
+
+			file_path = fmt::format("{}/{}", data_dir, filename);
+			if (cimbar::zstd_header_check::is_archive((const unsigned char*)head.data(), head.size()))
+			{
+				arc.emplace(file_path);
+				return arc->write(head.data(), head.size()) and arc->good();
+			}
+
+			f.emplace(file_path, std::ios::binary);
+
+			uint32_t dictId = cimbar::zstd_header_check::get_dictionary_id((const unsigned char*)head.data(), head.size());
+			if (dictId)
+			{
+				auto it = std::find_if(dicts.begin(), dicts.end(), [dictId](const cimbar::zstd_dictionary& d) { return d.id() == dictId; });
+				if (it == dicts.end() or !f->set_dictionary(*it))
+				{
+					if (log_writes)
+						printf("%s needs dictionary %08x, which we don't have\n", file_path.c_str(), dictId);
+					return false;
+				}
+			}
+
+			f->write(head.data(), head.size());
+			head.clear();
+			return true;
+		};
+
+		bool res = read([&](const uint8_t* data, unsigned len) {
+			if (f)
+				return f->write((const char*)data, len);
+			if (arc)
+				return arc->write((const char*)data, len) and arc->good();
+
+			head.append((const char*)data, len);
+			if (head.size() >= cimbar::zstd_header_check::MAX_HEADER_SIZE)
+				return open();
+			return true;
+		});
+		if (res and !f and !arc)
+			res = open();
+		// a truncated archive is a failure, not a short file
+		if (res and arc)
+			res = arc->done();
+		if (!res)
+		{
+			if (f)
+			{
+				f.reset();
+				std::filesystem::remove(file_path);
+			}
+			if (arc)
+			{
+				arc->remove_all();
+				arc.reset();
+			}
+			return "";
+		}
+
+		if (log_writes and arc)
+		{
+			for (const std::string& name : arc->files())
+				printf("%s/%s\n", file_path.c_str(), name.c_str());
+		}
+		else if (log_writes and strategy)
+			printf("%s (compression strategy %u, level %d)\n", file_path.c_str(), strategy->strategy, strategy->level);
+		else if (log_writes)
 			printf("%s\n", file_path.c_str());
 		return filename;
 	};
 }
 
 
+// the receiving half of FountainSegments. Wraps another store fun.
+// segments are written at their offsets into "<data_dir>/.<tag>.part". Once the manifest and every segment
+// have landed, the assembled payload goes through `store`, same as any other file would.
+// streams that aren't segments go straight to `store`.
+// copies share state. The sink keeps finished pieces apart from finished files (see is_piece()),
+// and calls expire() when one ages out -- so a transfer that stops coming in is dropped, part file and all.
+class segmented_on_store
+{
+protected:
+	struct transfer
+	{
+		std::string fallbackName;
+		uint64_t size = 0;
+		unsigned count = 0;
+		std::unordered_set<unsigned> segments;
+		std::string lastPiece; // the name we returned for the newest piece
+	};
+
+public:
+	segmented_on_store(std::string data_dir, fountain_store_fun store)
+		: _dataDir(std::move(data_dir))
+		, _store(std::move(store))
+		, _transfers(std::make_shared<std::unordered_map<uint32_t, transfer>>())
+	{
+	}
+
+	std::string operator()(const std::string& fallback_name, const fountain_block_reader& read) const
+	{
+		// a peek at the header. recover_blocks() starts with a batch of one, so this only costs block 0
+		std::string head;
+		read([&head](const uint8_t* data, unsigned len) {
+			head.append((const char*)data, std::min<size_t>(len, FountainSegments::HEADER_SIZE - head.size()));
+			return head.size() < FountainSegments::HEADER_SIZE;
+		});
+
+		auto header = FountainSegments::read_header(head.data(), head.size());
+		if (!header)
+			return _store(fallback_name, read);
+
+		std::string part_path = get_part_path(header->tag);
+		transfer& t = (*_transfers)[header->tag];
+		if (header->type == FountainSegments::MANIFEST_TYPE)
+		{
+			// fallback names are "<encode_id>.<size>". Use the size of the whole thing, not the manifest's
+			t.fallbackName = fmt::format("{}.{}", fallback_name.substr(0, fallback_name.find('.')), header->size_or_offset);
+			t.count = header->count_or_index;
+			t.size = header->size_or_offset;
+		}
+		else
+		{
+			{
+				std::ofstream touch(part_path, std::ios::binary | std::ios::app);
+			}
+			std::fstream f(part_path, std::ios::binary | std::ios::in | std::ios::out);
+			f.seekp(header->size_or_offset);
+
+			unsigned skip = FountainSegments::HEADER_SIZE;
+			bool res = read([&](const uint8_t* data, unsigned len) {
+				unsigned s = std::min(skip, len);
+				skip -= s;
+				f.write((const char*)data + s, len - s);
+				return f.good();
+			});
+			if (!res)
+				return "";
+			t.segments.insert(header->count_or_index);
+		}
+
+		if (t.count == 0 or t.segments.size() < t.count)
+		{
+			t.lastPiece = fallback_name;
+			return fallback_name; // this piece is done, the file isn't yet
+		}
+
+		// everything's here. Run the assembled payload through the real store
+		uint64_t size = t.size;
+		std::string filename = _store(t.fallbackName, [&part_path, size](const std::function<bool(const uint8_t*, unsigned)>& fun) {
+			std::ifstream f(part_path, std::ios::binary);
+			std::vector<char> buff(0x10000);
+			for (uint64_t remaining = size; remaining > 0;)
+			{
+				f.read(buff.data(), std::min<uint64_t>(buff.size(), remaining));
+				if (f.gcount() <= 0)
+					return false;
+				if (!fun((const uint8_t*)buff.data(), f.gcount()))
+					return false;
+				remaining -= f.gcount();
+			}
+			return true;
+		});
+
+		std::filesystem::remove(part_path);
+		_transfers->erase(header->tag);
+		return filename;
+	}
+
+	// `name` aged out of the sink's done list. If it was the newest piece of a transfer,
+	// everything else we had for it is older still -- so the sender has moved on. Clean up.
+	void expire(const std::string& name) const
+	{
+		if (name.empty())
+			return;
+		for (auto it = _transfers->begin(); it != _transfers->end(); ++it)
+		{
+			if (it->second.lastPiece != name)
+				continue;
+			std::error_code ec;
+			std::filesystem::remove(get_part_path(it->first), ec);
+			_transfers->erase(it);
+			return;
+		}
+	}
+
+	// true iff `name` is what we just returned for a piece of a transfer that isn't finished yet
+	bool is_piece(const std::string& name) const
+	{
+		for (auto&& [tag, t] : *_transfers)
+			if (t.lastPiece == name)
+				return true;
+		return false;
+	}
+
+	unsigned num_transfers() const
+	{
+		return _transfers->size();
+	}
+
+protected:
+	std::string get_part_path(uint32_t tag) const
+	{
+		return fmt::format("{}/.{:08x}.part", _dataDir, tag);
+	}
+
+protected:
+	std::string _dataDir;
+	fountain_store_fun _store;
+	std::shared_ptr<std::unordered_map<uint32_t, transfer>> _transfers;
+};
+
+
 class fountain_decoder_sink
 {
 public:
-	fountain_decoder_sink(unsigned chunk_size, const std::function<std::string(const std::string&, const std::vector<uint8_t>&)>& on_store=nullptr)
+	static const size_t DEFAULT_MEMORY_BUDGET = 0x10000000; // 256MB, summed over the wirehair decoders
+	static const unsigned DEFAULT_MAX_DONE = 1024;
+
+	struct eviction_stats
+	{
+		unsigned streams = 0; // in-progress streams dropped to stay under the memory budget
+		uint64_t blocks = 0; // ... and how many received blocks went with them
+		unsigned done = 0; // finished ids aged out of the done list
+	};
+
+public:
+	fountain_decoder_sink(unsigned chunk_size, const fountain_store_fun& on_store=nullptr)
 		: _chunkSize(chunk_size)
 		, _onStore(on_store)
 	{
 	}
 
+	// finished segments are tracked apart from finished files, and cleaned up when they age out of the done list
+	fountain_decoder_sink(unsigned chunk_size, const segmented_on_store& on_store)
+		: _chunkSize(chunk_size)
+		, _onStore(on_store)
+		, _segmented(on_store)
+	{
+	}
+
 	bool good() const
 	{
 		return true;
@@ -69,6 +328,78 @@ public:
 		return _chunkSize;
 	}
 
+	// for a mode change. The streams in progress were cut into the old size of chunk, so they go --
+	// everything else (the done list, the journal, the settings) stays.
+	void set_chunk_size(unsigned chunk_size)
+	{
+		if (chunk_size == _chunkSize)
+			return;
+		if (_journal)
+			for (auto&& [id, ts] : _streams)
+				_journal->forget(id);
+		_streams.clear();
+		_memoryUsage = 0;
+		_chunkSize = chunk_size;
+	}
+
+	void set_memory_budget(size_t bytes)
+	{
+		_memoryBudget = bytes;
+	}
+
+	// threads to rebuild finished files with
+	void set_recover_threads(unsigned threads)
+	{
+		_recoverPool = (threads > 1)? std::make_unique<FountainRecoverPool>(threads) : nullptr;
+	}
+
+	// resume from (and keep adding to) an on-disk journal of the chunks we've received. See FountainJournal.
+	// anything the journal has is replayed first -- which may finish (and store) a file or two.
+	bool set_journal(std::shared_ptr<FountainJournal> journal)
+	{
+		_journal = nullptr;
+		bool res = journal->replay(
+			[this](uint32_t id, const std::string& filename) {
+				if (filename.empty())
+					mark_piece_done(FountainMetadata(id), filename);
+				else
+					mark_done(FountainMetadata(id), filename);
+			},
+			[this](const char* data, unsigned len) {
+				if (len == _chunkSize)
+					decode_frame(data, len);
+			}
+		);
+		if (!res)
+			return false;
+
+		// anything that finished during the replay
+		for (auto&& [id, filename] : _done)
+			if (!journal->is_done(id))
+				journal->mark_done(id, filename);
+		for (auto&& [id, name] : _pieces)
+			if (!journal->is_done(id))
+				journal->mark_done(id, "");
+		_journal = journal;
+		return true;
+	}
+
+	void set_max_done(unsigned max_done)
+	{
+		_maxDone = max_done;
+		trim_done();
+	}
+
+	size_t memory_usage() const
+	{
+		return _memoryUsage;
+	}
+
+	const eviction_stats& evictions() const
+	{
+		return _evictions;
+	}
+
 	std::string get_filename(const FountainMetadata& md) const
 	{
 		return fmt::format("{}.{}", md.encode_id(), md.file_size());
@@ -78,21 +409,45 @@ public:
 	{
 		if (_onStore)
 		{
-			auto res = s.recover();
-			if (!res)
+			std::string filename = _onStore(get_filename(md), [this, &s](const std::function<bool(const uint8_t*, unsigned)>& fun) {
+				return s.recover_blocks(fun, _recoverPool.get());
+			});
+			if (filename.empty())
 				return false;
-			std::string filename = _onStore(get_filename(md), *res);
-			mark_done(md, filename);
+			if (_segmented and _segmented->is_piece(filename))
+				mark_piece_done(md, filename);
+			else
+				mark_done(md, filename);
 		}
 		return true;
 	}
 
 	void mark_done(const FountainMetadata& md, const std::string& filename)
 	{
-		_done[md.id()] = filename;
-		auto it = _streams.find(stream_slot(md));
-		if (it != _streams.end())
-			_streams.erase(it);
+		if (_journal)
+			_journal->mark_done(md.id(), filename);
+		auto [it, isNew] = _done.insert_or_assign(md.id(), filename);
+		if (isNew)
+		{
+			_doneOrder.push_back(md.id());
+			trim_done();
+		}
+		erase_stream(md.id());
+	}
+
+	// a finished stream that's only part of a file (a segment). We won't decode it again, but it isn't in get_done().
+	// the journal gets it without a name.
+	void mark_piece_done(const FountainMetadata& md, const std::string& name)
+	{
+		if (_journal)
+			_journal->mark_done(md.id(), "");
+		auto [it, isNew] = _pieces.insert_or_assign(md.id(), name);
+		if (isNew)
+		{
+			_doneOrder.push_back(md.id());
+			trim_done();
+		}
+		erase_stream(md.id());
 	}
 
 	unsigned num_streams() const
@@ -116,8 +471,9 @@ public:
 	std::vector<double> get_progress() const
 	{
 		std::vector<double> progress;
-		for (auto&& [slot, s] : _streams)
+		for (auto&& [id, ts] : _streams)
 		{
+			const fountain_decoder_stream& s = ts.stream;
 			unsigned br = s.blocks_required();
 			if (br)
 				progress.push_back( s.progress() * 1.0 / s.blocks_required() );
@@ -127,7 +483,27 @@ public:
 
 	bool is_done(uint32_t id) const
 	{
-		return _done.find(id) != _done.end();
+		return _done.find(id) != _done.end() or _pieces.find(id) != _pieces.end();
+	}
+
+	// true iff we've received enough blocks to recover `id`, but haven't done so yet.
+	// (i.e. there's no on_store callback, and the caller should schedule a recover())
+	bool is_solvable(uint32_t id) const
+	{
+		auto it = _streams.find(id);
+		if (it == _streams.end())
+			return false;
+		return it->second.stream.solvable();
+	}
+
+	// create the decoder for a stream before its first chunk arrives,
+	// so the wirehair allocation doesn't land on the decode path.
+	bool prepare(const FountainMetadata& md)
+	{
+		if (!md.file_size() or is_done(md.id()))
+			return false;
+		fountain_decoder_stream* s = find_or_create(md);
+		return s and s->good();
 	}
 
 	int64_t decode_frame(const char* data, unsigned size)
@@ -147,12 +523,15 @@ public:
 		if (is_done(md.id()))
 			return -1;
 
-		// find or create
-		auto p = _streams.try_emplace(stream_slot(md), md.file_size(), _chunkSize);
-		fountain_decoder_stream& s = p.first->second;
-		if (s.data_size() != md.file_size())
+		fountain_decoder_stream* sp = find_or_create(md);
+		if (!sp)
 			return -12;
+		fountain_decoder_stream& s = *sp;
 
+		// the journal wants them one chunk at a time, so they can be deduped
+		if (_journal)
+			for (unsigned i = 0; i + _chunkSize <= size; i += _chunkSize)
+				_journal->append(data + i, _chunkSize);
 		bool finished = s.write(data, size);
 		if (!finished)
 			return 0;
@@ -183,32 +562,107 @@ public:
 		// after the data is copied to `data`,
 		// the stream will be dropped from RAM (`mark_done()`)
 		FountainMetadata md(id);
-		auto p = _streams.find(stream_slot(md));
+		auto p = _streams.find(id);
 		if (p == _streams.end())
 			return false;
 
-		fountain_decoder_stream& s = p->second;
+		fountain_decoder_stream& s = p->second.stream;
 		bool res = s.recover(data, size);
 		mark_done(md, get_filename(md));
 		return res;
 	}
 
 protected:
-	// streams is limited to at most 8 decoders at a time. Currently, we just use the lower bits of the encode_id.
-	uint8_t stream_slot(const FountainMetadata& md) const
+	struct tracked_stream
+	{
+		tracked_stream(unsigned data_size, unsigned chunk_size)
+			: stream(data_size, chunk_size)
+		{}
+
+		fountain_decoder_stream stream;
+		uint64_t lastUsed = 0;
+	};
+
+	fountain_decoder_stream* find_or_create(const FountainMetadata& md)
+	{
+		uint32_t id = md.id();
+		auto it = _streams.find(id);
+		if (it == _streams.end())
+		{
+			// make room for the newcomer before wirehair allocates anything
+			make_room(fountain_decoder_stream::memory_estimate(md.file_size(), _chunkSize));
+			it = _streams.try_emplace(id, md.file_size(), _chunkSize).first;
+			_memoryUsage += it->second.stream.memory_usage();
+		}
+
+		it->second.lastUsed = ++_tick;
+		return &it->second.stream;
+	}
+
+	void erase_stream(uint32_t id)
 	{
-		return md.encode_id() & 0x7;
+		auto it = _streams.find(id);
+		if (it == _streams.end())
+			return;
+		_memoryUsage -= it->second.stream.memory_usage();
+		_streams.erase(it);
+	}
+
+	// evict the least recently used streams until `incoming` more bytes fit in the budget.
+	// the stream table is small (a handful of concurrent transfers), so a linear scan is fine.
+	void make_room(size_t incoming)
+	{
+		while (!_streams.empty() and _memoryUsage + incoming > _memoryBudget)
+		{
+			auto oldest = _streams.begin();
+			for (auto it = _streams.begin(); it != _streams.end(); ++it)
+				if (it->second.lastUsed < oldest->second.lastUsed)
+					oldest = it;
+
+			_evictions.streams += 1;
+			_evictions.blocks += oldest->second.stream.progress();
+			if (_journal)
+				_journal->forget(oldest->first);
+			erase_stream(oldest->first);
+		}
+	}
+
+	void trim_done()
+	{
+		while (_doneOrder.size() > _maxDone)
+		{
+			uint32_t id = _doneOrder.front();
+			_doneOrder.pop_front();
+			_evictions.done += 1;
+			_done.erase(id);
+
+			auto it = _pieces.find(id);
+			if (it == _pieces.end())
+				continue;
+			if (_segmented)
+				_segmented->expire(it->second);
+			_pieces.erase(it);
+		}
 	}
 
 protected:
 	unsigned _chunkSize;
-	std::function<std::string(const std::string&, const std::vector<uint8_t>&)> _onStore;
+	fountain_store_fun _onStore;
+	std::optional<segmented_on_store> _segmented;
+	std::unique_ptr<FountainRecoverPool> _recoverPool; // iff set_recover_threads() > 1
 
-	// maybe instead of unordered_map+set, something where we can "age out" old streams?
-	// e.g. most recent 16/8, or something?
-	// question is what happens to _done/_streams when we wrap for continuous data streaming...
-	std::unordered_map<uint8_t, fountain_decoder_stream> _streams;
-	// track the uint32_t combo of (encode_id,size) to avoid redundant work
+	// in-progress streams, keyed by the uint32_t combo of (encode_id,size)
+	std::unordered_map<uint32_t, tracked_stream> _streams;
+	size_t _memoryUsage = 0;
+	size_t _memoryBudget = DEFAULT_MEMORY_BUDGET;
+	uint64_t _tick = 0;
+
+	// track finished ids to avoid redundant work. Oldest entries age out first.
 	std::unordered_map<uint32_t, std::string> _done;
-	bool _logWrites;
+	std::unordered_map<uint32_t, std::string> _pieces; // ... and finished segments, which aren't files of their own
+	std::deque<uint32_t> _doneOrder;
+	unsigned _maxDone = DEFAULT_MAX_DONE;
+
+	eviction_stats _evictions;
+	std::shared_ptr<FountainJournal> _journal;
 };
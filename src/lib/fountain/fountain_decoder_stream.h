@@ -10,6 +10,15 @@ class fountain_decoder_stream
 public:
 	static const unsigned _headerSize = 6;
 
+	// a rough figure for what the wirehair decoder will allocate: input and recovery blocks,
+	// plus peeling/GE bookkeeping per block. Good enough to budget against.
+	static size_t memory_estimate(unsigned data_size, unsigned buffer_size)
+	{
+		unsigned blockSize = buffer_size > _headerSize? buffer_size - _headerSize : 1;
+		size_t blocks = (data_size / blockSize) + 2;
+		return buffer_size + (blocks * blockSize * 2) + (blocks * 64);
+	}
+
 public:
 	fountain_decoder_stream(unsigned data_size, unsigned buffer_size)
 	    : _buffer(buffer_size, 0)
@@ -42,6 +51,21 @@ public:
 		return _decoder.good();
 	}
 
+	size_t memory_usage() const
+	{
+		return memory_estimate(data_size(), _buffer.size());
+	}
+
+	bool needs_more() const
+	{
+		return _decoder.needs_more();
+	}
+
+	bool solvable() const
+	{
+		return _decoder.solvable();
+	}
+
 	bool decode()
 	{
 		// if we're full
@@ -88,6 +112,13 @@ public:
 		return _decoder.recover();
 	}
 
+	// fun(const uint8_t* data, unsigned len) -> bool, called in order for every block of the file
+	template <typename FUN>
+	bool recover_blocks(const FUN& fun, FountainRecoverPool* pool=nullptr)
+	{
+		return _decoder.recover_blocks(fun, pool);
+	}
+
 protected:
 	std::vector<uint8_t> _buffer;
 	FountainDecoder _decoder;
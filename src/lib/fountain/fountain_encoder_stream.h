@@ -3,9 +3,14 @@
 
 #include "FountainEncoder.h"
 #include "FountainMetadata.h"
+#include "FountainSchedule.h"
+#include "FountainSegments.h"
+#include <algorithm>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <vector>
 
 class fountain_encoder_stream
 {
@@ -17,18 +22,75 @@ protected:
 
 protected:
 	fountain_encoder_stream(std::string&& data, unsigned buffer_size, uint8_t encode_id)
-		: _data(data)
+		: _data(std::move(data))
 		, _buffer(buffer_size, 0)
 		, _encodeId(encode_id)
 		, _encoder((uint8_t*)_data.data(), _data.size(), block_size())
+		, _size(_data.size())
 	{
 	}
 
+	// one segment: its header, then `length` bytes of someone else's buffer. That buffer has to outlive us.
+	// the encoder (and the copy of the data it wants) only exists between load() and unload().
+	fountain_encoder_stream(std::string&& header, const char* view, size_t length, unsigned buffer_size, uint8_t encode_id)
+		: _buffer(buffer_size, 0)
+		, _encodeId(encode_id)
+		, _encoder(nullptr, 0, block_size())
+		, _size(header.size() + length)
+		, _header(std::move(header))
+		, _view(view)
+	{
+	}
+
+	// segmented: we keep the payload, and hand out runs of chunks from a few segments at a time. [0] is the manifest.
+	fountain_encoder_stream(std::string&& data, std::vector<ptr>&& segments, unsigned buffer_size, uint8_t encode_id)
+		: _data(std::move(data))
+		, _buffer(buffer_size, 0)
+		, _encodeId(encode_id)
+		, _encoder(nullptr, 0, block_size())
+		, _size(_data.size())
+		, _segments(std::move(segments))
+	{
+		restart();
+	}
+
 	unsigned block_size() const
 	{
 		return _buffer.size() - _headerSize;
 	}
 
+	static fountain_encoder_stream::ptr make(std::string&& data, unsigned buffer_size, uint8_t encode_id)
+	{
+		if (!FountainSegments::needed(data.size(), buffer_size - _headerSize))
+			return fountain_encoder_stream::ptr( new fountain_encoder_stream(std::move(data), buffer_size, encode_id) );
+
+		// the segments are views into `data`. The string's buffer doesn't move when we move the string into the parent.
+		std::vector<ptr> segments = make_segments(data, buffer_size, encode_id);
+		return fountain_encoder_stream::ptr( new fountain_encoder_stream(std::move(data), std::move(segments), buffer_size, encode_id) );
+	}
+
+	// the manifest, then the segments
+	static std::vector<ptr> make_segments(const std::string& data, unsigned buffer_size, uint8_t encode_id)
+	{
+		unsigned blockSize = buffer_size - _headerSize;
+		std::vector<FountainSegments::segment> layout = FountainSegments::layout(data.size(), blockSize);
+		uint32_t tag = FountainSegments::tag(encode_id, data.size());
+
+		std::vector<ptr> segments;
+		std::string manifest = FountainSegments::manifest(tag, layout.size(), data.size());
+		if (manifest.size() <= blockSize)
+			manifest.resize(blockSize + 1, '\0'); // wirehair wants at least 2 blocks
+		segments.push_back( ptr(new fountain_encoder_stream(std::move(manifest), buffer_size, encode_id)) );
+
+		for (unsigned i = 0; i < layout.size(); ++i)
+		{
+			const FountainSegments::segment& seg = layout[i];
+			std::string header = FountainSegments::segment_header(tag, i, seg.offset);
+			segments.push_back( ptr(new fountain_encoder_stream(std::move(header), data.data() + seg.offset, seg.length, buffer_size, encode_id)) );
+		}
+		return segments;
+	}
+
 public:
 	template <typename STREAM>
 	static fountain_encoder_stream::ptr create(STREAM& stream, unsigned buffer_size, uint8_t encode_id=0)
@@ -36,47 +98,115 @@ public:
 		std::stringstream buffs;
 		if (stream)
 			buffs << stream.rdbuf();
-		return fountain_encoder_stream::ptr( new fountain_encoder_stream(buffs.str(), buffer_size, encode_id & 0x7F) );
+		return make(buffs.str(), buffer_size, encode_id & 0x7F);
+	}
+
+	// takes ownership of the buffer. wirehair reads it in place.
+	static fountain_encoder_stream::ptr create(std::string&& data, unsigned buffer_size, uint8_t encode_id=0)
+	{
+		return make(std::move(data), buffer_size, encode_id & 0x7F);
+	}
+
+	// >1 iff the payload was too big for a single stream
+	unsigned num_segments() const
+	{
+		return _segments.empty()? 1 : _segments.size() - 1;
 	}
 
 	// this resets the stream!
 	// but you might need to do if you change other parameters
 	// ex: different ECC settings => different payload size => different fountain buffer size
+	// a segmented stream gets a new layout (and manifest) for the new block size. So might one that wasn't segmented before.
 	bool restart_and_resize_buffer(unsigned buffer_size)
 	{
-		if (buffer_size > _data.size())
+		if (buffer_size > _size)
 			return false;
 
 		_buffer.resize(buffer_size);
-		_encoder = FountainEncoder((uint8_t*)_data.data(), _data.size(), block_size());
-		restart();
+		_active.clear();
+		if (_view == nullptr and FountainSegments::needed(_data.size(), block_size()))
+		{
+			_segments = make_segments(_data, buffer_size, _encodeId);
+			_encoder = FountainEncoder(nullptr, 0, block_size());
+		}
+		else
+		{
+			_segments.clear();
+			if (!_data.empty()) // else it'll happen on load()
+				_encoder = FountainEncoder((uint8_t*)_data.data(), _data.size(), block_size());
+		}
+
+		if (_schedule)
+			set_schedule(_runLength);
+		else
+			restart();
 		return true;
 	}
 
+	// the number of chunks in a frame. Segments take turns a run of this many chunks at a time,
+	// so that every frame is all one stream -- the decoder guesses a frame's headers from its first one.
+	// this resets a segmented stream.
+	void set_run_length(unsigned run_length)
+	{
+		_runLength = run_length;
+		if (!_segments.empty())
+			restart();
+	}
+
+	// for streams that are shown on a loop: see FountainSchedule.
+	// run_length is the number of chunks in a frame. This resets the stream.
+	void set_schedule(unsigned run_length)
+	{
+		_runLength = run_length;
+		_schedule.emplace(_encodeId, blocks_required(), _runLength); // segmented, it's the segments' that get used
+		for (ptr& seg : _segments)
+			seg->set_schedule(run_length);
+		restart();
+	}
+
+	// segments outside the window don't have an encoder, and that's fine
 	bool good() const
 	{
-		return _encoder.good() and _data.size() > _encoder.packet_size();
+		if (!_segments.empty())
+			return _segments[0]->good() and std::all_of(_active.begin(), _active.end(), [this](unsigned idx) { return _segments[idx]->good(); });
+		return _encoder.good() and _size > _encoder.packet_size();
 	}
 
+	// with a schedule, this only resets block_count(). The block ids carry on where they were.
 	void restart()
 	{
 		_block = 0;
 		_buffIndex = ~0U;
 		_lastRead = 0;
+
+		if (!_segments.empty())
+		{
+			for (ptr& seg : _segments)
+				seg->restart();
+			_buffIndex = 0;
+			start_window();
+		}
 	}
 
 	unsigned block_count() const
 	{
+		if (!_segments.empty())
+			return sum([](const ptr& seg) { return seg->block_count(); });
 		return _block;
 	}
 
 	unsigned blocks_required() const
 	{
-		return (_data.size() / block_size()) + 1;
+		if (!_segments.empty())
+			return sum([](const ptr& seg) { return seg->blocks_required(); });
+		return (_size / block_size()) + 1;
 	}
 
 	void encode_new_block()
 	{
+		if (_schedule)
+			return encode_scheduled_block();
+
 		unsigned char* data = _buffer.data() + _headerSize;
 		size_t res = _encoder.encode(_block++, data, block_size());
 		if (res != block_size())
@@ -84,13 +214,16 @@ public:
 
 		unsigned block = _block - 1; // we already incremented it above
 		// write header
-		FountainMetadata::to_uint8_arr(_encodeId, _data.size(), block, _buffer.data());
+		FountainMetadata::to_uint8_arr(_encodeId, _size, block, _buffer.data());
 		_buffIndex = 0;
 	}
 
 	// sometimes we want a new encoded batch, sometimes we just want our buffer
 	fountain_encoder_stream& read(char* data, unsigned length)
 	{
+		if (!_segments.empty())
+			return read_segments(data, length);
+
 		std::streamsize totalRead = 0;
 		while (length > 0 and good())
 		{
@@ -124,13 +257,136 @@ public:
 		return _lastRead;
 	}
 
+protected:
+	void encode_scheduled_block()
+	{
+		unsigned char* data = _buffer.data() + _headerSize;
+		unsigned block = _schedule->next();
+		size_t res = _encoder.encode(block, data, block_size());
+		if (res != block_size())
+		{
+			block = _schedule->skip();
+			_encoder.encode(block, data, block_size());
+		}
+		++_block;
+
+		FountainMetadata::to_uint8_arr(_encodeId, _size, block, _buffer.data());
+		_buffIndex = 0;
+	}
+
+	// for segments: copy our slice of the payload, and spin up the encoder. Only while we're in the window.
+	// _block and _schedule stay put across unload(), so the next lap picks up where this one left off.
+	void load()
+	{
+		if (_view == nullptr or !_data.empty())
+			return;
+		_data.reserve(_size);
+		_data.assign(_header);
+		_data.append(_view, _size - _header.size());
+		_encoder = FountainEncoder((uint8_t*)_data.data(), _data.size(), block_size());
+	}
+
+	void unload()
+	{
+		if (_view == nullptr)
+			return;
+		_encoder = FountainEncoder(nullptr, 0, block_size());
+		std::string().swap(_data);
+	}
+
+	// segments go out a few at a time -- so the receiver only has a handful of decoders going at once,
+	// and we only have a handful of encoders. Each takes a turn of ~blocks_required() chunks in the window, then the next one slides in.
+	// chunks go out in runs of _runLength (a frame's worth), round robin through the window. Every MANIFEST_INTERVAL-th run is the manifest's.
+	// _buffIndex tracks how far into the current chunk we are.
+	void start_window()
+	{
+		for (unsigned idx : _active)
+			_segments[idx]->unload();
+		_active.clear();
+		_quota.assign(_segments.size(), 0);
+		_nextSegment = 1;
+		_chunks = 0;
+		for (unsigned i = 0; i < FountainSegments::WINDOW and i+1 < _segments.size(); ++i)
+			_active.push_back(next_segment());
+	}
+
+	unsigned next_segment()
+	{
+		unsigned idx = _nextSegment;
+		_nextSegment = (_nextSegment % (_segments.size() - 1)) + 1;
+		unsigned required = _segments[idx]->blocks_required();
+		_quota[idx] = _segments[idx]->block_count() + required + (required / FountainSegments::PASS_OVERHEAD);
+		_segments[idx]->load();
+		return idx;
+	}
+
+	fountain_encoder_stream& read_segments(char* data, unsigned length)
+	{
+		const unsigned run = std::max(1U, _runLength);
+		std::streamsize totalRead = 0;
+		while (length > 0 and good())
+		{
+			bool manifest = ((_chunks / run) % FountainSegments::MANIFEST_INTERVAL) == 0;
+			unsigned idx = manifest? 0 : _active[_block];
+			fountain_encoder_stream& seg = *_segments[idx];
+			unsigned readLen = std::min<unsigned>(length, _buffer.size() - _buffIndex);
+			seg.read(data, readLen);
+			if (seg.gcount() <= 0)
+				break;
+
+			totalRead += seg.gcount();
+			length -= seg.gcount();
+			data += seg.gcount();
+			_buffIndex += seg.gcount();
+			if (_buffIndex < _buffer.size())
+				continue;
+
+			// finished a chunk. At the end of a run, move along
+			_buffIndex = 0;
+			++_chunks;
+			if (manifest or (_chunks % run) != 0)
+				continue;
+			if (seg.block_count() >= _quota[idx] and _segments.size() - 1 > _active.size())
+			{
+				seg.unload();
+				_active[_block] = next_segment();
+			}
+			_block = (_block + 1) % _active.size();
+		}
+		_lastRead = totalRead;
+		return *this;
+	}
+
+	template <typename FUN>
+	unsigned sum(const FUN& fun) const
+	{
+		unsigned total = 0;
+		for (const ptr& seg : _segments)
+			total += fun(seg);
+		return total;
+	}
+
 protected:
 	std::string _data;
 	std::vector<uint8_t> _buffer;
 	uint8_t _encodeId;
 	FountainEncoder _encoder;
+	size_t _size; // of the stream. For an unloaded segment, _data is empty
+
+	// segments: _data is a copy of _header + a slice of the parent's payload, made on load()
+	std::string _header;
+	const char* _view = nullptr;
 
 	unsigned _buffIndex = ~0U;
-	unsigned _block = 0;
+	unsigned _block = 0; // in segmented mode, our position in _active
 	std::streamsize _lastRead = 0;
+
+	std::optional<FountainSchedule> _schedule;
+	unsigned _runLength = 0;
+
+	std::vector<ptr> _segments; // [0] is the manifest
+	std::vector<unsigned> _active;
+	std::vector<unsigned> _quota;
+	unsigned _nextSegment = 1;
+	unsigned _chunks = 0;
 };
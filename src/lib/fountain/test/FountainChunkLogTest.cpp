@@ -0,0 +1,107 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainChunkLog.h"
+#include "fountain_decoder_sink.h"
+#include "fountain_encoder_stream.h"
+
+#include "util/File.h"
+#include "util/MakeTempDirectory.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using std::string;
+
+namespace {
+	string contents(unsigned size)
+	{
+		string res;
+		for (unsigned i = 0; res.size() < size; ++i)
+			res += std::to_string(i*7) + ",";
+		res.resize(size);
+		return res;
+	}
+}
+
+TEST_CASE( "FountainChunkLogTest/testShardAndMerge", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+	string expected = contents(30000);
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(string(expected), 690, 2);
+	unsigned required = fes->blocks_required();
+
+	std::vector<string> chunks;
+	std::array<char, 690> buff;
+	for (unsigned i = 0; i < required + 10; ++i)
+	{
+		fes->readsome(buff.data(), buff.size());
+		chunks.push_back(string(buff.data(), buff.size()));
+	}
+
+	// two shards, neither has enough on its own. They overlap a bit, and see some chunks more than once
+	string shard1 = tempdir.path() / "shard1.log";
+	string shard2 = tempdir.path() / "shard2.log";
+	{
+		fountain_chunk_log_sink log1(shard1, 690);
+		fountain_chunk_log_sink log2(shard2, 690);
+		assertTrue( log1.good() );
+		for (unsigned i = 0; i < chunks.size(); ++i)
+		{
+			if (i < required/2 + 5)
+				log1.write(chunks[i].data(), chunks[i].size());
+			if (i >= required/2 - 5)
+				log2.write(chunks[i].data(), chunks[i].size());
+		}
+		string frame = chunks[0] + chunks[1];
+		assertTrue( log1.write(frame.data(), frame.size()) );
+		assertEquals( required/2 + 5, log1.count() );
+	}
+
+	FountainChunkLog log1(shard1);
+	FountainChunkLog log2(shard2);
+	assertTrue( log1.good() );
+	assertEquals( 690, log1.chunk_size() );
+	assertEquals( required/2 + 5, log1.size() );
+	assertEquals( FountainChunkLog::HEADER_SIZE + log1.size()*690, std::filesystem::file_size(shard1) );
+	assertEquals( 2, log1.metadata(3).encode_id() );
+	assertEquals( 3, log1.metadata(3).block_id() );
+	assertEquals( chunks[3], string(log1.chunk(3), 690) );
+
+	fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+	log1.for_each([&sink](const char* chunk, unsigned len) { sink.decode_frame(chunk, len); });
+	assertEquals( 0, sink.num_done() );
+	log2.for_each([&sink](const char* chunk, unsigned len) { sink.decode_frame(chunk, len); });
+	assertEquals( 1, sink.num_done() );
+	assertEquals( expected, File(tempdir.path() / "2.30000").read_all() );
+}
+
+TEST_CASE( "FountainChunkLogTest/testBadFiles", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+	string path = tempdir.path() / "chunks.log";
+
+	// not a chunk log
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << string(100, 'x');
+	}
+	assertFalse( FountainChunkLog(path).good() );
+	assertFalse( FountainChunkLog(tempdir.path() / "nope.log").good() );
+
+	// a log whose writer died partway through a record
+	{
+		std::ofstream f(path, std::ios::binary);
+		f << FountainChunkLog::header(400);
+		string chunk(400, 'a');
+		FountainMetadata::to_uint8_arr(5, 8000, 1, (uint8_t*)chunk.data());
+		f << chunk << chunk.substr(0, 150);
+	}
+	FountainChunkLog log(path);
+	assertTrue( log.good() );
+	assertEquals( 400, log.chunk_size() );
+	assertEquals( 1, log.size() );
+	assertEquals( 8000, log.metadata(0).file_size() );
+}
@@ -177,3 +177,47 @@ TEST_CASE( "FountainEncodingTest/testWhichN", "[unit]" )
 	assertEquals( 10, decoder.progress() );
 }
 
+
+TEST_CASE( "FountainEncodingTest/testDecoderState", "[unit]" )
+{
+	static const unsigned packetSize = 624;
+
+	unsigned messageSize = 6000;
+	std::string message;
+	while (message.size() < messageSize)
+		message += "0123456789";
+	message.resize(messageSize);
+
+	FountainEncoder encoder((uint8_t*)message.data(), message.size(), packetSize);
+	FountainDecoder decoder(messageSize, packetSize);
+	assertTrue( decoder.needs_more() );
+	assertFalse( decoder.solvable() );
+
+	// high block ids grow the seen bitmap
+	std::array<uint8_t,packetSize> block;
+	std::vector<unsigned> ids = {60000, 3, 4, 1000, 7, 8, 9, 0, 1, 2};
+	for (unsigned i = 0; i < ids.size(); ++i)
+	{
+		unsigned block_id = ids[i];
+		unsigned bites = encoder.encode(block_id, block.data(), block.size());
+		assertFalse( decoder.seen(block_id) );
+		bool res = decoder.decode(block_id, block.data(), bites);
+		assertTrue( decoder.seen(block_id) );
+
+		// dupes are rejected without bothering wirehair
+		assertFalse( decoder.decode(block_id, block.data(), bites) );
+		assertEquals( i+1, decoder.progress() );
+
+		if (res)
+			break;
+		assertTrue( decoder.needs_more() );
+	}
+
+	assertTrue( decoder.solvable() );
+	assertFalse( decoder.needs_more() );
+	assertFalse( decoder.seen(5) );
+
+	std::optional<vector<uint8_t>> reassembled = decoder.recover();
+	assertTrue( reassembled );
+	assertEquals( message, string((char*)reassembled->data(), reassembled->size()) );
+}
@@ -0,0 +1,190 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainJournal.h"
+#include "fountain_decoder_sink.h"
+#include "fountain_encoder_stream.h"
+
+#include "util/File.h"
+#include "util/MakeTempDirectory.h"
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+
+namespace {
+	string contents(unsigned size)
+	{
+		string res;
+		for (unsigned i = 0; res.size() < size; ++i)
+			res += std::to_string(i*i) + "\n";
+		res.resize(size);
+		return res;
+	}
+
+	std::vector<string> make_chunks(fountain_encoder_stream& fes, unsigned count)
+	{
+		std::vector<string> chunks;
+		std::array<char, 690> buff;
+		for (unsigned i = 0; i < count; ++i)
+		{
+			fes.readsome(buff.data(), buff.size());
+			chunks.push_back(string(buff.data(), buff.size()));
+		}
+		return chunks;
+	}
+}
+
+TEST_CASE( "FountainJournalTest/testResume", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+	string journalPath = tempdir.path() / "journal";
+
+	string expected = contents(40000);
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(string(expected), 690, 3);
+	std::vector<string> chunks = make_chunks(*fes, 80);
+	unsigned required = fes->blocks_required();
+
+	// first run: most of the file, and some repeats
+	{
+		fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+		assertTrue( sink.set_journal(std::make_shared<FountainJournal>(journalPath)) );
+		for (unsigned i = 0; i < required - 10; ++i)
+			sink.write(chunks[i].data(), chunks[i].size());
+		for (unsigned i = 0; i < 5; ++i)
+			sink.write(chunks[i].data(), chunks[i].size());
+		assertEquals( 0, sink.num_done() );
+		// ... and then we crash. (well, the journal is synced on the way out)
+	}
+
+	{
+		FountainJournal journal(journalPath);
+		assertEquals( required - 10, journal.on_disk().chunks );
+		assertEquals( 0, journal.on_disk().dead );
+		assertFalse( journal.on_disk().torn );
+	}
+
+	// second run: picks up where we left off
+	string filename = "3.40000";
+	{
+		fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+		assertTrue( sink.set_journal(std::make_shared<FountainJournal>(journalPath)) );
+		assertEquals( 1, sink.num_streams() );
+
+		unsigned i = required;
+		for (; i < chunks.size() and !std::filesystem::exists(tempdir.path() / filename); ++i)
+			sink.write(chunks[i].data(), chunks[i].size());
+		assertTrue( i < required + 20 );
+		assertEquals( 1, sink.num_done() );
+	}
+	assertEquals( expected, File(tempdir.path() / filename).read_all() );
+
+	// third run: the file is done. The journal remembers, and drops the chunks
+	{
+		FountainJournal journal(journalPath);
+		assertEquals( 0, journal.on_disk().chunks );
+		assertEquals( 1, journal.on_disk().done );
+		assertTrue( journal.on_disk().dead > 0 );
+
+		fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+		assertTrue( sink.set_journal(std::make_shared<FountainJournal>(journalPath)) );
+		assertEquals( 0, sink.num_streams() );
+		assertEquals( 1, sink.num_done() );
+		assertEquals( -1, sink.decode_frame(chunks[0].data(), chunks[0].size()) );
+	}
+	{
+		FountainJournal journal(journalPath);
+		assertEquals( 0, journal.on_disk().dead );
+		assertEquals( 1, journal.on_disk().done );
+	}
+}
+
+TEST_CASE( "FountainJournalTest/testTornWrite", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+	string journalPath = tempdir.path() / "journal";
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(contents(40000), 690, 4);
+	std::vector<string> chunks = make_chunks(*fes, 20);
+	{
+		FountainJournal journal(journalPath);
+		assertTrue( journal.replay([](uint32_t, const string&) {}, [](const char*, unsigned) {}) );
+		for (unsigned i = 0; i < 10; ++i)
+			assertTrue( journal.append(chunks[i].data(), chunks[i].size()) );
+		assertFalse( journal.append(chunks[3].data(), chunks[3].size()) ); // already have it
+	}
+
+	// half a record at the end
+	size_t goodSize = std::filesystem::file_size(journalPath);
+	{
+		std::ofstream f(journalPath, std::ios::binary | std::ios::app);
+		f << string("\x01\xb2\x02\x00\x00", 5) << chunks[10].substr(0, 100);
+	}
+
+	FountainJournal journal(journalPath);
+	assertTrue( journal.on_disk().torn );
+	assertEquals( 10, journal.on_disk().chunks );
+
+	unsigned replayed = 0;
+	assertTrue( journal.replay([](uint32_t, const string&) {}, [&replayed](const char*, unsigned len) { replayed += (len == 690); }) );
+	assertEquals( 10, replayed );
+	assertEquals( goodSize, std::filesystem::file_size(journalPath) );
+
+	// appends land after the good stuff
+	assertTrue( journal.append(chunks[10].data(), chunks[10].size()) );
+	journal.sync();
+	assertEquals( 11, FountainJournal(journalPath).on_disk().chunks );
+}
+
+TEST_CASE( "FountainJournalTest/testCompactAsWeGo", "[unit]" )
+{
+	// a long session: chunks for a stream that finished, and one that got evicted. Neither should stick around
+	MakeTempDirectory tempdir;
+	string journalPath = tempdir.path() / "journal";
+
+	fountain_encoder_stream::ptr big = fountain_encoder_stream::create(contents(2000000), 690, 5);
+	std::vector<string> bigChunks = make_chunks(*big, 1500);
+	fountain_encoder_stream::ptr small = fountain_encoder_stream::create(contents(40000), 690, 6);
+	std::vector<string> smallChunks = make_chunks(*small, 20);
+
+	FountainJournal journal(journalPath);
+	assertTrue( journal.replay([](uint32_t, const string&) {}, [](const char*, unsigned) {}) );
+	for (unsigned i = 0; i < 10; ++i)
+		assertTrue( journal.append(smallChunks[i].data(), smallChunks[i].size()) );
+	for (const string& chunk : bigChunks)
+		assertTrue( journal.append(chunk.data(), chunk.size()) );
+	journal.sync();
+	assertEquals( 1510, journal.on_disk().chunks );
+	assertTrue( std::filesystem::file_size(journalPath) > 1500 * 690 );
+
+	// the big one finishes. That's most of the journal, so it gets rewritten
+	uint32_t bigId = FountainMetadata(bigChunks[0].data(), bigChunks[0].size()).id();
+	assertTrue( journal.mark_done(bigId, "big.txt") );
+	assertEquals( 10, journal.on_disk().chunks );
+	assertEquals( 0, journal.on_disk().dead );
+	assertTrue( std::filesystem::file_size(journalPath) < 11 * 700 );
+
+	// appends still work. The small one is still there, and the big one is still done
+	assertTrue( journal.append(smallChunks[10].data(), smallChunks[10].size()) );
+	journal.sync();
+	{
+		FountainJournal reread(journalPath);
+		assertEquals( 11, reread.on_disk().chunks );
+		assertEquals( 1, reread.on_disk().done );
+		assertEquals( 0, reread.on_disk().dead );
+	}
+
+	// forgetting a stream makes its chunks dead weight. A handful aren't worth a rewrite
+	uint32_t smallId = FountainMetadata(smallChunks[0].data(), smallChunks[0].size()).id();
+	journal.forget(smallId);
+	assertEquals( 0, journal.on_disk().chunks );
+	assertEquals( 11, journal.on_disk().dead );
+	assertTrue( journal.compact() );
+	assertEquals( 0, journal.on_disk().dead );
+	assertEquals( 0, FountainJournal(journalPath).on_disk().chunks );
+}
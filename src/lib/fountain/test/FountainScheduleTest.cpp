@@ -0,0 +1,228 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainSchedule.h"
+#include "fountain_decoder_stream.h"
+#include "fountain_encoder_stream.h"
+
+#include "serialize/format.h"
+#include <algorithm>
+#include <array>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::string;
+using namespace std;
+
+namespace {
+	// frames of the stream, as a list of chunks. `restart_every` mimics cimbar_js' loop
+	std::vector<std::vector<string>> make_frames(fountain_encoder_stream& fes, unsigned chunk_size, unsigned chunks_per_frame, unsigned num_frames, unsigned restart_every)
+	{
+		std::vector<std::vector<string>> frames;
+		for (unsigned f = 0; f < num_frames; ++f)
+		{
+			if (restart_every and fes.block_count() > restart_every)
+				fes.restart();
+
+			std::vector<string> frame;
+			for (unsigned c = 0; c < chunks_per_frame; ++c)
+			{
+				string chunk(chunk_size, '\0');
+				fes.read(chunk.data(), chunk.size());
+				frame.push_back(chunk);
+			}
+			frames.push_back(frame);
+		}
+		return frames;
+	}
+
+	// receivers join at a random frame, and miss some of the frames after that.
+	// returns the average number of frames each one had to sit through. (0 == someone never finished)
+	double simulate(const std::vector<std::vector<string>>& frames, unsigned data_size, unsigned chunk_size, unsigned receivers, unsigned max_join, double loss)
+	{
+		std::default_random_engine rng(42);
+		std::uniform_real_distribution<double> drop(0, 1);
+
+		unsigned total = 0;
+		for (unsigned r = 0; r < receivers; ++r)
+		{
+			fountain_decoder_stream fds(data_size, chunk_size);
+			unsigned start = rng() % max_join;
+			unsigned watched = 0;
+			bool done = false;
+			for (unsigned f = start; f < frames.size() and !done; ++f)
+			{
+				++watched;
+				if (drop(rng) < loss)
+					continue;
+				for (unsigned c = 0; c < frames[f].size() and !done; ++c)
+					done = fds.write(frames[f][c].data(), frames[f][c].size());
+			}
+			if (!done)
+				return 0;
+			total += watched;
+		}
+		return (double)total / receivers;
+	}
+}
+
+TEST_CASE( "FountainScheduleTest/testIds", "[unit]" )
+{
+	// 100 systematic blocks, 10 chunks per frame
+	FountainSchedule sched(5, 100, 10);
+	for (unsigned i = 0; i < 100; ++i)
+		assertEquals( i, sched.next() );
+
+	// then repair blocks. Runs of 10 consecutive ids, never repeated
+	std::set<unsigned> seen;
+	for (unsigned run = 0; run < 400; ++run)
+	{
+		unsigned first = sched.next();
+		assertTrue( first >= 100 );
+		assertTrue( seen.insert(first).second );
+		for (unsigned i = 1; i < 10; ++i)
+		{
+			unsigned id = sched.next();
+			assertEquals( first + i, id );
+			assertTrue( seen.insert(id).second );
+		}
+
+		// each encode_id gets 1/128th of the repair ids to itself
+		if (run == 49)
+		{
+			FountainSchedule other(6, 100, 10);
+			for (unsigned i = 0; i < 100; ++i)
+				other.next();
+			for (unsigned i = 0; i < 500; ++i)
+				assertTrue( seen.find(other.next()) == seen.end() );
+		}
+	}
+	assertEquals( 4100, sched.chunks() );
+}
+
+TEST_CASE( "FountainScheduleTest/testPassesAreShuffled", "[unit]" )
+{
+	FountainSchedule sched(0, 50, 5);
+	for (unsigned i = 0; i < 50; ++i)
+		sched.next();
+
+	// two passes of 10 runs each. Same set of ids would be a bug, same order would be a missed opportunity
+	std::vector<unsigned> pass1, pass2;
+	for (unsigned i = 0; i < 50; ++i)
+		pass1.push_back(sched.next());
+	for (unsigned i = 0; i < 50; ++i)
+		pass2.push_back(sched.next());
+
+	std::vector<unsigned> sorted1(pass1), sorted2(pass2);
+	std::sort(sorted1.begin(), sorted1.end());
+	std::sort(sorted2.begin(), sorted2.end());
+	assertTrue( (sorted1 != pass1 or sorted2 != pass2) );
+	assertTrue( sorted1.back() < sorted2.front() );
+}
+
+TEST_CASE( "FountainScheduleTest/testSkip", "[unit]" )
+{
+	// the short block is skipped without costing a chunk -- same as the decoder's header prediction
+	stringstream input;
+	for (int i = 0; i < 1000; ++i)
+		input << "0123456789";
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(input, 636);
+	fes->set_schedule(4);
+	assertEquals( 16, fes->blocks_required() );
+
+	std::array<char, 636> buff;
+	std::vector<unsigned> ids;
+	for (unsigned i = 0; i < 20; ++i)
+	{
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+		ids.push_back(FountainMetadata(buff.data(), buff.size()).block_id());
+	}
+	assertEquals( 20, fes->block_count() );
+
+	// 0-14, 16 (15 is the short one), then the rest of that frame
+	for (unsigned i = 0; i < 15; ++i)
+		assertEquals( i, ids[i] );
+	assertEquals( 16, ids[15] );
+	// the next frame starts somewhere new
+	assertTrue( ids[16] > 16 );
+	for (unsigned i = 17; i < 20; ++i)
+		assertEquals( ids[16] + (i-16), ids[i] );
+
+	// restart() doesn't rewind the ids
+	fes->restart();
+	assertEquals( 0, fes->block_count() );
+	fes->readsome(buff.data(), buff.size());
+	assertTrue( FountainMetadata(buff.data(), buff.size()).block_id() > 16 );
+}
+
+TEST_CASE( "FountainScheduleTest/testSimulateReceivers", "[unit]" )
+{
+	// a receiver that shows up at a random point, and misses 30% of the frames
+	const unsigned chunkSize = 400;
+	const unsigned chunksPerFrame = 10;
+	std::default_random_engine rng(1);
+	string data;
+	for (unsigned i = 0; i < 60000; ++i)
+		data += (char)(rng() & 0xFF);
+
+	fountain_encoder_stream::ptr seq = fountain_encoder_stream::create(string(data), chunkSize, 7);
+	unsigned loop = seq->blocks_required() + chunksPerFrame; // a short loop, so everyone sees it come around
+	unsigned loopFrames = loop / chunksPerFrame;
+	unsigned numFrames = loopFrames * 20;
+	auto seqFrames = make_frames(*seq, chunkSize, chunksPerFrame, numFrames, loop);
+
+	fountain_encoder_stream::ptr sched = fountain_encoder_stream::create(string(data), chunkSize, 7);
+	sched->set_schedule(chunksPerFrame);
+	auto schedFrames = make_frames(*sched, chunkSize, chunksPerFrame, numFrames, loop);
+
+	double seqAvg = simulate(seqFrames, data.size(), chunkSize, 40, loopFrames * 4, 0.3);
+	double schedAvg = simulate(schedFrames, data.size(), chunkSize, 40, loopFrames * 4, 0.3);
+	// every frame we see is new, so we shouldn't need much more than (blocks required / chunks per frame) / (1 - loss)
+	double ideal = (seq->blocks_required() + chunksPerFrame) / (double)chunksPerFrame / 0.7;
+	assertTrue( seqAvg > 0 );
+	assertTrue( schedAvg > 0 );
+	assertTrue( schedAvg < seqAvg );
+	// ... and can't do much better than that, either
+	assertTrue( schedAvg > ideal * 0.9 );
+	assertTrue( schedAvg < ideal * 1.15 );
+}
+
+TEST_CASE( "FountainScheduleTest/testSegmented", "[unit]" )
+{
+	// segments take turns a frame at a time. Within a frame it's all one stream, and the ids count up
+	std::string input;
+	for (unsigned i = 0; input.size() < 2500000; ++i)
+		input += fmt::format("{}\n", i*i);
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::move(input), 40, 5);
+	assertEquals( 5, fes->num_segments() );
+	fes->set_schedule(10);
+
+	std::array<char, 40> buff;
+	std::set<uint32_t> streams;
+	for (unsigned run = 0; run < 80; ++run)
+	{
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+		FountainMetadata first(buff.data(), buff.size());
+		streams.insert(first.id());
+
+		unsigned prev = first.block_id();
+		for (unsigned i = 1; i < 10; ++i)
+		{
+			assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+			FountainMetadata md(buff.data(), buff.size());
+			assertEquals( first.id(), md.id() );
+			// +2 is the short block getting skipped
+			assertTrue( (md.block_id() == prev+1 or md.block_id() == prev+2) );
+			prev = md.block_id();
+		}
+	}
+
+	// the manifest, and the window's worth of segments
+	assertEquals( 5, streams.size() );
+	assertTrue( fes->good() );
+}
@@ -0,0 +1,75 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainSegments.h"
+#include <set>
+#include <string>
+
+TEST_CASE( "FountainSegmentsTest/testNeeded", "[unit]" )
+{
+	assertFalse( FountainSegments::needed(1000000, 684) );
+	assertFalse( FountainSegments::needed(0x1FFFFFF, 684) );
+	assertTrue( FountainSegments::needed(0x2000000, 684) );
+
+	// too many blocks, even though the size fits
+	assertFalse( FountainSegments::needed(63000*100, 100) );
+	assertTrue( FountainSegments::needed(64000*100, 100) );
+}
+
+TEST_CASE( "FountainSegmentsTest/testLayout", "[unit]" )
+{
+	uint64_t size = 100000000;
+	std::vector<FountainSegments::segment> segs = FountainSegments::layout(size, 684);
+	assertEquals( 10, segs.size() );
+
+	// contiguous, and every length (and so every stream size) is different
+	uint64_t offset = 0;
+	std::set<unsigned> lengths;
+	for (const FountainSegments::segment& seg : segs)
+	{
+		assertEquals( offset, seg.offset );
+		assertTrue( seg.length >= FountainSegments::MIN_SEGMENT_SIZE );
+		assertTrue( seg.length + FountainSegments::HEADER_SIZE <= FountainSegments::MAX_STREAM_SIZE );
+		assertTrue( (seg.length + FountainSegments::HEADER_SIZE) / 684 < FountainSegments::MAX_STREAM_BLOCKS );
+		lengths.insert(seg.length);
+		offset += seg.length;
+	}
+	assertEquals( size, offset );
+	assertEquals( segs.size(), lengths.size() );
+}
+
+TEST_CASE( "FountainSegmentsTest/testLayout.TinyRemainder", "[unit]" )
+{
+	uint64_t full = 684 * FountainSegments::MAX_SEGMENT_BLOCKS;
+	std::vector<FountainSegments::segment> segs = FountainSegments::layout(full*2 + 10, 684);
+	assertEquals( 3, segs.size() );
+	assertEquals( full - 1 - FountainSegments::MIN_SEGMENT_SIZE, segs[1].length );
+	assertEquals( FountainSegments::MIN_SEGMENT_SIZE + 11, segs[2].length );
+	assertEquals( full*2 + 10, segs[2].offset + segs[2].length );
+}
+
+TEST_CASE( "FountainSegmentsTest/testHeader", "[unit]" )
+{
+	std::string manifest = FountainSegments::manifest(0xdeadbeef, 12, 0x123456789ULL);
+	assertEquals( FountainSegments::HEADER_SIZE, manifest.size() );
+
+	auto header = FountainSegments::read_header(manifest.data(), manifest.size());
+	assertTrue( header );
+	assertEquals( FountainSegments::MANIFEST_TYPE, header->type );
+	assertEquals( 0xdeadbeef, header->tag );
+	assertEquals( 12, header->count_or_index );
+	assertEquals( 0x123456789ULL, header->size_or_offset );
+
+	std::string seg = FountainSegments::segment_header(0xdeadbeef, 3, 5000000) + "data";
+	header = FountainSegments::read_header(seg.data(), seg.size());
+	assertTrue( header );
+	assertEquals( FountainSegments::SEGMENT_TYPE, header->type );
+	assertEquals( 3, header->count_or_index );
+	assertEquals( 5000000, header->size_or_offset );
+
+	// too short, or not ours
+	assertFalse( FountainSegments::read_header(seg.data(), 10) );
+	seg[8] = 1;
+	assertFalse( FountainSegments::read_header(seg.data(), seg.size()) );
+	assertFalse( FountainSegments::read_header("hello, this is not a header", 27) );
+}
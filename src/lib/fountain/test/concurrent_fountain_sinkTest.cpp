@@ -0,0 +1,109 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#include "unittest.h"
+
+#include "FountainMetadata.h"
+#include "fountain_encoder_stream.h"
+#include "concurrent_fountain_decoder_sink.h"
+
+#include "serialize/format.h"
+#include "serialize/str_join.h"
+#include "util/File.h"
+#include "util/MakeTempDirectory.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::string;
+using namespace std;
+
+namespace {
+	string createChunks(uint8_t encode_id, unsigned size, unsigned count)
+	{
+		stringstream input;
+		for (unsigned i = 0; i < (size/10); ++i)
+			input << "0123456789";
+		fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(input, 690, encode_id);
+
+		string res(690*count, '\0');
+		assertEquals( (std::streamsize)res.size(), fes->readsome(res.data(), res.size()) );
+		return res;
+	}
+
+	class TestableSink : public concurrent_fountain_decoder_sink
+	{
+	public:
+		using concurrent_fountain_decoder_sink::concurrent_fountain_decoder_sink;
+
+		std::mutex& writeMutex()
+		{
+			return _writeMutex;
+		}
+	};
+}
+
+TEST_CASE( "ConcurrentFountainSinkTest/testDefault", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	concurrent_fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+	string chunks = createChunks(0, 1200, 4);
+
+	assertTrue( sink.write(chunks.data(), chunks.size()) );
+	assertEquals( 1, sink.num_done() );
+	assertEquals( "0.1200", turbo::str::join(sink.get_done()) );
+	assertEquals( 0, sink.num_dropped() );
+
+	string contents = File(tempdir.path() / "0.1200").read_all();
+	assertEquals( 1200, contents.size() );
+}
+
+TEST_CASE( "ConcurrentFountainSinkTest/testConsumerThread", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	concurrent_fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+	sink.start_consumer();
+
+	// several producers, one stream each
+	std::vector<std::thread> producers;
+	for (uint8_t id = 0; id < 4; ++id)
+		producers.emplace_back([&sink, id]() {
+			string chunks = createChunks(id, 4000 + id*1000, 12);
+			for (unsigned i = 0; i < chunks.size(); i+=690)
+				sink.write(chunks.data()+i, 690);
+		});
+	for (std::thread& t : producers)
+		t.join();
+
+	sink.stop_consumer();
+	assertEquals( 0, sink.num_dropped() );
+	assertEquals( 4, sink.num_done() );
+
+	for (uint8_t id = 0; id < 4; ++id)
+	{
+		string contents = File(tempdir.path() / fmt::format("{}.{}", id, 4000 + id*1000)).read_all();
+		assertEquals( 4000u + id*1000u, contents.size() );
+	}
+}
+
+TEST_CASE( "ConcurrentFountainSinkTest/testPoolExhausted", "[unit]" )
+{
+	TestableSink sink(690, nullptr, 2);
+	string chunks = createChunks(0, 4000, 3);
+
+	// hold the decoder so nothing drains, and the third chunk has nowhere to go
+	sink.start_consumer();
+	{
+		std::unique_lock<std::mutex> lock(sink.writeMutex());
+		assertTrue( sink.write(chunks.data(), 690*2) );
+		assertFalse( sink.write(chunks.data()+690*2, 690) );
+		assertEquals( 1, sink.num_dropped() );
+	}
+	sink.stop_consumer();
+
+	assertEquals( 1, sink.num_streams() );
+	assertEquals( 0, sink.num_done() );
+}
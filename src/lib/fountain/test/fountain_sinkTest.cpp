@@ -5,6 +5,7 @@
 #include "fountain_encoder_stream.h"
 #include "fountain_decoder_sink.h"
 
+#include "compression/zstd_compressor.h"
 #include "serialize/format.h"
 #include "serialize/str_join.h"
 #include "util/File.h"
@@ -139,3 +140,337 @@ TEST_CASE( "FountainSinkTest/testSameFrameManyTimes", "[unit]" )
 	assertEquals( "0.333333", turbo::str::join(sink.get_progress()) ); // 33% done
 	assertEquals( "", turbo::str::join(sink.get_done()) );
 }
+
+TEST_CASE( "FountainSinkTest/testPrepareAndDeferredRecover", "[unit]" )
+{
+	// no on_store callback: the caller decides when to recover()
+	fountain_decoder_sink sink(690);
+
+	stringstream input = dummyContents(20000);
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(input, 690, 5);
+	FountainMetadata md(5, 20000, 0);
+
+	assertTrue( sink.prepare(md) );
+	assertEquals( 1, sink.num_streams() );
+	assertEquals( "0", turbo::str::join(sink.get_progress()) );
+	assertFalse( sink.is_solvable(md.id()) );
+
+	for (int i = 0; i < 3; ++i)
+	{
+		string iframe = createFrame(*fes);
+		bool finished = sink.write(iframe.data(), iframe.size());
+		assertEquals( (i == 2), finished );
+		assertEquals( (i == 2), sink.is_solvable(md.id()) );
+	}
+
+	std::vector<unsigned char> contents(md.file_size());
+	assertTrue( sink.recover(md.id(), contents.data(), contents.size()) );
+	assertEquals( dummyContents(20000).str(), string(contents.begin(), contents.end()) );
+
+	assertFalse( sink.is_solvable(md.id()) );
+	assertTrue( sink.is_done(md.id()) );
+	assertFalse( sink.prepare(md) );
+	assertEquals( 0, sink.num_streams() );
+}
+
+TEST_CASE( "FountainSinkTest/testSlotCollision", "[unit]" )
+{
+	// encode_ids 1 and 9 used to share a slot. Now they're separate streams.
+	MakeTempDirectory tempdir;
+
+	fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+
+	stringstream input1 = dummyContents(20000);
+	fountain_encoder_stream::ptr fes1 = fountain_encoder_stream::create(input1, 690, 1);
+	stringstream input9 = dummyContents(10000);
+	fountain_encoder_stream::ptr fes9 = fountain_encoder_stream::create(input9, 690, 9);
+
+	for (int i = 0; i < 3; ++i)
+	{
+		string frame1 = createFrame(*fes1);
+		sink.write(frame1.data(), frame1.size());
+		string frame9 = createFrame(*fes9);
+		sink.write(frame9.data(), frame9.size());
+	}
+
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( 2, sink.num_done() );
+	assertEquals( 0, sink.evictions().streams );
+	assertEquals( 0, sink.memory_usage() );
+
+	assertEquals( 20000, File(tempdir.path() / "1.20000").read_all().size() );
+	assertEquals( 10000, File(tempdir.path() / "9.10000").read_all().size() );
+}
+
+TEST_CASE( "FountainSinkTest/testMemoryBudget", "[unit]" )
+{
+	fountain_decoder_sink sink(690);
+
+	size_t oneStream = fountain_decoder_stream::memory_estimate(20000, 690);
+	sink.set_memory_budget(oneStream * 2);
+
+	std::vector<fountain_encoder_stream::ptr> encoders;
+	for (uint8_t encode_id = 0; encode_id < 3; ++encode_id)
+	{
+		stringstream input = dummyContents(20000);
+		encoders.push_back( fountain_encoder_stream::create(input, 690, encode_id) );
+	}
+
+	// one frame for 0 and 1, then touch 0 again so 1 is the oldest
+	for (unsigned i : {0, 1, 0})
+	{
+		string frame = createFrame(*encoders[i]);
+		assertFalse( sink.write(frame.data(), frame.size()) );
+	}
+	assertEquals( 2, sink.num_streams() );
+	assertEquals( oneStream * 2, sink.memory_usage() );
+
+	// a third stream doesn't fit -- the least recently used (1) goes
+	string frame = createFrame(*encoders[2]);
+	assertFalse( sink.write(frame.data(), frame.size()) );
+
+	assertEquals( 2, sink.num_streams() );
+	assertEquals( oneStream * 2, sink.memory_usage() );
+	assertEquals( 1, sink.evictions().streams );
+	assertEquals( 10, sink.evictions().blocks );
+
+	// 0 kept its progress: one more frame finishes it
+	frame = createFrame(*encoders[0]);
+	assertTrue( sink.write(frame.data(), frame.size()) );
+	assertTrue( sink.is_solvable(FountainMetadata(0, 20000, 0).id()) );
+}
+
+TEST_CASE( "FountainSinkTest/testDoneAgesOut", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+	sink.set_max_done(2);
+
+	for (uint8_t encode_id = 0; encode_id < 4; ++encode_id)
+	{
+		string frame = createFrame(encode_id, 1200);
+		assertTrue( sink.write(frame.data(), frame.size()) );
+	}
+
+	assertEquals( 2, sink.num_done() );
+	assertEquals( 2, sink.evictions().done );
+	assertFalse( sink.is_done(FountainMetadata(0, 1200, 0).id()) );
+	assertFalse( sink.is_done(FountainMetadata(1, 1200, 0).id()) );
+	assertTrue( sink.is_done(FountainMetadata(2, 1200, 0).id()) );
+	assertTrue( sink.is_done(FountainMetadata(3, 1200, 0).id()) );
+}
+
+TEST_CASE( "FountainSinkTest/testSetChunkSize", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	fountain_decoder_sink sink(690, write_on_store<std::ofstream>(tempdir.path()));
+	string done = createFrame(0, 1200);
+	assertTrue( sink.write(done.data(), done.size()) );
+
+	// a partial stream
+	string partial = createFrame(1, 20000);
+	assertFalse( sink.write(partial.data(), partial.size()) );
+	assertEquals( 1, sink.num_streams() );
+
+	// same size: nothing happens
+	sink.set_chunk_size(690);
+	assertEquals( 1, sink.num_streams() );
+
+	// new size: the partial stream goes, the done list stays
+	sink.set_chunk_size(345);
+	assertEquals( 345, sink.chunk_size() );
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( 0, sink.memory_usage() );
+	assertTrue( sink.is_done(FountainMetadata(0, 1200, 0).id()) );
+
+	stringstream input = dummyContents(1200);
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(input, 345, 2);
+	string frame = createFrame(*fes);
+	assertTrue( sink.write(frame.data(), frame.size()) );
+	assertEquals( 2, sink.num_done() );
+}
+
+TEST_CASE( "FountainSinkTest/testDecompressOnStore", "[unit]" )
+{
+	// small chunks, so the header is spread over several blocks
+	MakeTempDirectory tempdir;
+
+	std::string expected;
+	for (unsigned i = 0; i < 5000; ++i)
+		expected += fmt::format("{}\n", i*i);
+
+	cimbar::zstd_compressor<std::stringstream> comp;
+	string name = "some/dir/" + string(200, 'a') + ".txt";
+	comp.write_header(name.data(), name.size());
+	comp.write(expected.data(), expected.size());
+
+	fountain_decoder_sink sink(106, decompress_on_store<std::ofstream>(tempdir.path()));
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(comp, 106, 4);
+
+	std::array<char, 106> buff;
+	for (int i = 0; i < 1000 and sink.num_done() == 0; ++i)
+	{
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+		sink.write(buff.data(), buff.size());
+	}
+
+	assertEquals( 1, sink.num_done() );
+	assertEquals( string(200, 'a') + ".txt", turbo::str::join(sink.get_done()) );
+
+	string contents = File(tempdir.path() / (string(200, 'a') + ".txt")).read_all();
+	assertEquals( expected, contents );
+}
+
+TEST_CASE( "FountainSinkTest/testSegmented", "[unit]" )
+{
+	// tiny chunks, so a couple MB is more blocks than one stream can hold
+	MakeTempDirectory tempdir;
+
+	std::string expected;
+	for (unsigned i = 0; expected.size() < 2500000; ++i)
+		expected += fmt::format("{}\n", i*i);
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::string(expected), 40, 5);
+	assertTrue( fes->good() );
+	assertEquals( 5, fes->num_segments() );
+
+	fountain_decoder_sink sink(40, segmented_on_store(tempdir.path(), write_on_store<std::ofstream>(tempdir.path())));
+	sink.set_recover_threads(2);
+
+	std::array<char, 40> buff;
+	string filename = fmt::format("5.{}", expected.size());
+	for (int i = 0; i < 300000 and !std::filesystem::exists(tempdir.path() / filename); ++i)
+	{
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+		sink.write(buff.data(), buff.size());
+	}
+	// the manifest and the segments are done too, but they aren't files
+	assertEquals( 1, sink.num_done() );
+	assertEquals( filename, turbo::str::join(sink.get_done()) );
+
+	string contents = File(tempdir.path() / filename).read_all();
+	assertEquals( expected.size(), contents.size() );
+	assertEquals( expected, contents );
+
+	// we don't decode them again, either
+	for (int i = 0; i < 1000; ++i)
+	{
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+		sink.write(buff.data(), buff.size());
+	}
+	assertEquals( 0, sink.num_streams() );
+	assertEquals( 1, sink.num_done() );
+
+	// the part file is cleaned up
+	unsigned files = 0;
+	for (auto& entry : std::filesystem::directory_iterator(tempdir.path()))
+		files += (entry.path().filename().string()[0] == '.');
+	assertEquals( 0, files );
+}
+
+TEST_CASE( "FountainSinkTest/testSegmented.Abandoned", "[unit]" )
+{
+	// one segment of a transfer that never finishes. Once it ages out of the done list, its part file goes too
+	MakeTempDirectory tempdir;
+
+	segmented_on_store store(tempdir.path(), write_on_store<std::ofstream>(tempdir.path()));
+	fountain_decoder_sink sink(690, store);
+	sink.set_max_done(2);
+
+	std::string piece = FountainSegments::segment_header(0x1234, 1, 5000) + std::string(5000, 'x');
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::move(piece), 690, 3);
+	string frame = createFrame(*fes);
+	sink.write(frame.data(), frame.size());
+
+	std::filesystem::path part = tempdir.path() / ".00001234.part";
+	assertEquals( 0, sink.num_done() );
+	assertTrue( sink.is_done(FountainMetadata(3, 5000 + FountainSegments::HEADER_SIZE, 0).id()) );
+	assertEquals( 1, store.num_transfers() );
+	assertTrue( std::filesystem::exists(part) );
+	assertEquals( 10000, std::filesystem::file_size(part) );
+
+	// other files come and go
+	frame = createFrame(4, 1000);
+	sink.write(frame.data(), frame.size());
+	assertEquals( 1, store.num_transfers() );
+
+	frame = createFrame(5, 1000);
+	sink.write(frame.data(), frame.size());
+	assertEquals( 2, sink.num_done() );
+	assertEquals( 1, sink.evictions().done );
+
+	assertEquals( 0, store.num_transfers() );
+	assertFalse( std::filesystem::exists(part) );
+}
+
+TEST_CASE( "FountainSinkTest/testDecompressOnStore.Dictionary", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	std::string expected;
+	for (unsigned i = 0; i < 200; ++i)
+		expected += fmt::format("{{\"id\": {}, \"name\": \"thing {}\"}}\n", i, i*i);
+	cimbar::zstd_dictionary dict(expected.substr(0, 2000));
+
+	cimbar::zstd_compressor<std::stringstream> comp;
+	comp.set_dictionary(dict);
+	string name = "things.json";
+	comp.write_header(name.data(), name.size());
+	comp.write(expected.data(), expected.size());
+	comp.pad(700);
+	string compressed = comp.str();
+
+	// without the dictionary, we can't store it
+	{
+		fountain_decoder_sink sink(690, decompress_on_store<std::ofstream>(tempdir.path()));
+		fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::string(compressed), 690, 1);
+		string frame = createFrame(*fes);
+		sink.write(frame.data(), frame.size());
+		assertEquals( 0, sink.num_done() );
+		assertFalse( std::filesystem::exists(tempdir.path() / name) );
+	}
+
+	fountain_decoder_sink sink(690, decompress_on_store<std::ofstream>(tempdir.path(), false, {dict}));
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::string(compressed), 690, 1);
+	string frame = createFrame(*fes);
+	sink.write(frame.data(), frame.size());
+	assertEquals( 1, sink.num_done() );
+
+	string contents = File(tempdir.path() / name).read_all();
+	assertEquals( expected, contents );
+}
+
+TEST_CASE( "FountainSinkTest/testDecompressOnStore.Archive", "[unit]" )
+{
+	MakeTempDirectory tempdir;
+
+	std::vector<std::pair<string, string>> files = {
+		{"a.txt", "aaaaaaaaaa"},
+		{"sub/b.txt", dummyContents(2000).str()},
+	};
+
+	cimbar::zstd_compressor<std::stringstream> comp;
+	comp.set_streaming(true);
+	string name = "bundle";
+	comp.write_archive_header(name.data(), name.size());
+	for (const auto& [fn, contents] : files)
+	{
+		string header = cimbar::archive::entry_header(fn, contents.size());
+		comp.write(header.data(), header.size());
+		comp.write(contents.data(), contents.size());
+	}
+	comp.finish();
+	comp.pad(700);
+	string compressed = comp.str();
+
+	fountain_decoder_sink sink(690, decompress_on_store<std::ofstream>(tempdir.path()));
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::string(compressed), 690, 1);
+	string frame = createFrame(*fes);
+	sink.write(frame.data(), frame.size());
+	assertEquals( 1, sink.num_done() );
+
+	for (const auto& [fn, contents] : files)
+		assertEquals( contents, File(tempdir.path() / name / fn).read_all() );
+}
@@ -134,6 +134,28 @@ TEST_CASE( "FountainStreamTest/testEncoder_Consistency", "[unit]" )
 	assertEquals( expected, full.str() );
 }
 
+TEST_CASE( "FountainStreamTest/testEncoder_FromBuffer", "[unit]" )
+{
+	// same output as the stream version, without the copies
+	stringstream input;
+	for (int i = 0; i < 1000; ++i)
+		input << "0123456789";
+
+	fountain_encoder_stream::ptr fromStream = fountain_encoder_stream::create(input, 400, 5);
+	fountain_encoder_stream::ptr fromBuffer = fountain_encoder_stream::create(input.str(), 400, 5);
+	assertTrue( fromBuffer->good() );
+	assertEquals( fromStream->blocks_required(), fromBuffer->blocks_required() );
+
+	std::array<char, 400> expected;
+	std::array<char, 400> actual;
+	for (int i = 0; i < 50; ++i)
+	{
+		assertEquals( 400, fromStream->readsome(expected.data(), expected.size()) );
+		assertEquals( 400, fromBuffer->readsome(actual.data(), actual.size()) );
+		assertEquals( string(expected.data(), expected.size()), string(actual.data(), actual.size()) );
+	}
+}
+
 TEST_CASE( "FountainStreamTest/testEncoder_ChangeBufferSize", "[unit]" )
 {
 	stringstream input;
@@ -184,6 +206,39 @@ TEST_CASE( "FountainStreamTest/testEncoder_ChangeBufferSize_Fails", "[unit]" )
 }
 
 
+TEST_CASE( "FountainStreamTest/testEncoder_ChangeBufferSize_Segmented", "[unit]" )
+{
+	// the segment layout depends on the block size, so it gets redone
+	string input;
+	for (unsigned i = 0; input.size() < 2500000; ++i)
+		input += fmt::format("{}\n", i*i);
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(std::move(input), 40, 5);
+	assertEquals( 5, fes->num_segments() );
+	assertTrue( fes->good() );
+
+	// smaller blocks => more segments. Each one still fits in FountainSegments::MAX_SEGMENT_BLOCKS
+	assertTrue( fes->restart_and_resize_buffer(30) );
+	assertEquals( 7, fes->num_segments() );
+	assertTrue( fes->blocks_required() <= 7 * (FountainSegments::MAX_SEGMENT_BLOCKS + 1) + 2 );
+	assertTrue( fes->good() );
+
+	std::array<char, 30> buff;
+	for (int i = 0; i < 100; ++i)
+		assertEquals( buff.size(), fes->readsome(buff.data(), buff.size()) );
+
+	// big enough blocks, and it's one stream again
+	assertTrue( fes->restart_and_resize_buffer(600) );
+	assertEquals( 1, fes->num_segments() );
+	assertTrue( fes->good() );
+	assertEquals( 4209, fes->blocks_required() );
+
+	// ... and back
+	assertTrue( fes->restart_and_resize_buffer(40) );
+	assertEquals( 5, fes->num_segments() );
+	assertTrue( fes->good() );
+}
+
 TEST_CASE( "FountainStreamTest/testDecode", "[unit]" )
 {
 	stringstream input;
@@ -228,6 +283,37 @@ TEST_CASE( "FountainStreamTest/testDecode", "[unit]" )
 	assertTrue( fes->good() );
 }
 
+TEST_CASE( "FountainStreamTest/testDecode_RecoverBlocks", "[unit]" )
+{
+	string input;
+	for (int i = 0; i < 20000; ++i)
+		input += fmt::format("{}\n", i*i);
+
+	fountain_encoder_stream::ptr fes = fountain_encoder_stream::create(string(input), 830);
+	fountain_decoder_stream fds(input.size(), 830);
+
+	std::array<char, 830> buff;
+	for (int i = 0; i < 1000 and !fds.write(buff.data(), fes->readsome(buff.data(), buff.size())); ++i);
+	assertTrue( fds.good() );
+
+	// on the calling thread, and then with a pool. Same answer either way
+	FountainRecoverPool pool(3);
+	for (FountainRecoverPool* p : {(FountainRecoverPool*)nullptr, &pool, &pool})
+	{
+		string output;
+		assertTrue( fds.recover_blocks([&output](const uint8_t* data, unsigned len) {
+			output.append((const char*)data, len);
+			return true;
+		}, p) );
+		assertEquals( input, output );
+	}
+
+	// stopping early is fine too
+	unsigned calls = 0;
+	assertFalse( fds.recover_blocks([&calls](const uint8_t*, unsigned) { return ++calls < 2; }, &pool) );
+	assertEquals( 2, calls );
+}
+
 TEST_CASE( "FountainStreamTest/testDecode_BigPackets", "[unit]" )
 {
 	stringstream input;
@@ -24,13 +24,30 @@ public:
 	std::string read_all()
 	{
 		std::string res;
+		if (!good())
+			return res;
+
+		// if we can tell how much is left, read it in one go
+		long pos = ftell(_fp);
+		if (pos >= 0 and fseek(_fp, 0, SEEK_END) == 0)
+		{
+			long end = ftell(_fp);
+			fseek(_fp, pos, SEEK_SET);
+			if (end > pos)
+			{
+				res.resize(end - pos);
+				res.resize(read(res.data(), res.size()));
+			}
+		}
+
+		// and for pipes (or a file that's still growing), the slow way
 		std::array<char, 8192> buffer;
 		while (1)
 		{
 			unsigned bytesRead = read(buffer.data(), buffer.size());
 			if (!bytesRead)
 				break;
-			res += std::string(buffer.data(), bytesRead);
+			res.append(buffer.data(), bytesRead);
 		}
 		return res;
 	}
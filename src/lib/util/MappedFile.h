@@ -0,0 +1,82 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include "File.h"
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read-only view of a whole file. mmap'd where we can, so big inputs don't have to be copied in.
+// (on windows, or if the map fails, we fall back to reading it into memory)
+class MappedFile
+{
+public:
+	MappedFile(const std::string& filename)
+	{
+#ifndef _WIN32
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			struct stat st;
+			if (::fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0)
+			{
+				void* addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (addr != MAP_FAILED)
+				{
+					::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+					_map = addr;
+					_data = static_cast<const char*>(addr);
+					_size = st.st_size;
+					_good = true;
+				}
+			}
+			::close(fd);
+		}
+		if (_good)
+			return;
+#endif
+		File f(filename);
+		_good = f.good();
+		_fallback = f.read_all();
+		_data = _fallback.data();
+		_size = _fallback.size();
+	}
+
+	~MappedFile()
+	{
+#ifndef _WIN32
+		if (_map)
+			::munmap(_map, _size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool good() const
+	{
+		return _good;
+	}
+
+	const char* data() const
+	{
+		return _data;
+	}
+
+	size_t size() const
+	{
+		return _size;
+	}
+
+protected:
+	void* _map = nullptr;
+	const char* _data = nullptr;
+	size_t _size = 0;
+	bool _good = false;
+	std::string _fallback;
+};
@@ -0,0 +1,41 @@
+/* This code is subject to the terms of the Mozilla Public License, v.2.0. http://mozilla.org/MPL/2.0/. */
+#pragma once
+
+#include <string>
+
+// write()-only stream into a std::string. reserve() up front, and the writes never reallocate.
+class string_sink
+{
+public:
+	string_sink()
+	{}
+
+	void reserve(size_t size)
+	{
+		_data.reserve(size);
+	}
+
+	string_sink& write(const char* data, size_t length)
+	{
+		_data.append(data, length);
+		return *this;
+	}
+
+	bool good() const
+	{
+		return true;
+	}
+
+	long tellp() const
+	{
+		return _data.size();
+	}
+
+	std::string& str()
+	{
+		return _data;
+	}
+
+protected:
+	std::string _data;
+};
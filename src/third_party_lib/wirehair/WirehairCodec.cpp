@@ -3329,8 +3329,15 @@ WirehairResult Codec::ReconstructBlock(
         PeelRow * GF256_RESTRICT row = _peel_rows;
         const uint8_t * GF256_RESTRICT src = _input_blocks;
 
+        // Originals usually arrive in order, so check the obvious row first.
+        // Otherwise recovering every block this way is O(N^2)
+        uint16_t row_start = 0;
+        if (block_id < _row_count && row[block_id].RecoveryId == block_id) {
+            row_start = block_id;
+        }
+
         // For each row that was received:
-        for (uint16_t row_i = 0, count = _row_count; row_i < count; ++row_i)
+        for (uint16_t row_i = row_start, count = _row_count; row_i < count; ++row_i)
         {
             const uint32_t id = row[row_i].RecoveryId;
 
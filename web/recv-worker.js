@@ -19,10 +19,8 @@ var RecvWorker = function () {
       const format = data.format;
       const width = data.width;
       const height = data.height;
-      const mode = data.mode;
-      if (mode) {
-        Module._cimbard_configure_decode(mode);
-      }
+      // 0 == auto. wasm follows the frame header
+      Module._cimbard_configure_decode(data.mode);
 
       try {
         //console.log(vf);
@@ -61,6 +59,8 @@ var RecvWorker = function () {
         console.log('len is ' + len);
         const msgbuf = new Uint8Array(Module.HEAPU8.buffer, fountainBuff.byteOffset, len).slice();
         //console.log(msgbuf);
+        // the mode we actually decoded as
+        const mode = Module._cimbard_get_mode();
         self.postMessage({ mode: mode, buff: msgbuf }, [msgbuf.buffer]);
       }
       // in main, const receivedArray = event.data.buff;
@@ -343,7 +343,8 @@ var Recv = function () {
       // make sure the camera feed stays up
       Recv.watch_for_camera_pause();
 
-      const modeVals = [66, 68, 67, 4];
+      // 0 is wasm's auto mode: B, unless the frame header says otherwise. The rest are for senders that don't draw a header
+      const modeVals = [0, 66, 67, 4];
 
       var vf = undefined;
       if (_framesInFlight > 20) {